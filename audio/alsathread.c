@@ -37,11 +37,8 @@ typedef struct alsa
    size_t period_size;
    snd_pcm_uframes_t period_frames;
 
-   fifo_buffer_t *buffer;
+   fifo_buffer_t *buffer; // Lock-free, the worker thread is the only reader.
    sthread_t *worker_thread;
-   slock_t *fifo_lock;
-   scond_t *cond;
-   slock_t *cond_lock;
 } alsa_t;
 
 static void alsa_worker_thread(void *data)
@@ -57,12 +54,9 @@ static void alsa_worker_thread(void *data)
 
    while (!alsa->thread_dead)
    {
-      slock_lock(alsa->fifo_lock);
       size_t avail = fifo_read_avail(alsa->buffer);
       size_t fifo_size = min(alsa->period_size, avail);
       fifo_read(alsa->buffer, buf, fifo_size);
-      scond_signal(alsa->cond);
-      slock_unlock(alsa->fifo_lock);
 
       // If underrun, fill rest with silence.
       memset(buf + fifo_size, 0, alsa->period_size - fifo_size);
@@ -88,10 +82,8 @@ static void alsa_worker_thread(void *data)
    }
 
 end:
-   slock_lock(alsa->cond_lock);
    alsa->thread_dead = true;
-   scond_signal(alsa->cond);
-   slock_unlock(alsa->cond_lock);
+   fifo_cancel_wait(alsa->buffer);
    free(buf);
 }
 
@@ -125,12 +117,6 @@ static void alsa_free(void *data)
       }
       if (alsa->buffer)
          fifo_free(alsa->buffer);
-      if (alsa->cond)
-         scond_free(alsa->cond);
-      if (alsa->fifo_lock)
-         slock_free(alsa->fifo_lock);
-      if (alsa->cond_lock)
-         slock_free(alsa->cond_lock);
       if (alsa->pcm)
       {
          snd_pcm_drop(alsa->pcm);
@@ -192,11 +178,8 @@ static void *alsa_init(const char *device, unsigned rate, unsigned latency)
    snd_pcm_hw_params_free(params);
    snd_pcm_sw_params_free(sw_params);
 
-   alsa->fifo_lock = slock_new();
-   alsa->cond_lock = slock_new();
-   alsa->cond = scond_new();
    alsa->buffer = fifo_new(alsa->buffer_size);
-   if (!alsa->fifo_lock || !alsa->cond_lock || !alsa->cond || !alsa->buffer)
+   if (!alsa->buffer)
       goto error;
 
    alsa->worker_thread = sthread_create(alsa_worker_thread, alsa);
@@ -230,11 +213,9 @@ static ssize_t alsa_write(void *data, const void *buf, size_t size)
 
    if (alsa->nonblock)
    {
-      slock_lock(alsa->fifo_lock);
       size_t avail = fifo_write_avail(alsa->buffer);
       size_t write_amt = min(avail, size);
       fifo_write(alsa->buffer, buf, write_amt);
-      slock_unlock(alsa->fifo_lock);
       return write_amt;
    }
    else
@@ -242,24 +223,11 @@ static ssize_t alsa_write(void *data, const void *buf, size_t size)
       size_t written = 0;
       while (written < size && !alsa->thread_dead)
       {
-         slock_lock(alsa->fifo_lock);
-         size_t avail = fifo_write_avail(alsa->buffer);
-
-         if (avail == 0)
-         {
-            slock_unlock(alsa->fifo_lock);
-            slock_lock(alsa->cond_lock);
-            if (!alsa->thread_dead)
-               scond_wait(alsa->cond, alsa->cond_lock);
-            slock_unlock(alsa->cond_lock);
-         }
-         else
-         {
-            size_t write_amt = min(size - written, avail);
-            fifo_write(alsa->buffer, (const char*)buf + written, write_amt);
-            slock_unlock(alsa->fifo_lock);
-            written += write_amt;
-         }
+         // Sleeps until the worker has consumed a period, or has died.
+         size_t avail = fifo_wait_write_avail(alsa->buffer, 1);
+         size_t write_amt = min(size - written, avail);
+         fifo_write(alsa->buffer, (const char*)buf + written, write_amt);
+         written += write_amt;
       }
       return written;
    }
@@ -289,10 +257,7 @@ static size_t alsa_write_avail(void *data)
 
    if (alsa->thread_dead)
       return 0;
-   slock_lock(alsa->fifo_lock);
-   size_t val = fifo_write_avail(alsa->buffer);
-   slock_unlock(alsa->fifo_lock);
-   return val;
+   return fifo_write_avail(alsa->buffer);
 }
 
 static size_t alsa_buffer_size(void *data)
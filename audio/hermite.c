@@ -58,8 +58,11 @@ static inline float hermite_kernel(float mu1, float a, float b, float c, float d
    return (a0 * b) + (a1 * m0) + (a2 * m1) + (a3 * c);
 }
 
-void *resampler_hermite_new(double bandwidth_mod)
+void *resampler_hermite_new(double bandwidth_mod, enum resampler_quality quality, unsigned simd_mask)
 {
+   (void)quality;
+   (void)simd_mask;
+
    if (bandwidth_mod < 1.0)
       RARCH_WARN("Hermite resampler is likely to sound absolutely terrible when downsampling.\n");
 
@@ -15,21 +15,32 @@
 
 #include "resampler.h"
 #include <string.h>
+#include <stdlib.h>
 
 #ifdef HAVE_CONFIG_H
 #include "../config.h"
 #endif
 
 #include "../general.h"
+#include "../performance.h"
 
 static const rarch_resampler_t *backends[] = {
 #ifdef HAVE_SINC
    &sinc_resampler,
+   &polyphase_resampler,
 #endif
    &hermite_resampler,
 };
 
-bool rarch_resampler_realloc(void **re, const rarch_resampler_t **backend, const char *ident, double bw_ratio)
+static unsigned resampler_simd_mask(void)
+{
+   struct rarch_cpu_features cpu;
+   rarch_get_cpu_features(&cpu);
+   return cpu.simd;
+}
+
+bool rarch_resampler_realloc(void **re, const rarch_resampler_t **backend, const char *ident,
+      enum resampler_quality quality, double bw_ratio)
 {
    if (*re && *backend)
       (*backend)->free(*re);
@@ -54,7 +65,7 @@ bool rarch_resampler_realloc(void **re, const rarch_resampler_t **backend, const
    if (!*backend)
       return false;
 
-   *re = (*backend)->init(bw_ratio);
+   *re = (*backend)->init(bw_ratio, quality, resampler_simd_mask());
    if (!*re)
    {
       *backend = NULL;
@@ -64,3 +75,8 @@ bool rarch_resampler_realloc(void **re, const rarch_resampler_t **backend, const
    return true;
 }
 
+const char *rarch_resampler_get_ident(unsigned index)
+{
+   return index < ARRAY_SIZE(backends) ? backends[index]->ident : NULL;
+}
+
@@ -42,9 +42,23 @@ struct resampler_data
    double ratio;
 };
 
+// Trades CPU time for stopband attenuation. Resamplers without a choice ignore it.
+// Values are stable, as they are used in the config file.
+enum resampler_quality
+{
+   RESAMPLER_QUALITY_DONTCARE = 0, // Whatever the resampler was built to default to.
+   RESAMPLER_QUALITY_LOWEST,
+   RESAMPLER_QUALITY_LOWER,
+   RESAMPLER_QUALITY_NORMAL,
+   RESAMPLER_QUALITY_HIGHER,
+   RESAMPLER_QUALITY_HIGHEST
+};
+
 typedef struct rarch_resampler
 {
-   void *(*init)(double bandwidth_mod); // Bandwidth factor. Will be < 1.0 for downsampling, > 1.0 for upsamling. Corresponds to expected resampling ratio.
+   // Bandwidth factor. Will be < 1.0 for downsampling, > 1.0 for upsamling. Corresponds to expected resampling ratio.
+   // simd_mask is a set of RARCH_SIMD_* flags the resampler may use, see performance.h.
+   void *(*init)(double bandwidth_mod, enum resampler_quality quality, unsigned simd_mask);
    void (*process)(void *re, struct resampler_data *data);
    void (*free)(void *re);
    const char *ident;
@@ -52,10 +66,15 @@ typedef struct rarch_resampler
 
 extern const rarch_resampler_t hermite_resampler;
 extern const rarch_resampler_t sinc_resampler;
+extern const rarch_resampler_t polyphase_resampler;
 
 // Reallocs resampler. Will free previous handle before allocating a new one.
 // If ident is NULL, first resampler will be used.
-bool rarch_resampler_realloc(void **re, const rarch_resampler_t **backend, const char *ident, double bw_ratio);
+bool rarch_resampler_realloc(void **re, const rarch_resampler_t **backend, const char *ident,
+      enum resampler_quality quality, double bw_ratio);
+
+// Ident of the index'th resampler built in, or NULL past the last one.
+const char *rarch_resampler_get_ident(unsigned index);
 
 // Convenience macros.
 // freep makes sure to set handles to NULL to avoid double-free in rarch_resampler_realloc.
@@ -31,8 +31,16 @@
 #define RARCH_LOG(...) fprintf(stderr, __VA_ARGS__)
 #endif
 
-#ifdef __SSE__
-#include <xmmintrin.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SINC_SIMD_X86
+#define SINC_TARGET(x) __attribute__((target(x)))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)) && !defined(_XBOX)
+#define SINC_SIMD_X86
+#define SINC_TARGET(x)
+#endif
+
+#ifdef SINC_SIMD_X86
+#include <immintrin.h>
 #endif
 
 // Rough SNR values for upsampling:
@@ -42,74 +50,94 @@
 // HIGHER: 110 dB
 // HIGHEST: 140 dB
 
-// TODO, make all this more configurable.
+enum sinc_window
+{
+   SINC_WINDOW_LANCZOS = 0,
+   SINC_WINDOW_KAISER
+};
+
+struct sinc_params
+{
+   enum sinc_window window;
+   double kaiser_beta;
+   double cutoff;
+   unsigned phase_bits;
+   unsigned subphase_bits;
+   bool lerp;
+   unsigned sidelobes;
+
+   // For the little amount of taps we're using,
+   // SSE1 is faster than AVX for some reason.
+   // By increasing number of sinc taps, the AVX code is clearly faster than SSE1.
+   bool avx;
+};
+
+// Indexed by enum resampler_quality.
+static const struct sinc_params sinc_quality[] = {
+   { SINC_WINDOW_KAISER,  0.0,  0.0,   0,  0,  false, 0,   false }, // DONTCARE, resolved below.
+   { SINC_WINDOW_LANCZOS, 0.0,  0.98,  12, 10, false, 2,   false }, // LOWEST
+   { SINC_WINDOW_LANCZOS, 0.0,  0.98,  12, 10, false, 4,   false }, // LOWER
+   { SINC_WINDOW_KAISER,  5.5,  0.825, 8,  16, true,  8,   false }, // NORMAL
+   { SINC_WINDOW_KAISER,  10.5, 0.90,  10, 14, true,  32,  true  }, // HIGHER
+   { SINC_WINDOW_KAISER,  14.5, 0.95,  10, 14, true,  128, true  }, // HIGHEST
+};
+
+static const char *sinc_quality_names[] = {
+   "default", "lowest", "lower", "normal", "higher", "highest",
+};
+
+// The build can still pick what "don't care" means, e.g. for weak consoles.
 #if defined(SINC_LOWEST_QUALITY)
-#define SINC_WINDOW_LANCZOS
-#define CUTOFF 0.98
-#define PHASE_BITS 12
-#define SINC_COEFF_LERP 0
-#define SUBPHASE_BITS 10
-#define SIDELOBES 2
-#define ENABLE_AVX 0
+#define SINC_DEFAULT_QUALITY RESAMPLER_QUALITY_LOWEST
 #elif defined(SINC_LOWER_QUALITY)
-#define SINC_WINDOW_LANCZOS
-#define CUTOFF 0.98
-#define PHASE_BITS 12
-#define SUBPHASE_BITS 10
-#define SINC_COEFF_LERP 0
-#define SIDELOBES 4
-#define ENABLE_AVX 0
+#define SINC_DEFAULT_QUALITY RESAMPLER_QUALITY_LOWER
 #elif defined(SINC_HIGHER_QUALITY)
-#define SINC_WINDOW_KAISER
-#define SINC_WINDOW_KAISER_BETA 10.5
-#define CUTOFF 0.90
-#define PHASE_BITS 10
-#define SUBPHASE_BITS 14
-#define SINC_COEFF_LERP 1
-#define SIDELOBES 32
-#define ENABLE_AVX 1
+#define SINC_DEFAULT_QUALITY RESAMPLER_QUALITY_HIGHER
 #elif defined(SINC_HIGHEST_QUALITY)
-#define SINC_WINDOW_KAISER
-#define SINC_WINDOW_KAISER_BETA 14.5
-#define CUTOFF 0.95
-#define PHASE_BITS 10
-#define SUBPHASE_BITS 14
-#define SINC_COEFF_LERP 1
-#define SIDELOBES 128
-#define ENABLE_AVX 1
+#define SINC_DEFAULT_QUALITY RESAMPLER_QUALITY_HIGHEST
 #else
-#define SINC_WINDOW_KAISER
-#define SINC_WINDOW_KAISER_BETA 5.5
-#define CUTOFF 0.825
-#define PHASE_BITS 8
-#define SUBPHASE_BITS 16
-#define SINC_COEFF_LERP 1
-#define SIDELOBES 8
-#define ENABLE_AVX 0
+#define SINC_DEFAULT_QUALITY RESAMPLER_QUALITY_NORMAL
 #endif
 
-// For the little amount of taps we're using,
-// SSE1 is faster than AVX for some reason.
-// AVX code is kept here though as by increasing number
-// of sinc taps, the AVX code is clearly faster than SSE1.
+// Output frames computed per call by block kernels.
+#define SINC_BLOCK_FRAMES 4
+// Extra history kept by block kernels, so that input pushed while frames are
+// being gathered does not overwrite the oldest window still waiting to be processed.
+#define SINC_BLOCK_SPAN 32
 
-#if defined(__AVX__) && ENABLE_AVX
-#include <immintrin.h>
-#endif
+typedef struct rarch_sinc_resampler rarch_sinc_resampler_t;
+typedef void (*sinc_process_t)(rarch_sinc_resampler_t *resamp, float *out_buffer);
 
-#define PHASES (1 << (PHASE_BITS + SUBPHASE_BITS))
-
-#define TAPS (SIDELOBES * 2)
-#define SUBPHASE_MASK ((1 << SUBPHASE_BITS) - 1)
-#define SUBPHASE_MOD (1.0f / (1 << SUBPHASE_BITS))
+struct sinc_frame
+{
+   unsigned ptr;
+   uint32_t time;
+};
+// Computes SINC_BLOCK_FRAMES interleaved stereo frames.
+typedef void (*sinc_process_block_t)(rarch_sinc_resampler_t *resamp, float *out_buffer,
+      const struct sinc_frame *frames);
 
-typedef struct rarch_sinc_resampler
+struct rarch_sinc_resampler
 {
    float *phase_table;
    float *buffer_l;
    float *buffer_r;
 
    unsigned taps;
+   unsigned ring; // History length, buffer_l and buffer_r hold it twice.
+
+   // Derived from struct sinc_params at init.
+   uint32_t phases;
+   unsigned subphase_bits;
+   uint32_t subphase_mask;
+   float subphase_mod;
+   bool lerp;
+   sinc_process_t process;
+   sinc_process_block_t process_block; // If non-NULL, used instead of process.
+
+   enum sinc_window window;
+   double kaiser_beta;
+   double cutoff;
 
    unsigned ptr;
    uint32_t time;
@@ -117,7 +145,7 @@ typedef struct rarch_sinc_resampler
    // A buffer for phase_table, buffer_l and buffer_r are created in a single calloc().
    // Ensure that we get as good cache locality as we can hope for.
    float *main_buffer;
-} rarch_sinc_resampler_t;
+};
 
 static inline double sinc(double val)
 {
@@ -127,12 +155,6 @@ static inline double sinc(double val)
       return sin(val) / val;
 }
 
-#if defined(SINC_WINDOW_LANCZOS)
-static inline double window_function(double index)
-{
-   return sinc(M_PI * index);
-}
-#elif defined(SINC_WINDOW_KAISER)
 // Modified Bessel function of first order.
 // Check Wiki for mathematical definition ...
 static inline double besseli0(double x)
@@ -160,18 +182,22 @@ static inline double besseli0(double x)
    return sum;
 }
 
-static inline double window_function(double index)
+static double window_function(const rarch_sinc_resampler_t *resamp, double index)
 {
-   return besseli0(SINC_WINDOW_KAISER_BETA * sqrt(1 - index * index));
+   switch (resamp->window)
+   {
+      case SINC_WINDOW_LANCZOS:
+         return sinc(M_PI * index);
+      case SINC_WINDOW_KAISER:
+      default:
+         return besseli0(resamp->kaiser_beta * sqrt(1 - index * index));
+   }
 }
-#else
-#error "No SINC window function defined."
-#endif
 
 static void init_sinc_table(rarch_sinc_resampler_t *resamp, double cutoff,
       float *phase_table, int phases, int taps, bool calculate_delta)
 {
-   double window_mod = window_function(0.0); // Need to normalize w(0) to 1.0.
+   double window_mod = window_function(resamp, 0.0); // Need to normalize w(0) to 1.0.
    int stride = calculate_delta ? 2 : 1;
 
    double sidelobes = taps / 2.0;
@@ -184,7 +210,7 @@ static void init_sinc_table(rarch_sinc_resampler_t *resamp, double cutoff,
          window_phase = 2.0 * window_phase - 1.0; // [-1, 1)
          double sinc_phase = sidelobes * window_phase;
 
-         float val = cutoff * sinc(M_PI * sinc_phase * cutoff) * window_function(window_phase) / window_mod;
+         float val = cutoff * sinc(M_PI * sinc_phase * cutoff) * window_function(resamp, window_phase) / window_mod;
          phase_table[i * stride * taps + j] = val;
       }
    }
@@ -208,7 +234,7 @@ static void init_sinc_table(rarch_sinc_resampler_t *resamp, double cutoff,
          window_phase = 2.0 * window_phase - 1.0; // (-1, 1]
          double sinc_phase = sidelobes * window_phase;
 
-         float val = cutoff * sinc(M_PI * sinc_phase * cutoff) * window_function(window_phase) / window_mod;
+         float val = cutoff * sinc(M_PI * sinc_phase * cutoff) * window_function(resamp, window_phase) / window_mod;
          float delta = (val - phase_table[phase * stride * taps + j]);
          phase_table[(phase * stride + 1) * taps + j] = delta;
       }
@@ -235,7 +261,7 @@ static void aligned_free__(void *ptr)
    free(p[-1]);
 }
 
-static inline void process_sinc_C(rarch_sinc_resampler_t *resamp, float *out_buffer)
+static void process_sinc_C(rarch_sinc_resampler_t *resamp, float *out_buffer)
 {
    float sum_l = 0.0f;
    float sum_r = 0.0f;
@@ -243,33 +269,41 @@ static inline void process_sinc_C(rarch_sinc_resampler_t *resamp, float *out_buf
    const float *buffer_r = resamp->buffer_r + resamp->ptr;
 
    unsigned taps  = resamp->taps;
-   unsigned phase = resamp->time >> SUBPHASE_BITS;
-#if SINC_COEFF_LERP
-   const float *phase_table = resamp->phase_table + phase * taps * 2;
-   const float *delta_table = phase_table + taps;
-   float delta = (float)(resamp->time & SUBPHASE_MASK) * SUBPHASE_MOD;
-#else
-   const float *phase_table = resamp->phase_table + phase * taps;
-#endif
+   unsigned phase = resamp->time >> resamp->subphase_bits;
 
-   for (unsigned i = 0; i < taps; i++)
+   if (resamp->lerp)
    {
-#if SINC_COEFF_LERP
-      float sinc_val = phase_table[i] + delta_table[i] * delta;
-#else
-      float sinc_val = phase_table[i];
-#endif
-      sum_l         += buffer_l[i] * sinc_val;
-      sum_r         += buffer_r[i] * sinc_val;
+      const float *phase_table = resamp->phase_table + phase * taps * 2;
+      const float *delta_table = phase_table + taps;
+      float delta = (float)(resamp->time & resamp->subphase_mask) * resamp->subphase_mod;
+
+      for (unsigned i = 0; i < taps; i++)
+      {
+         float sinc_val = phase_table[i] + delta_table[i] * delta;
+         sum_l         += buffer_l[i] * sinc_val;
+         sum_r         += buffer_r[i] * sinc_val;
+      }
+   }
+   else
+   {
+      const float *phase_table = resamp->phase_table + phase * taps;
+
+      for (unsigned i = 0; i < taps; i++)
+      {
+         float sinc_val = phase_table[i];
+         sum_l         += buffer_l[i] * sinc_val;
+         sum_r         += buffer_r[i] * sinc_val;
+      }
    }
 
    out_buffer[0] = sum_l;
    out_buffer[1] = sum_r;
 }
 
-#if defined(__AVX__) && ENABLE_AVX
-#define process_sinc_func process_sinc
-static void process_sinc(rarch_sinc_resampler_t *resamp, float *out_buffer)
+#ifdef SINC_SIMD_X86
+// Assumes taps is a multiple of 8.
+SINC_TARGET("avx")
+static void process_sinc_avx(rarch_sinc_resampler_t *resamp, float *out_buffer)
 {
    __m256 sum_l = _mm256_setzero_ps();
    __m256 sum_r = _mm256_setzero_ps();
@@ -278,28 +312,38 @@ static void process_sinc(rarch_sinc_resampler_t *resamp, float *out_buffer)
    const float *buffer_r = resamp->buffer_r + resamp->ptr;
 
    unsigned taps = resamp->taps;
-   unsigned phase = resamp->time >> SUBPHASE_BITS;
-#if SINC_COEFF_LERP
-   const float *phase_table = resamp->phase_table + phase * taps * 2;
-   const float *delta_table = phase_table + taps;
-   __m256 delta = _mm256_set1_ps((float)(resamp->time & SUBPHASE_MASK) * SUBPHASE_MOD);
-#else
-   const float *phase_table = resamp->phase_table + phase * taps;
-#endif
+   unsigned phase = resamp->time >> resamp->subphase_bits;
 
-   for (unsigned i = 0; i < taps; i += 8)
+   if (resamp->lerp)
    {
-      __m256 buf_l = _mm256_loadu_ps(buffer_l + i);
-      __m256 buf_r = _mm256_loadu_ps(buffer_r + i);
+      const float *phase_table = resamp->phase_table + phase * taps * 2;
+      const float *delta_table = phase_table + taps;
+      __m256 delta = _mm256_set1_ps((float)(resamp->time & resamp->subphase_mask) * resamp->subphase_mod);
 
-#if SINC_COEFF_LERP
-      __m256 deltas = _mm256_load_ps(delta_table + i);
-      __m256 sinc = _mm256_add_ps(_mm256_load_ps(phase_table + i), _mm256_mul_ps(deltas, delta));
-#else
-      __m256 sinc = _mm256_load_ps(phase_table + i);
-#endif
-      sum_l       = _mm256_add_ps(sum_l, _mm256_mul_ps(buf_l, sinc));
-      sum_r       = _mm256_add_ps(sum_r, _mm256_mul_ps(buf_r, sinc));
+      for (unsigned i = 0; i < taps; i += 8)
+      {
+         __m256 buf_l = _mm256_loadu_ps(buffer_l + i);
+         __m256 buf_r = _mm256_loadu_ps(buffer_r + i);
+
+         __m256 deltas = _mm256_load_ps(delta_table + i);
+         __m256 sinc = _mm256_add_ps(_mm256_load_ps(phase_table + i), _mm256_mul_ps(deltas, delta));
+         sum_l       = _mm256_add_ps(sum_l, _mm256_mul_ps(buf_l, sinc));
+         sum_r       = _mm256_add_ps(sum_r, _mm256_mul_ps(buf_r, sinc));
+      }
+   }
+   else
+   {
+      const float *phase_table = resamp->phase_table + phase * taps;
+
+      for (unsigned i = 0; i < taps; i += 8)
+      {
+         __m256 buf_l = _mm256_loadu_ps(buffer_l + i);
+         __m256 buf_r = _mm256_loadu_ps(buffer_r + i);
+
+         __m256 sinc = _mm256_load_ps(phase_table + i);
+         sum_l       = _mm256_add_ps(sum_l, _mm256_mul_ps(buf_l, sinc));
+         sum_r       = _mm256_add_ps(sum_r, _mm256_mul_ps(buf_r, sinc));
+      }
    }
 
    // hadd on AVX is weird, and acts on low-lanes and high-lanes separately.
@@ -312,12 +356,85 @@ static void process_sinc(rarch_sinc_resampler_t *resamp, float *out_buffer)
 
    // This is optimized to mov %xmmN, [mem].
    // There doesn't seem to be any _mm256_store_ss intrinsic.
-   _mm_store_ss(out_buffer + 0, _mm256_extractf128_ps(res_l, 0));
-   _mm_store_ss(out_buffer + 1, _mm256_extractf128_ps(res_r, 0));
+   _mm_store_ss(out_buffer + 0, _mm256_castps256_ps128(res_l));
+   _mm_store_ss(out_buffer + 1, _mm256_castps256_ps128(res_r));
+}
+
+// Computes several output frames at once. The coefficients for each frame are
+// calculated once and shared by both channels, and the independent sums
+// hide FMA latency, which the single frame kernels are bound by with many taps.
+// Assumes taps is a multiple of 8.
+#define SINC_AVX2_TAP(f, coeff) \
+   do { \
+      __m256 sinc = coeff; \
+      sum_l##f = _mm256_fmadd_ps(_mm256_loadu_ps(buffer_l##f + i), sinc, sum_l##f); \
+      sum_r##f = _mm256_fmadd_ps(_mm256_loadu_ps(buffer_r##f + i), sinc, sum_r##f); \
+   } while (0)
+
+#define SINC_AVX2_SETUP(f) \
+   const float *buffer_l##f = resamp->buffer_l + frames[f].ptr; \
+   const float *buffer_r##f = resamp->buffer_r + frames[f].ptr; \
+   const float *phase_table##f = resamp->phase_table + \
+      (frames[f].time >> resamp->subphase_bits) * taps * stride; \
+   __m256 delta##f = _mm256_set1_ps((float)(frames[f].time & resamp->subphase_mask) * resamp->subphase_mod); \
+   __m256 sum_l##f = _mm256_setzero_ps(); \
+   __m256 sum_r##f = _mm256_setzero_ps()
+
+#define SINC_AVX2_LERP(f) _mm256_fmadd_ps(_mm256_load_ps(phase_table##f + taps + i), delta##f, \
+      _mm256_load_ps(phase_table##f + i))
+#define SINC_AVX2_PLAIN(f) _mm256_load_ps(phase_table##f + i)
+
+SINC_TARGET("avx2,fma")
+static void process_sinc_avx2_block(rarch_sinc_resampler_t *resamp, float *out_buffer,
+      const struct sinc_frame *frames)
+{
+   unsigned taps = resamp->taps;
+   unsigned stride = resamp->lerp ? 2 : 1;
+
+   SINC_AVX2_SETUP(0);
+   SINC_AVX2_SETUP(1);
+   SINC_AVX2_SETUP(2);
+   SINC_AVX2_SETUP(3);
+
+   if (resamp->lerp)
+   {
+      for (unsigned i = 0; i < taps; i += 8)
+      {
+         SINC_AVX2_TAP(0, SINC_AVX2_LERP(0));
+         SINC_AVX2_TAP(1, SINC_AVX2_LERP(1));
+         SINC_AVX2_TAP(2, SINC_AVX2_LERP(2));
+         SINC_AVX2_TAP(3, SINC_AVX2_LERP(3));
+      }
+   }
+   else
+   {
+      for (unsigned i = 0; i < taps; i += 8)
+      {
+         SINC_AVX2_TAP(0, SINC_AVX2_PLAIN(0));
+         SINC_AVX2_TAP(1, SINC_AVX2_PLAIN(1));
+         SINC_AVX2_TAP(2, SINC_AVX2_PLAIN(2));
+         SINC_AVX2_TAP(3, SINC_AVX2_PLAIN(3));
+      }
+   }
+
+   // Reduce all eight sums at once.
+   // hadd(hadd(l, r), ...) gives { L0, R0, L1, R1 } partial sums in each 128-bit lane.
+   __m256 sum01 = _mm256_hadd_ps(_mm256_hadd_ps(sum_l0, sum_r0), _mm256_hadd_ps(sum_l1, sum_r1));
+   __m256 sum23 = _mm256_hadd_ps(_mm256_hadd_ps(sum_l2, sum_r2), _mm256_hadd_ps(sum_l3, sum_r3));
+
+   // Add low and high lanes: { L0, R0, L1, R1, L2, R2, L3, R3 }.
+   __m256 res = _mm256_add_ps(_mm256_permute2f128_ps(sum01, sum23, 0x20),
+         _mm256_permute2f128_ps(sum01, sum23, 0x31));
+   _mm256_storeu_ps(out_buffer, res);
 }
-#elif defined(__SSE__)
-#define process_sinc_func process_sinc
-static void process_sinc(rarch_sinc_resampler_t *resamp, float *out_buffer)
+
+#undef SINC_AVX2_TAP
+#undef SINC_AVX2_SETUP
+#undef SINC_AVX2_LERP
+#undef SINC_AVX2_PLAIN
+
+SINC_TARGET("sse")
+static void process_sinc_sse(rarch_sinc_resampler_t *resamp, float *out_buffer)
 {
    __m128 sum_l = _mm_setzero_ps();
    __m128 sum_r = _mm_setzero_ps();
@@ -326,28 +443,38 @@ static void process_sinc(rarch_sinc_resampler_t *resamp, float *out_buffer)
    const float *buffer_r = resamp->buffer_r + resamp->ptr;
 
    unsigned taps = resamp->taps;
-   unsigned phase = resamp->time >> SUBPHASE_BITS;
-#if SINC_COEFF_LERP
-   const float *phase_table = resamp->phase_table + phase * taps * 2;
-   const float *delta_table = phase_table + taps;
-   __m128 delta = _mm_set1_ps((float)(resamp->time & SUBPHASE_MASK) * SUBPHASE_MOD);
-#else
-   const float *phase_table = resamp->phase_table + phase * taps;
-#endif
+   unsigned phase = resamp->time >> resamp->subphase_bits;
 
-   for (unsigned i = 0; i < taps; i += 4)
+   if (resamp->lerp)
    {
-      __m128 buf_l = _mm_loadu_ps(buffer_l + i);
-      __m128 buf_r = _mm_loadu_ps(buffer_r + i);
+      const float *phase_table = resamp->phase_table + phase * taps * 2;
+      const float *delta_table = phase_table + taps;
+      __m128 delta = _mm_set1_ps((float)(resamp->time & resamp->subphase_mask) * resamp->subphase_mod);
 
-#if SINC_COEFF_LERP
-      __m128 deltas = _mm_load_ps(delta_table + i);
-      __m128 sinc = _mm_add_ps(_mm_load_ps(phase_table + i), _mm_mul_ps(deltas, delta));
-#else
-      __m128 sinc = _mm_load_ps(phase_table + i);
-#endif
-      sum_l       = _mm_add_ps(sum_l, _mm_mul_ps(buf_l, sinc));
-      sum_r       = _mm_add_ps(sum_r, _mm_mul_ps(buf_r, sinc));
+      for (unsigned i = 0; i < taps; i += 4)
+      {
+         __m128 buf_l = _mm_loadu_ps(buffer_l + i);
+         __m128 buf_r = _mm_loadu_ps(buffer_r + i);
+
+         __m128 deltas = _mm_load_ps(delta_table + i);
+         __m128 sinc = _mm_add_ps(_mm_load_ps(phase_table + i), _mm_mul_ps(deltas, delta));
+         sum_l       = _mm_add_ps(sum_l, _mm_mul_ps(buf_l, sinc));
+         sum_r       = _mm_add_ps(sum_r, _mm_mul_ps(buf_r, sinc));
+      }
+   }
+   else
+   {
+      const float *phase_table = resamp->phase_table + phase * taps;
+
+      for (unsigned i = 0; i < taps; i += 4)
+      {
+         __m128 buf_l = _mm_loadu_ps(buffer_l + i);
+         __m128 buf_r = _mm_loadu_ps(buffer_r + i);
+
+         __m128 sinc = _mm_load_ps(phase_table + i);
+         sum_l       = _mm_add_ps(sum_l, _mm_mul_ps(buf_l, sinc));
+         sum_r       = _mm_add_ps(sum_r, _mm_mul_ps(buf_r, sinc));
+      }
    }
 
    // Them annoying shuffles :V
@@ -371,64 +498,187 @@ static void process_sinc(rarch_sinc_resampler_t *resamp, float *out_buffer)
    // movehl { X, R, X, L } == { X, R, X, R }
    _mm_store_ss(out_buffer + 1, _mm_movehl_ps(sum, sum));
 }
-#elif defined(HAVE_NEON)
-
-#if SINC_COEFF_LERP
-#error "NEON asm does not support SINC lerp."
 #endif
 
-// Need to make this function pointer as Android doesn't have built-in targets
-// for NEON and plain ARMv7a.
-static void (*process_sinc_func)(rarch_sinc_resampler_t *resamp, float *out_buffer);
-
+#ifdef HAVE_NEON
 // Assumes that taps >= 8, and that taps is a multiple of 8.
 void process_sinc_neon_asm(float *out, const float *left, const float *right, const float *coeff, unsigned taps);
 
+// NEON asm does not support SINC lerp.
 static void process_sinc_neon(rarch_sinc_resampler_t *resamp, float *out_buffer)
 {
    const float *buffer_l = resamp->buffer_l + resamp->ptr;
    const float *buffer_r = resamp->buffer_r + resamp->ptr;
 
-   unsigned phase = resamp->time >> SUBPHASE_BITS;
+   unsigned phase = resamp->time >> resamp->subphase_bits;
    unsigned taps = resamp->taps;
    const float *phase_table = resamp->phase_table + phase * taps;
 
    process_sinc_neon_asm(out_buffer, buffer_l, buffer_r, phase_table, taps);
 }
-#else // Plain ol' C99
-#define process_sinc_func process_sinc_C
 #endif
 
-static void resampler_sinc_process(void *re_, struct resampler_data *data)
+// Below this, the SSE kernel keeps up and the block kernel only adds latency to each call.
+#define SINC_AVX2_MIN_SIDELOBES 8
+
+// Picks a kernel before taps are rounded, as the wide (AVX, NEON) kernels need taps to be a multiple of 8.
+static const char *choose_process_sinc(rarch_sinc_resampler_t *re,
+      const struct sinc_params *params, unsigned simd_mask, bool *wide)
 {
-   rarch_sinc_resampler_t *re = (rarch_sinc_resampler_t*)re_;
+   (void)params;
+   (void)simd_mask;
+
+#ifdef SINC_SIMD_X86
+   if ((simd_mask & (RARCH_SIMD_AVX2 | RARCH_SIMD_FMA3)) == (RARCH_SIMD_AVX2 | RARCH_SIMD_FMA3) &&
+         params->sidelobes >= SINC_AVX2_MIN_SIDELOBES)
+   {
+      // Single frames are still needed for the odd frame at the end of a run.
+      re->process       = process_sinc_avx;
+      re->process_block = process_sinc_avx2_block;
+      *wide = true;
+      return "AVX2/FMA";
+   }
+   if (params->avx && (simd_mask & RARCH_SIMD_AVX))
+   {
+      re->process = process_sinc_avx;
+      *wide = true;
+      return "AVX";
+   }
+   if (simd_mask & RARCH_SIMD_SSE)
+   {
+      re->process = process_sinc_sse;
+      return "SSE";
+   }
+#endif
+#ifdef HAVE_NEON
+   if (!params->lerp && (simd_mask & RARCH_SIMD_NEON))
+   {
+      re->process = process_sinc_neon;
+      *wide = true;
+      return "NEON";
+   }
+#endif
+
+   re->process = process_sinc_C;
+   return "C";
+}
+
+static inline void sinc_push_frame(rarch_sinc_resampler_t *re, const float *input)
+{
+   // Push in reverse to make filter more obvious.
+   if (!re->ptr)
+      re->ptr = re->ring;
+   re->ptr--;
+
+   re->buffer_l[re->ptr + re->ring] = re->buffer_l[re->ptr] = input[0];
+   re->buffer_r[re->ptr + re->ring] = re->buffer_r[re->ptr] = input[1];
+}
+
+// Runs gathered frames which did not fill a block through the single frame kernel.
+static void sinc_process_partial(rarch_sinc_resampler_t *re, float *output,
+      const struct sinc_frame *frames, unsigned count)
+{
+   unsigned ptr = re->ptr;
+   uint32_t time = re->time;
+
+   for (unsigned i = 0; i < count; i++, output += 2)
+   {
+      re->ptr  = frames[i].ptr;
+      re->time = frames[i].time;
+      re->process(re, output);
+   }
 
-   uint32_t ratio = PHASES / data->ratio;
+   re->ptr  = ptr;
+   re->time = time;
+}
+
+static size_t resampler_sinc_process_blocked(rarch_sinc_resampler_t *re,
+      const float *input, size_t frames, float *output, uint32_t ratio)
+{
+   struct sinc_frame pending[SINC_BLOCK_FRAMES];
+   unsigned count  = 0;
+   unsigned pushed = 0;
+   size_t out_frames = 0;
+   uint32_t phases = re->phases;
+
+   if (!frames)
+      return 0;
+
+   for (;;)
+   {
+      while (re->time >= phases)
+      {
+         if (!frames)
+            goto end;
+
+         // Another push could overwrite the window of the first pending frame.
+         if (count && pushed == SINC_BLOCK_SPAN)
+         {
+            sinc_process_partial(re, output, pending, count);
+            output     += 2 * count;
+            out_frames += count;
+            count       = 0;
+         }
+
+         sinc_push_frame(re, input);
+         input += 2;
+         pushed++;
+
+         re->time -= phases;
+         frames--;
+      }
+
+      if (!count)
+         pushed = 0;
+
+      pending[count].ptr  = re->ptr;
+      pending[count].time = re->time;
+      re->time += ratio;
+
+      if (++count == SINC_BLOCK_FRAMES)
+      {
+         re->process_block(re, output, pending);
+         output     += 2 * SINC_BLOCK_FRAMES;
+         out_frames += SINC_BLOCK_FRAMES;
+         count       = 0;
+      }
+   }
+
+end:
+   sinc_process_partial(re, output, pending, count);
+   return out_frames + count;
+}
+
+// Ratio is the distance between output frames, in units of 1 / phases input frames.
+static void sinc_process(rarch_sinc_resampler_t *re, struct resampler_data *data, uint32_t ratio)
+{
+   uint32_t phases = re->phases;
 
    const float *input = data->data_in;
    float *output      = data->data_out;
    size_t frames         = data->input_frames;
    size_t out_frames     = 0;
 
+   if (re->process_block)
+   {
+      data->output_frames = resampler_sinc_process_blocked(re, input, frames, output, ratio);
+      return;
+   }
+
    while (frames)
    {
-      while (frames && re->time >= PHASES)
+      while (frames && re->time >= phases)
       {
-         // Push in reverse to make filter more obvious.
-         if (!re->ptr)
-            re->ptr = re->taps;
-         re->ptr--;
+         sinc_push_frame(re, input);
+         input += 2;
 
-         re->buffer_l[re->ptr + re->taps] = re->buffer_l[re->ptr] = *input++;
-         re->buffer_r[re->ptr + re->taps] = re->buffer_r[re->ptr] = *input++;
-
-         re->time -= PHASES;
+         re->time -= phases;
          frames--;
       }
 
-      while (re->time < PHASES)
+      while (re->time < phases)
       {
-         process_sinc_func(re, output);
+         re->process(re, output);
          output += 2;
          out_frames++;
          re->time += ratio;
@@ -438,6 +688,12 @@ static void resampler_sinc_process(void *re_, struct resampler_data *data)
    data->output_frames = out_frames;
 }
 
+static void resampler_sinc_process(void *re_, struct resampler_data *data)
+{
+   rarch_sinc_resampler_t *re = (rarch_sinc_resampler_t*)re_;
+   sinc_process(re, data, re->phases / data->ratio);
+}
+
 static void resampler_sinc_free(void *re)
 {
    rarch_sinc_resampler_t *resampler = (rarch_sinc_resampler_t*)re;
@@ -446,7 +702,7 @@ static void resampler_sinc_free(void *re)
    free(resampler);
 }
 
-static void *resampler_sinc_new(double bandwidth_mod)
+static void *resampler_sinc_new(double bandwidth_mod, enum resampler_quality quality, unsigned simd_mask)
 {
    rarch_sinc_resampler_t *re = (rarch_sinc_resampler_t*)calloc(1, sizeof(*re));
    if (!re)
@@ -454,28 +710,44 @@ static void *resampler_sinc_new(double bandwidth_mod)
 
    memset(re, 0, sizeof(*re));
 
-   re->taps = TAPS;
-   double cutoff = CUTOFF;
+   if (quality == RESAMPLER_QUALITY_DONTCARE || quality > RESAMPLER_QUALITY_HIGHEST)
+      quality = SINC_DEFAULT_QUALITY;
+   const struct sinc_params *params = &sinc_quality[quality];
+
+   re->window        = params->window;
+   re->kaiser_beta   = params->kaiser_beta;
+   re->lerp          = params->lerp;
+   re->subphase_bits = params->subphase_bits;
+   re->subphase_mask = (1 << params->subphase_bits) - 1;
+   re->subphase_mod  = 1.0f / (1 << params->subphase_bits);
+   re->phases        = 1 << (params->phase_bits + params->subphase_bits);
+
+   re->taps = params->sidelobes * 2;
+   re->cutoff = params->cutoff;
 
    // Downsampling, must lower cutoff, and extend number of taps accordingly to keep same stopband attenuation.
    if (bandwidth_mod < 1.0)
    {
-      cutoff *= bandwidth_mod;
+      re->cutoff *= bandwidth_mod;
       re->taps = (unsigned)ceil(re->taps / bandwidth_mod);
    }
 
+   bool wide_kernel = false;
+   const char *kernel = choose_process_sinc(re, params, simd_mask, &wide_kernel);
+
    // Be SIMD-friendly.
-#if (defined(__AVX__) && ENABLE_AVX) || defined(HAVE_NEON)
-   re->taps = (re->taps + 7) & ~7;
-#else
-   re->taps = (re->taps + 3) & ~3;
-#endif
+   if (wide_kernel)
+      re->taps = (re->taps + 7) & ~7;
+   else
+      re->taps = (re->taps + 3) & ~3;
 
-   size_t phase_elems = (1 << PHASE_BITS) * re->taps;
-#if SINC_COEFF_LERP
-   phase_elems *= 2;
-#endif
-   size_t elems = phase_elems + 4 * re->taps;
+   size_t phase_elems = (1 << params->phase_bits) * re->taps;
+   if (re->lerp)
+      phase_elems *= 2;
+   re->ring = re->taps;
+   if (re->process_block)
+      re->ring += SINC_BLOCK_SPAN;
+   size_t elems = phase_elems + 4 * re->ring;
 
    re->main_buffer = (float*)aligned_alloc__(128, sizeof(float) * elems);
    if (!re->main_buffer)
@@ -483,24 +755,14 @@ static void *resampler_sinc_new(double bandwidth_mod)
 
    re->phase_table = re->main_buffer;
    re->buffer_l = re->main_buffer + phase_elems;
-   re->buffer_r = re->buffer_l + 2 * re->taps;
-
-   init_sinc_table(re, cutoff, re->phase_table, 1 << PHASE_BITS, re->taps, SINC_COEFF_LERP);
-
-#if defined(__AVX__) && ENABLE_AVX
-   RARCH_LOG("Sinc resampler [AVX]\n");
-#elif defined(__SSE__)
-   RARCH_LOG("Sinc resampler [SSE]\n");
-#elif defined(HAVE_NEON)
-   struct rarch_cpu_features cpu;
-   rarch_get_cpu_features(&cpu);
-   process_sinc_func = cpu.simd & RARCH_SIMD_NEON ? process_sinc_neon : process_sinc_C;
-   RARCH_LOG("Sinc resampler [%s]\n", cpu.simd & RARCH_SIMD_NEON ? "NEON" : "C");
-#else
-   RARCH_LOG("Sinc resampler [C]\n");
-#endif
+   re->buffer_r = re->buffer_l + 2 * re->ring;
+   // History starts out silent. The allocation might be reused memory.
+   memset(re->buffer_l, 0, sizeof(float) * 4 * re->ring);
+
+   init_sinc_table(re, re->cutoff, re->phase_table, 1 << params->phase_bits, re->taps, re->lerp);
 
-   RARCH_LOG("SINC params (%u phase bits, %u taps).\n", PHASE_BITS, re->taps);
+   RARCH_LOG("Sinc resampler [%s], %s quality.\n", kernel, sinc_quality_names[quality]);
+   RARCH_LOG("SINC params (%u phase bits, %u taps).\n", params->phase_bits, re->taps);
    return re;
 
 error:
@@ -515,3 +777,173 @@ const rarch_resampler_t sinc_resampler = {
    "sinc",
 };
 
+
+// Polyphase resampler for fixed rational ratios, e.g. 32040 -> 48000 Hz (400 / 267).
+// Every output frame then lands on one of L exact phases, so a table with one
+// row per phase needs no coefficient interpolation, and time advances by an exact integer.
+// Whenever the ratio differs from the one given at init (dynamic rate control),
+// it runs the interpolating sinc path on the same history instead.
+
+// Exact tables larger than this are not worth the memory, use interpolation.
+#define POLYPHASE_MAX_PHASES 2048
+
+struct sinc_table
+{
+   float *phase_table;
+   uint32_t phases;
+   unsigned subphase_bits;
+   uint32_t subphase_mask;
+   float subphase_mod;
+   bool lerp;
+};
+
+typedef struct rarch_polyphase_resampler
+{
+   rarch_sinc_resampler_t *sinc;
+
+   struct sinc_table interp;
+   struct sinc_table exact;
+   bool use_exact;
+
+   double ratio;  // Ratio the exact table was built for.
+   uint32_t step; // M in ratio = L / M.
+   float *exact_buffer;
+} rarch_polyphase_resampler_t;
+
+static void sinc_get_table(const rarch_sinc_resampler_t *re, struct sinc_table *table)
+{
+   table->phase_table   = re->phase_table;
+   table->phases        = re->phases;
+   table->subphase_bits = re->subphase_bits;
+   table->subphase_mask = re->subphase_mask;
+   table->subphase_mod  = re->subphase_mod;
+   table->lerp          = re->lerp;
+}
+
+static void sinc_set_table(rarch_sinc_resampler_t *re, const struct sinc_table *table)
+{
+   // Keep the fractional position when changing time base.
+   re->time = (uint32_t)(((uint64_t)re->time * table->phases + re->phases / 2) / re->phases);
+
+   re->phase_table   = table->phase_table;
+   re->phases        = table->phases;
+   re->subphase_bits = table->subphase_bits;
+   re->subphase_mask = table->subphase_mask;
+   re->subphase_mod  = table->subphase_mod;
+   re->lerp          = table->lerp;
+}
+
+// Finds ratio = L / M with L <= max_phases using continued fractions.
+static bool find_rational_ratio(double ratio, unsigned max_phases, uint32_t *l, uint32_t *m)
+{
+   uint64_t num_prev = 1, num = (uint64_t)ratio;
+   uint64_t den_prev = 0, den = 1;
+   double frac = ratio - (double)num;
+
+   for (unsigned i = 0; i < 32 && num <= max_phases; i++)
+   {
+      if (num && fabs((double)num / den - ratio) <= ratio * 1e-12)
+      {
+         *l = num;
+         *m = den;
+         return true;
+      }
+
+      if (frac < 1e-15)
+         break;
+
+      double inv = 1.0 / frac;
+      uint64_t a = (uint64_t)inv;
+      frac = inv - (double)a;
+
+      uint64_t num_next = a * num + num_prev;
+      uint64_t den_next = a * den + den_prev;
+      num_prev = num;
+      den_prev = den;
+      num = num_next;
+      den = den_next;
+   }
+
+   return false;
+}
+
+static void resampler_polyphase_process(void *re_, struct resampler_data *data)
+{
+   rarch_polyphase_resampler_t *re = (rarch_polyphase_resampler_t*)re_;
+
+   bool exact = re->exact_buffer && fabs(data->ratio - re->ratio) <= re->ratio * 1e-12;
+   if (exact != re->use_exact)
+   {
+      sinc_set_table(re->sinc, exact ? &re->exact : &re->interp);
+      re->use_exact = exact;
+   }
+
+   if (exact)
+      sinc_process(re->sinc, data, re->step);
+   else
+      sinc_process(re->sinc, data, re->sinc->phases / data->ratio);
+}
+
+static void resampler_polyphase_free(void *re_)
+{
+   rarch_polyphase_resampler_t *re = (rarch_polyphase_resampler_t*)re_;
+   if (!re)
+      return;
+
+   resampler_sinc_free(re->sinc);
+   if (re->exact_buffer)
+      aligned_free__(re->exact_buffer);
+   free(re);
+}
+
+static void *resampler_polyphase_new(double bandwidth_mod, enum resampler_quality quality, unsigned simd_mask)
+{
+   rarch_polyphase_resampler_t *re = (rarch_polyphase_resampler_t*)calloc(1, sizeof(*re));
+   if (!re)
+      return NULL;
+
+   re->sinc = (rarch_sinc_resampler_t*)resampler_sinc_new(bandwidth_mod, quality, simd_mask);
+   if (!re->sinc)
+      goto error;
+
+   sinc_get_table(re->sinc, &re->interp);
+   re->ratio = bandwidth_mod;
+
+   uint32_t phases, step;
+   if (!find_rational_ratio(bandwidth_mod, POLYPHASE_MAX_PHASES, &phases, &step))
+   {
+      RARCH_LOG("Polyphase resampler: ratio %.6f is not a small rational, interpolating.\n", bandwidth_mod);
+      return re;
+   }
+
+   re->exact_buffer = (float*)aligned_alloc__(128, sizeof(float) * phases * re->sinc->taps);
+   if (!re->exact_buffer)
+      goto error;
+
+   init_sinc_table(re->sinc, re->sinc->cutoff, re->exact_buffer, phases, re->sinc->taps, false);
+
+   re->step = step;
+   re->exact.phase_table   = re->exact_buffer;
+   re->exact.phases        = phases;
+   re->exact.subphase_bits = 0;
+   re->exact.subphase_mask = 0;
+   re->exact.subphase_mod  = 0.0f;
+   re->exact.lerp          = false;
+
+   sinc_set_table(re->sinc, &re->exact);
+   re->use_exact = true;
+
+   RARCH_LOG("Polyphase resampler: %u / %u, %u exact phases.\n", phases, step, phases);
+   return re;
+
+error:
+   resampler_polyphase_free(re);
+   return NULL;
+}
+
+const rarch_resampler_t polyphase_resampler = {
+   resampler_polyphase_new,
+   resampler_polyphase_process,
+   resampler_polyphase_free,
+   "polyphase",
+};
@@ -0,0 +1,591 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2013 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Runs every resampler built into resampler.c at the ratios RetroArch sees in practice,
+// and reports speed, SNR and THD for each. Results are written one case per line,
+// and compared against a baseline written the same way. See "make bench-audio".
+
+#include "../resampler.h"
+#include "../../performance.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+
+// About one video frame of audio per audio_flush().
+#define BLOCK_FRAMES 800
+
+// Short runs, the fastest one counts. Longer runs are more likely to be disturbed.
+#define SPEED_SECONDS 0.5
+#define SPEED_RUNS 15
+
+// Measured on the left channel, after the filter has settled.
+#define FFT_BITS 16
+#define FFT_SAMPLES (1 << FFT_BITS)
+#define WARMUP_FRAMES 8192
+#define TONE_AMPLITUDE 0.5
+
+// Kaiser window with sidelobes well below float precision.
+// Its main lobe is a few bins wide, so a tone is summed over +/- MAIN_LOBE_BINS.
+#define KAISER_BETA 24.0
+#define MAIN_LOBE_BINS 16
+#define HARMONICS 5
+
+// About where float output runs out of precision. Beyond it, results differ with
+// rounding between kernels, so they are clamped.
+#define PRECISION_DB 130.0
+
+// Dynamic rate control nudges the ratio by up to this much every audio_flush().
+#define DRC_DEVIATION 0.005
+#define DRC_PERIOD_BLOCKS 60
+
+#define DEFAULT_SNR_TOLERANCE 2.0
+#define DEFAULT_SPEED_TOLERANCE 0.25
+
+struct bench_case
+{
+   const char *name;
+   double in_rate;
+   double out_rate;
+   bool drc;
+};
+
+static const struct bench_case cases[] = {
+   { "32040-48000", 32040.0, 48000.0, false }, // SNES.
+   { "44100-48000", 44100.0, 48000.0, false },
+   { "48000-44100", 48000.0, 44100.0, false },
+   { "24000-48000", 24000.0, 48000.0, false }, // Small rational, exact polyphase table.
+   { "44100-48000-drc", 44100.0, 48000.0, true },
+};
+
+// Fractions of the lower Nyquist frequency. The worst one is reported.
+static const double tones[] = { 0.02, 0.1, 0.3, 0.6, 0.8 };
+
+// Resamplers which have no quality setting only run once.
+static const char *fixed_quality[] = { "hermite" };
+
+struct bench_result
+{
+   char ident[32];
+   unsigned quality;
+   char name[32];
+
+   double ns_per_frame;
+   double frames_per_sec;
+   double snr;
+   double thd;
+};
+
+static double time_sec(void)
+{
+   struct timespec tv;
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tv);
+   return tv.tv_sec + tv.tv_nsec / 1000000000.0;
+}
+
+static double block_ratio(const struct bench_case *c, unsigned block)
+{
+   double ratio = c->out_rate / c->in_rate;
+   if (c->drc)
+      ratio *= 1.0 + DRC_DEVIATION * sin(2.0 * M_PI * block / DRC_PERIOD_BLOCKS);
+   return ratio;
+}
+
+static size_t max_block_output(const struct bench_case *c)
+{
+   return (size_t)ceil(BLOCK_FRAMES * (c->out_rate / c->in_rate) * (1.0 + DRC_DEVIATION)) + 16;
+}
+
+static double bessel_i0(double x)
+{
+   double sum = 1.0, term = 1.0;
+   for (unsigned k = 1; k < 64; k++)
+   {
+      term *= (x / (2.0 * k)) * (x / (2.0 * k));
+      sum  += term;
+   }
+   return sum;
+}
+
+// In-place radix-2 FFT of interleaved complex doubles.
+static void fft(double *buf, unsigned bits)
+{
+   unsigned n = 1u << bits;
+
+   for (unsigned i = 0, j = 0; i < n; i++)
+   {
+      if (i < j)
+      {
+         double re = buf[2 * i], im = buf[2 * i + 1];
+         buf[2 * i]     = buf[2 * j];
+         buf[2 * i + 1] = buf[2 * j + 1];
+         buf[2 * j]     = re;
+         buf[2 * j + 1] = im;
+      }
+
+      unsigned bit = n >> 1;
+      for (; j & bit; bit >>= 1)
+         j ^= bit;
+      j |= bit;
+   }
+
+   for (unsigned len = 2; len <= n; len <<= 1)
+   {
+      for (unsigned k = 0; k < len / 2; k++)
+      {
+         double phase = -2.0 * M_PI * k / len;
+         double wr = cos(phase), wi = sin(phase);
+
+         for (unsigned i = k; i < n; i += len)
+         {
+            double *a = buf + 2 * i;
+            double *b = buf + 2 * (i + len / 2);
+            double re = b[0] * wr - b[1] * wi;
+            double im = b[0] * wi + b[1] * wr;
+            b[0] = a[0] - re;
+            b[1] = a[1] - im;
+            a[0] += re;
+            a[1] += im;
+         }
+      }
+   }
+}
+
+static double band_power(const double *power, int lo, int hi)
+{
+   double sum = 0.0;
+   if (lo < 1)
+      lo = 1;
+   if (hi > FFT_SAMPLES / 2 - 1)
+      hi = FFT_SAMPLES / 2 - 1;
+   for (int i = lo; i <= hi; i++)
+      sum += power[i];
+   return sum;
+}
+
+static double to_db(double ratio)
+{
+   return 10.0 * log10(ratio > 1e-30 ? ratio : 1e-30);
+}
+
+// Resamples a tone on an exact output FFT bin. Returns SNR, everything which isn't the tone
+// counting as noise, and THD over the harmonics which fit below the output Nyquist frequency.
+static bool measure_tone(const char *ident, enum resampler_quality quality, const struct bench_case *c,
+      double tone, double *snr, double *thd)
+{
+   const rarch_resampler_t *backend = NULL;
+   void *re = NULL;
+   bool ret = false;
+
+   double ratio    = c->out_rate / c->in_rate;
+   double nyquist  = 0.5 * (c->in_rate < c->out_rate ? c->in_rate : c->out_rate);
+   double bin_hz   = c->out_rate / FFT_SAMPLES;
+   int bin         = (int)round(tone * nyquist / bin_hz);
+   double freq     = bin * bin_hz;
+
+   // A drifting ratio spreads the tone over the bins it drifts across, and the steps between blocks
+   // leave sidebands around that. DRC cases mostly catch discontinuities when the ratio changes.
+   int lobe = MAIN_LOBE_BINS;
+   if (c->drc)
+      lobe += (int)ceil(freq * DRC_DEVIATION * 4.0 / bin_hz) + 64;
+
+   size_t need     = WARMUP_FRAMES + FFT_SAMPLES;
+   size_t max_out  = max_block_output(c);
+   float *in       = (float*)malloc(2 * BLOCK_FRAMES * sizeof(float));
+   float *out      = (float*)malloc(2 * (need + max_out) * sizeof(float));
+   double *buf     = (double*)calloc(2 * FFT_SAMPLES, sizeof(double));
+   double *power   = (double*)calloc(FFT_SAMPLES / 2, sizeof(double));
+   if (!in || !out || !buf || !power)
+      goto end;
+
+   if (!rarch_resampler_realloc(&re, &backend, ident, quality, ratio))
+      goto end;
+
+   size_t out_frames = 0;
+   uint64_t in_frames = 0;
+   for (unsigned block = 0; out_frames < need; block++)
+   {
+      for (unsigned i = 0; i < BLOCK_FRAMES; i++, in_frames++)
+      {
+         float s = TONE_AMPLITUDE * sin(2.0 * M_PI * freq * in_frames / c->in_rate);
+         in[2 * i + 0] = s;
+         in[2 * i + 1] = s;
+      }
+
+      struct resampler_data data = {0};
+      data.data_in      = in;
+      data.data_out     = out + 2 * out_frames;
+      data.input_frames = BLOCK_FRAMES;
+      data.ratio        = block_ratio(c, block);
+      rarch_resampler_process(backend, re, &data);
+      out_frames += data.output_frames;
+   }
+
+   double i0_beta = bessel_i0(KAISER_BETA);
+   for (unsigned i = 0; i < FFT_SAMPLES; i++)
+   {
+      double x = 2.0 * i / (FFT_SAMPLES - 1) - 1.0;
+      double w = bessel_i0(KAISER_BETA * sqrt(1.0 - x * x)) / i0_beta;
+      buf[2 * i] = w * out[2 * (WARMUP_FRAMES + i)];
+   }
+
+   fft(buf, FFT_BITS);
+   for (unsigned i = 0; i < FFT_SAMPLES / 2; i++)
+      power[i] = buf[2 * i] * buf[2 * i] + buf[2 * i + 1] * buf[2 * i + 1];
+
+   double signal = band_power(power, bin - lobe, bin + lobe);
+   double noise  = band_power(power, MAIN_LOBE_BINS + 1, FFT_SAMPLES / 2) - signal;
+   *snr = to_db(signal / noise);
+
+   double harmonics = 0.0;
+   for (int h = 2; h <= HARMONICS && h * bin + lobe < FFT_SAMPLES / 2; h++)
+      harmonics += band_power(power, h * bin - lobe, h * bin + lobe);
+   *thd = to_db(harmonics / signal);
+
+   ret = true;
+
+end:
+   rarch_resampler_freep(&backend, &re);
+   free(in);
+   free(out);
+   free(buf);
+   free(power);
+   return ret;
+}
+
+// Best of a few runs, CPU time of this thread, white noise in.
+static bool measure_speed(const char *ident, enum resampler_quality quality, const struct bench_case *c,
+      struct bench_result *res)
+{
+   const rarch_resampler_t *backend = NULL;
+   void *re = NULL;
+   bool ret = false;
+
+   unsigned blocks = (unsigned)(SPEED_SECONDS * c->in_rate / BLOCK_FRAMES);
+   size_t samples = 2 * BLOCK_FRAMES * blocks;
+   float *in  = (float*)malloc(samples * sizeof(float));
+   float *out = (float*)malloc(2 * max_block_output(c) * sizeof(float));
+   if (!in || !out)
+      goto end;
+
+   uint32_t seed = 1;
+   for (size_t i = 0; i < samples; i++)
+   {
+      seed  = seed * 1664525u + 1013904223u;
+      in[i] = (float)((int32_t)seed / 4294967296.0);
+   }
+
+   double best = 0.0;
+   size_t best_frames = 0;
+   for (unsigned run = 0; run < SPEED_RUNS; run++)
+   {
+      if (!rarch_resampler_realloc(&re, &backend, ident, quality, c->out_rate / c->in_rate))
+         goto end;
+
+      size_t out_frames = 0;
+      double start = time_sec();
+      for (unsigned block = 0; block < blocks; block++)
+      {
+         struct resampler_data data = {0};
+         data.data_in      = in + 2 * BLOCK_FRAMES * block;
+         data.data_out     = out;
+         data.input_frames = BLOCK_FRAMES;
+         data.ratio        = block_ratio(c, block);
+         rarch_resampler_process(backend, re, &data);
+         out_frames += data.output_frames;
+      }
+      double elapsed = time_sec() - start;
+
+      if (run == 0 || elapsed < best)
+      {
+         best        = elapsed;
+         best_frames = out_frames;
+      }
+   }
+
+   res->ns_per_frame   = best * 1000000000.0 / best_frames;
+   res->frames_per_sec = best_frames / best;
+   ret = true;
+
+end:
+   rarch_resampler_freep(&backend, &re);
+   free(in);
+   free(out);
+   return ret;
+}
+
+static bool run_case(const char *ident, enum resampler_quality quality, const struct bench_case *c,
+      struct bench_result *res)
+{
+   memset(res, 0, sizeof(*res));
+   snprintf(res->ident, sizeof(res->ident), "%s", ident);
+   snprintf(res->name, sizeof(res->name), "%s", c->name);
+   res->quality = quality;
+   res->snr = HUGE_VAL;
+   res->thd = -HUGE_VAL;
+
+   for (unsigned i = 0; i < sizeof(tones) / sizeof(tones[0]); i++)
+   {
+      double snr, thd;
+      if (!measure_tone(ident, quality, c, tones[i], &snr, &thd))
+         return false;
+      if (snr < res->snr)
+         res->snr = snr;
+      if (thd > res->thd)
+         res->thd = thd;
+   }
+
+   if (res->snr > PRECISION_DB)
+      res->snr = PRECISION_DB;
+   if (res->thd < -PRECISION_DB)
+      res->thd = -PRECISION_DB;
+
+   return measure_speed(ident, quality, c, res);
+}
+
+// Speed is only comparable on the same CPU with the same kernels.
+static void get_cpu_ident(char *ident, size_t size)
+{
+   struct rarch_cpu_features cpu;
+   rarch_get_cpu_features(&cpu);
+
+   char model[256] = "unknown";
+   FILE *file = fopen("/proc/cpuinfo", "r");
+   if (file)
+   {
+      char line[512];
+      while (fgets(line, sizeof(line), file))
+      {
+         const char *colon = strchr(line, ':');
+         if (strncmp(line, "model name", 10) == 0 && colon)
+         {
+            snprintf(model, sizeof(model), "%s", colon + 2);
+            model[strcspn(model, "\n")] = '\0';
+            break;
+         }
+      }
+      fclose(file);
+   }
+
+   snprintf(ident, size, "0x%x %s", cpu.simd, model);
+}
+
+static bool write_results(const char *path, const char *cpu, const struct bench_result *res, unsigned num)
+{
+   FILE *file = fopen(path, "w");
+   if (!file)
+      return false;
+
+   fprintf(file, "# cpu %s\n", cpu);
+   fprintf(file, "# backend quality case ns_per_frame frames_per_sec snr_db thd_db\n");
+   for (unsigned i = 0; i < num; i++)
+   {
+      fprintf(file, "%s %u %s %.3f %.0f %.2f %.2f\n",
+            res[i].ident, res[i].quality, res[i].name,
+            res[i].ns_per_frame, res[i].frames_per_sec, res[i].snr, res[i].thd);
+   }
+
+   fclose(file);
+   return true;
+}
+
+// Returns number of regressions, or -1 if the baseline can't be read.
+// Speed is only compared if the baseline's cpu line matches this machine. The baseline in the tree
+// has none, as only quality is comparable between machines.
+static int compare_baseline(const char *path, const char *cpu, const struct bench_result *res, unsigned num,
+      double snr_tolerance, double speed_tolerance)
+{
+   FILE *file = fopen(path, "r");
+   if (!file)
+      return -1;
+
+   int failed = 0;
+   bool same_cpu = false;
+   char line[512];
+   while (fgets(line, sizeof(line), file))
+   {
+      line[strcspn(line, "\n")] = '\0';
+      if (strncmp(line, "# cpu ", 6) == 0)
+      {
+         same_cpu = strcmp(line + 6, cpu) == 0;
+         if (!same_cpu)
+            printf("Baseline is from another CPU (%s), only comparing quality.\n", line + 6);
+         continue;
+      }
+      if (line[0] == '#' || line[0] == '\0')
+         continue;
+
+      struct bench_result base;
+      if (sscanf(line, "%31s %u %31s %lf %lf %lf %lf", base.ident, &base.quality, base.name,
+               &base.ns_per_frame, &base.frames_per_sec, &base.snr, &base.thd) != 7)
+         continue;
+
+      const struct bench_result *cur = NULL;
+      for (unsigned i = 0; i < num; i++)
+      {
+         if (!strcmp(res[i].ident, base.ident) && res[i].quality == base.quality &&
+               !strcmp(res[i].name, base.name))
+            cur = &res[i];
+      }
+
+      if (!cur)
+      {
+         printf("FAIL: %s q%u %s was not run.\n", base.ident, base.quality, base.name);
+         failed++;
+         continue;
+      }
+
+      if (cur->snr < base.snr - snr_tolerance)
+      {
+         printf("FAIL: %s q%u %s SNR %.2f dB, baseline %.2f dB.\n",
+               cur->ident, cur->quality, cur->name, cur->snr, base.snr);
+         failed++;
+      }
+
+      if (cur->thd > base.thd + snr_tolerance)
+      {
+         printf("FAIL: %s q%u %s THD %.2f dB, baseline %.2f dB.\n",
+               cur->ident, cur->quality, cur->name, cur->thd, base.thd);
+         failed++;
+      }
+
+      if (same_cpu && cur->ns_per_frame > base.ns_per_frame * (1.0 + speed_tolerance))
+      {
+         printf("FAIL: %s q%u %s %.2f ns/frame, baseline %.2f ns/frame.\n",
+               cur->ident, cur->quality, cur->name, cur->ns_per_frame, base.ns_per_frame);
+         failed++;
+      }
+   }
+
+   fclose(file);
+   return failed;
+}
+
+static bool is_fixed_quality(const char *ident)
+{
+   for (unsigned i = 0; i < sizeof(fixed_quality) / sizeof(fixed_quality[0]); i++)
+      if (!strcmp(fixed_quality[i], ident))
+         return true;
+   return false;
+}
+
+static void print_help(void)
+{
+   fprintf(stderr, "Usage: bench [-o results] [-b baseline] [-q snr_tolerance_db] [-s speed_tolerance]\n");
+   fprintf(stderr, "\tSpeed tolerance is a fraction, e.g. 0.25 fails cases more than 25%% slower than the baseline.\n");
+}
+
+int main(int argc, char *argv[])
+{
+   const char *out_path = NULL;
+   const char *baseline_path = NULL;
+   double snr_tolerance = DEFAULT_SNR_TOLERANCE;
+   double speed_tolerance = DEFAULT_SPEED_TOLERANCE;
+
+   int c;
+   while ((c = getopt(argc, argv, "o:b:q:s:h")) != -1)
+   {
+      switch (c)
+      {
+         case 'o':
+            out_path = optarg;
+            break;
+         case 'b':
+            baseline_path = optarg;
+            break;
+         case 'q':
+            snr_tolerance = strtod(optarg, NULL);
+            break;
+         case 's':
+            speed_tolerance = strtod(optarg, NULL);
+            break;
+         default:
+            print_help();
+            return 1;
+      }
+   }
+
+   unsigned max_results = 0;
+   for (unsigned i = 0; rarch_resampler_get_ident(i); i++)
+      max_results += (RESAMPLER_QUALITY_HIGHEST + 1) * (sizeof(cases) / sizeof(cases[0]));
+
+   struct bench_result *res = (struct bench_result*)calloc(max_results, sizeof(*res));
+   if (!res)
+      return 1;
+
+   printf("%-10s %2s %-16s %12s %14s %9s %9s\n",
+         "backend", "q", "case", "ns/frame", "frames/s", "SNR dB", "THD dB");
+
+   unsigned num = 0;
+   const char *ident;
+   for (unsigned i = 0; (ident = rarch_resampler_get_ident(i)); i++)
+   {
+      unsigned lo = RESAMPLER_QUALITY_LOWEST, hi = RESAMPLER_QUALITY_HIGHEST;
+      if (is_fixed_quality(ident))
+         lo = hi = RESAMPLER_QUALITY_DONTCARE;
+
+      for (unsigned q = lo; q <= hi; q++)
+      {
+         for (unsigned j = 0; j < sizeof(cases) / sizeof(cases[0]); j++)
+         {
+            struct bench_result *r = &res[num];
+            if (!run_case(ident, (enum resampler_quality)q, &cases[j], r))
+            {
+               printf("Failed to run %s q%u %s.\n", ident, q, cases[j].name);
+               free(res);
+               return 1;
+            }
+
+            printf("%-10s %2u %-16s %12.2f %14.0f %9.2f %9.2f\n",
+                  r->ident, r->quality, r->name, r->ns_per_frame, r->frames_per_sec, r->snr, r->thd);
+            fflush(stdout);
+            num++;
+         }
+      }
+   }
+
+   char cpu[320];
+   get_cpu_ident(cpu, sizeof(cpu));
+
+   int ret = 0;
+   if (out_path && !write_results(out_path, cpu, res, num))
+   {
+      printf("Failed to write %s.\n", out_path);
+      ret = 1;
+   }
+
+   if (baseline_path)
+   {
+      int failed = compare_baseline(baseline_path, cpu, res, num, snr_tolerance, speed_tolerance);
+      if (failed < 0)
+      {
+         printf("Failed to read baseline %s.\n", baseline_path);
+         ret = 1;
+      }
+      else if (failed > 0)
+      {
+         printf("%d regression(s) against %s.\n", failed, baseline_path);
+         ret = 1;
+      }
+      else
+         printf("No regressions against %s.\n", baseline_path);
+   }
+
+   free(res);
+   return ret;
+}
+
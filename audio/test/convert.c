@@ -0,0 +1,227 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2013 - Hans-Kristian Arntzen
+ * 
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Checks every sample converter the CPU supports against the others, and reports their throughput.
+// The x86 SIMD variants must agree bit for bit, and saturate out of range floats.
+
+#include "../utils.h"
+#include "../../performance.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// Samples per call. Input and output together stay well inside L2.
+#define BENCH_SAMPLES (16 * 1024)
+#define BENCH_BYTES (256 * 1024 * 1024)
+
+typedef void (*s16_to_float_t)(float *out, const int16_t *in, size_t samples, float gain);
+typedef void (*float_to_s16_t)(int16_t *out, const float *in, size_t samples);
+typedef void (*planarize_float_t)(float *out, const float *in, size_t frames);
+typedef void (*planarize_s16_t)(int16_t *out, const int16_t *in, size_t frames);
+
+struct variant
+{
+   const char *name;
+   unsigned simd; // Needs all of these.
+   s16_to_float_t s16_to_float;
+   float_to_s16_t float_to_s16;
+   planarize_float_t planarize_float;
+   planarize_s16_t planarize_s16;
+};
+
+static const struct variant variants[] = {
+   { "C", 0,
+      audio_convert_s16_to_float_C, audio_convert_float_to_s16_C,
+      audio_convert_planarize_float_C, audio_convert_planarize_s16_C },
+#if defined(AUDIO_CONVERT_X86)
+   { "SSE2", RARCH_SIMD_SSE2,
+      audio_convert_s16_to_float_SSE2, audio_convert_float_to_s16_SSE2,
+      audio_convert_planarize_float_SSE2, audio_convert_planarize_s16_SSE2 },
+   { "SSE4.1", RARCH_SIMD_SSE2 | RARCH_SIMD_SSE41,
+      audio_convert_s16_to_float_SSE41, NULL, NULL, NULL },
+   { "AVX2", RARCH_SIMD_SSE2 | RARCH_SIMD_AVX2,
+      audio_convert_s16_to_float_AVX2, audio_convert_float_to_s16_AVX2,
+      audio_convert_planarize_float_AVX2, audio_convert_planarize_s16_AVX2 },
+#endif
+};
+
+static double time_sec(void)
+{
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return tv.tv_sec + tv.tv_nsec / 1000000000.0;
+}
+
+static float float_in[2 * BENCH_SAMPLES];
+static int16_t s16_in[2 * BENCH_SAMPLES];
+static float float_out[2][2 * BENCH_SAMPLES];
+static int16_t s16_out[2][2 * BENCH_SAMPLES];
+
+static void gen_input(void)
+{
+   srand(0);
+   for (size_t i = 0; i < 2 * BENCH_SAMPLES; i++)
+   {
+      s16_in[i]   = (int16_t)(rand() & 0xffff);
+      float_in[i] = (rand() / (float)RAND_MAX) * 2.4f - 1.2f; // Some of it clips.
+   }
+
+   // Values which overflow int32_t, and NaN. Within the first SIMD block, as the C tails don't saturate these.
+   float_in[1] = 1e10f;
+   float_in[2] = -1e10f;
+   float_in[3] = INFINITY;
+   float_in[4] = NAN;
+}
+
+// Lengths are varied so every tail path runs.
+static bool check(const struct variant *ref, const struct variant *v)
+{
+   static const size_t lengths[] = { 1, 7, 8, 9, 15, 16, 17, 31, 33, 100, 4099, 2 * BENCH_SAMPLES };
+   bool ok = true;
+
+   for (unsigned l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++)
+   {
+      size_t n = lengths[l];
+
+      if (v->s16_to_float)
+      {
+         ref->s16_to_float(float_out[0], s16_in, n, 0.7f);
+         v->s16_to_float(float_out[1], s16_in, n, 0.7f);
+         if (memcmp(float_out[0], float_out[1], n * sizeof(float)))
+         {
+            fprintf(stderr, "%s: s16 -> float differs for %u samples.\n", v->name, (unsigned)n);
+            ok = false;
+         }
+      }
+
+      if (v->float_to_s16)
+      {
+         ref->float_to_s16(s16_out[0], float_in, n);
+         v->float_to_s16(s16_out[1], float_in, n);
+         if (memcmp(s16_out[0], s16_out[1], n * sizeof(int16_t)))
+         {
+            fprintf(stderr, "%s: float -> s16 differs for %u samples.\n", v->name, (unsigned)n);
+            ok = false;
+         }
+
+         if (n >= 8 && (s16_out[1][1] != 0x7fff || s16_out[1][2] != -0x8000 || s16_out[1][3] != 0x7fff))
+         {
+            fprintf(stderr, "%s: float -> s16 doesn't saturate.\n", v->name);
+            ok = false;
+         }
+      }
+
+      size_t frames = n / 2;
+      if (v->planarize_float)
+      {
+         audio_convert_planarize_float_C(float_out[0], float_in, frames);
+         v->planarize_float(float_out[1], float_in, frames);
+         if (memcmp(float_out[0], float_out[1], 2 * frames * sizeof(float)))
+         {
+            fprintf(stderr, "%s: float planarize differs for %u frames.\n", v->name, (unsigned)frames);
+            ok = false;
+         }
+      }
+
+      if (v->planarize_s16)
+      {
+         audio_convert_planarize_s16_C(s16_out[0], s16_in, frames);
+         v->planarize_s16(s16_out[1], s16_in, frames);
+         if (memcmp(s16_out[0], s16_out[1], 2 * frames * sizeof(int16_t)))
+         {
+            fprintf(stderr, "%s: s16 planarize differs for %u frames.\n", v->name, (unsigned)frames);
+            ok = false;
+         }
+      }
+   }
+
+   return ok;
+}
+
+// Returns GB/s of input and output together.
+static double bench(const struct variant *v, unsigned which)
+{
+   size_t bytes_per_call = 0;
+   switch (which)
+   {
+      case 0: bytes_per_call = BENCH_SAMPLES * (sizeof(int16_t) + sizeof(float)); break;
+      case 1: bytes_per_call = BENCH_SAMPLES * (sizeof(float) + sizeof(int16_t)); break;
+      case 2: bytes_per_call = BENCH_SAMPLES * 2 * sizeof(float); break;
+      case 3: bytes_per_call = BENCH_SAMPLES * 2 * sizeof(int16_t); break;
+   }
+
+   unsigned calls = BENCH_BYTES / bytes_per_call;
+   double start = time_sec();
+   for (unsigned i = 0; i < calls; i++)
+   {
+      switch (which)
+      {
+         case 0: v->s16_to_float(float_out[0], s16_in, BENCH_SAMPLES, 1.0f); break;
+         case 1: v->float_to_s16(s16_out[0], float_in, BENCH_SAMPLES); break;
+         case 2: v->planarize_float(float_out[0], float_in, BENCH_SAMPLES / 2); break;
+         case 3: v->planarize_s16(s16_out[0], s16_in, BENCH_SAMPLES / 2); break;
+      }
+   }
+
+   return (double)calls * bytes_per_call / (time_sec() - start) / 1e9;
+}
+
+int main(void)
+{
+   struct rarch_cpu_features cpu;
+   rarch_get_cpu_features(&cpu);
+   gen_input();
+
+   // C scales and rounds differently, and is undefined for huge floats.
+   // SIMD variants are compared against the first one of them, which is checked for saturation.
+   const struct variant *ref = NULL;
+   bool ok = true;
+
+   printf("%-8s %14s %14s %14s %14s\n", "GB/s", "s16 -> float", "float -> s16", "planar float", "planar s16");
+   for (unsigned i = 0; i < sizeof(variants) / sizeof(variants[0]); i++)
+   {
+      const struct variant *v = &variants[i];
+      if ((cpu.simd & v->simd) != v->simd)
+      {
+         printf("%-8s %14s\n", v->name, "(unsupported)");
+         continue;
+      }
+
+      if (v->simd)
+      {
+         if (!ref)
+            ref = v;
+         ok &= check(ref, v);
+      }
+
+      printf("%-8s", v->name);
+      for (unsigned which = 0; which < 4; which++)
+      {
+         bool has = (which == 0 && v->s16_to_float) || (which == 1 && v->float_to_s16) ||
+            (which == 2 && v->planarize_float) || (which == 3 && v->planarize_s16);
+         if (has)
+            printf(" %14.2f", bench(v, which));
+         else
+            printf(" %14s", "-");
+         fflush(stdout);
+      }
+      printf("\n");
+   }
+
+   printf("%s\n", ok ? "PASS" : "FAIL");
+   return ok ? 0 : 1;
+}
@@ -0,0 +1,50 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2013 - Hans-Kristian Arntzen
+ * 
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// The test harness is built without performance.c, which needs the rest of RetroArch.
+// Same CPU feature flags, from the compiler's builtins instead.
+
+#include "../../performance.h"
+#include <stdlib.h>
+
+void rarch_get_cpu_features(struct rarch_cpu_features *cpu)
+{
+   cpu->simd = 0;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("sse"))
+      cpu->simd |= RARCH_SIMD_SSE;
+   if (__builtin_cpu_supports("sse2"))
+      cpu->simd |= RARCH_SIMD_SSE2;
+   if (__builtin_cpu_supports("sse4.1"))
+      cpu->simd |= RARCH_SIMD_SSE41;
+   if (__builtin_cpu_supports("sse4.2"))
+      cpu->simd |= RARCH_SIMD_SSE42;
+   if (__builtin_cpu_supports("avx"))
+      cpu->simd |= RARCH_SIMD_AVX;
+   if (__builtin_cpu_supports("avx2"))
+      cpu->simd |= RARCH_SIMD_AVX2;
+   if (__builtin_cpu_supports("fma"))
+      cpu->simd |= RARCH_SIMD_FMA3;
+#elif defined(HAVE_NEON)
+   cpu->simd |= RARCH_SIMD_NEON;
+#endif
+
+   // Lets benchmarks compare kernels on the same machine.
+   const char *env = getenv("RESAMPLER_SIMD_MASK");
+   if (env)
+      cpu->simd &= strtoul(env, NULL, 0);
+}
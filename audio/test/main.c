@@ -21,6 +21,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+// Use first resampler unless the Makefile picks one.
+#ifndef RESAMPLER_IDENT
+#define RESAMPLER_IDENT NULL
+#endif
+
 int main(int argc, char *argv[])
 {
    int16_t input_i[1024];
@@ -29,14 +34,16 @@ int main(int argc, char *argv[])
    float input_f[1024];
    float output_f[1024 * 8];
 
-   if (argc != 3)
+   if (argc < 3 || argc > 4)
    {
-      fprintf(stderr, "Usage: %s <in-rate> <out-rate> (max ratio: 8.0)\n", argv[0]);
+      fprintf(stderr, "Usage: %s <in-rate> <out-rate> [quality 0-5] (max ratio: 8.0)\n", argv[0]);
       return 1;
    }
 
    double in_rate = strtod(argv[1], NULL);
    double out_rate = strtod(argv[2], NULL);
+   enum resampler_quality quality = argc == 4 ?
+      (enum resampler_quality)strtoul(argv[3], NULL, 0) : RESAMPLER_QUALITY_DONTCARE;
 
    double ratio = out_rate / in_rate;
    if (ratio >= 7.99)
@@ -47,7 +54,7 @@ int main(int argc, char *argv[])
 
    const rarch_resampler_t *resampler = NULL;
    void *re = NULL;
-   if (!rarch_resampler_realloc(&re, &resampler, NULL, out_rate / in_rate))
+   if (!rarch_resampler_realloc(&re, &resampler, RESAMPLER_IDENT, quality, out_rate / in_rate))
    {
       fprintf(stderr, "Failed to allocate resampler ...\n");
       return 1;
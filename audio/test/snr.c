@@ -235,15 +235,22 @@ static void calculate_snr(struct snr_result *res,
       res->alias_power[i] = 10.0 * log10(res->alias_power[i]);
 }
 
+// Use first resampler unless the Makefile picks one.
+#ifndef RESAMPLER_IDENT
+#define RESAMPLER_IDENT NULL
+#endif
+
 int main(int argc, char *argv[])
 {
-   if (argc != 2)
+   if (argc < 2 || argc > 3)
    {
-      fprintf(stderr, "Usage: %s <ratio> (out-rate is fixed for FFT).\n", argv[0]);
+      fprintf(stderr, "Usage: %s <ratio> [quality 0-5] (out-rate is fixed for FFT).\n", argv[0]);
       return 1;
    }
 
    double ratio = strtod(argv[1], NULL);
+   enum resampler_quality quality = argc == 3 ?
+      (enum resampler_quality)strtoul(argv[2], NULL, 0) : RESAMPLER_QUALITY_DONTCARE;
 
    const unsigned fft_samples = 1024 * 128;
    unsigned out_rate = fft_samples / 2;
@@ -269,7 +276,7 @@ int main(int argc, char *argv[])
 
    void *re = NULL;
    const rarch_resampler_t *resampler = NULL;
-   if (!rarch_resampler_realloc(&re, &resampler, NULL, ratio))
+   if (!rarch_resampler_realloc(&re, &resampler, RESAMPLER_IDENT, quality, ratio))
       return 1;
 
    test_fft();
@@ -0,0 +1,364 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2013 - Hans-Kristian Arntzen
+ * 
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "thread_wrapper.h"
+#include "../thread.h"
+#include "../fifo_buffer.h"
+#include "../general.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+enum audio_thread_cmd
+{
+   AUDIO_CMD_NONE = 0,
+   AUDIO_CMD_INIT,
+   AUDIO_CMD_FREE,
+   AUDIO_CMD_START,
+   AUDIO_CMD_STOP,
+
+   AUDIO_CMD_DUMMY = INT_MAX
+};
+
+typedef struct thread_audio
+{
+   slock_t *lock;
+   scond_t *cond_cmd;
+   scond_t *cond_thread;
+   sthread_t *thread;
+
+   const audio_driver_t *driver;
+   void *driver_data;
+
+   char *device;
+   unsigned out_rate;
+   unsigned latency;
+
+   fifo_buffer_t *buffer; // Main thread is the only writer, worker thread the only reader.
+   size_t buffer_size;
+   uint8_t *chunk;
+   size_t chunk_size;
+
+   bool use_float;
+   bool nonblock;
+   volatile bool stopped;
+   volatile bool failed;
+
+   // Last write_avail() of the driver itself, updated by the worker after every write.
+   volatile size_t driver_avail;
+   size_t driver_buffer_size;
+
+   enum audio_thread_cmd send_cmd;
+   enum audio_thread_cmd reply_cmd;
+   bool cmd_ret;
+
+   audio_driver_t audio_thread;
+} thread_audio_t;
+
+static void *audio_thread_init_never_call(const char *device, unsigned rate, unsigned latency)
+{
+   (void)device;
+   (void)rate;
+   (void)latency;
+   RARCH_ERR("Sanity check fail! Threaded audio mustn't be reinit.\n");
+   abort();
+   return NULL;
+}
+
+static void audio_thread_reply(thread_audio_t *thr, enum audio_thread_cmd cmd)
+{
+   slock_lock(thr->lock);
+   thr->reply_cmd = cmd;
+   thr->send_cmd = AUDIO_CMD_NONE;
+   scond_signal(thr->cond_cmd);
+   slock_unlock(thr->lock);
+}
+
+static bool audio_thread_init_driver(thread_audio_t *thr)
+{
+   // The driver gets whatever part of the latency the ring doesn't hold.
+   unsigned ring_latency = thr->latency / 2;
+   thr->driver_data = thr->driver->init(thr->device, thr->out_rate, thr->latency - ring_latency);
+   if (!thr->driver_data)
+      return false;
+
+   thr->use_float = thr->driver->use_float && thr->driver->use_float(thr->driver_data);
+   if (thr->driver->write_avail && thr->driver->buffer_size)
+   {
+      thr->driver_buffer_size = thr->driver->buffer_size(thr->driver_data);
+      thr->driver_avail = thr->driver->write_avail(thr->driver_data);
+   }
+
+   size_t frame_size = thr->use_float ? 2 * sizeof(float) : 2 * sizeof(int16_t);
+   size_t ring_frames = (size_t)thr->out_rate * ring_latency / 1000;
+   if (ring_frames < 64)
+      ring_frames = 64;
+
+   // Worker feeds the driver in quarters of the ring.
+   // Small enough to keep the driver topped up, large enough that waking up is cheap.
+   thr->chunk_size = (ring_frames / 4) * frame_size;
+   thr->chunk = (uint8_t*)malloc(thr->chunk_size);
+   thr->buffer_size = ring_frames * frame_size;
+   thr->buffer = fifo_new(thr->buffer_size);
+   if (!thr->chunk || !thr->buffer)
+      return false;
+
+   RARCH_LOG("Threaded audio: %u ms ring, %u ms in \"%s\".\n",
+         ring_latency, thr->latency - ring_latency, thr->driver->ident);
+   return true;
+}
+
+static void audio_thread_loop(void *data)
+{
+   thread_audio_t *thr = (thread_audio_t*)data;
+
+   for (;;)
+   {
+      slock_lock(thr->lock);
+      // Only audio work left to do once the driver is up and running.
+      while (thr->send_cmd == AUDIO_CMD_NONE && (!thr->buffer || thr->stopped || thr->failed))
+         scond_wait(thr->cond_thread, thr->lock);
+      enum audio_thread_cmd cmd = thr->send_cmd;
+      slock_unlock(thr->lock);
+
+      switch (cmd)
+      {
+         case AUDIO_CMD_NONE:
+            break;
+
+         case AUDIO_CMD_INIT:
+            thr->cmd_ret = audio_thread_init_driver(thr);
+            if (!thr->cmd_ret)
+               thr->failed = true;
+            audio_thread_reply(thr, AUDIO_CMD_INIT);
+            continue;
+
+         case AUDIO_CMD_FREE:
+            if (thr->driver_data)
+               thr->driver->free(thr->driver_data);
+            thr->driver_data = NULL;
+            audio_thread_reply(thr, AUDIO_CMD_FREE);
+            return;
+
+         case AUDIO_CMD_START:
+            thr->cmd_ret = thr->driver->start(thr->driver_data);
+            if (thr->cmd_ret)
+               thr->stopped = false;
+            audio_thread_reply(thr, AUDIO_CMD_START);
+            continue;
+
+         case AUDIO_CMD_STOP:
+            thr->cmd_ret = thr->driver->stop(thr->driver_data);
+            thr->stopped = true;
+            audio_thread_reply(thr, AUDIO_CMD_STOP);
+            continue;
+
+         default:
+            audio_thread_reply(thr, cmd);
+            continue;
+      }
+
+      // Returns early if a command is pending.
+      if (fifo_wait_read_avail(thr->buffer, thr->chunk_size) < thr->chunk_size)
+         continue;
+
+      fifo_read(thr->buffer, thr->chunk, thr->chunk_size);
+
+      // Driver is always left in blocking mode, nonblocking is handled on the ring.
+      if (thr->driver->write(thr->driver_data, thr->chunk, thr->chunk_size) < 0)
+      {
+         RARCH_ERR("Threaded audio: driver \"%s\" failed to write.\n", thr->driver->ident);
+         thr->failed = true;
+         fifo_cancel_wait(thr->buffer); // Wake up the main thread if it is waiting for room.
+         continue;
+      }
+
+      if (thr->driver_buffer_size)
+         thr->driver_avail = thr->driver->write_avail(thr->driver_data);
+   }
+}
+
+static void audio_thread_send_cmd(thread_audio_t *thr, enum audio_thread_cmd cmd)
+{
+   slock_lock(thr->lock);
+   thr->send_cmd = cmd;
+   thr->reply_cmd = AUDIO_CMD_NONE;
+   scond_signal(thr->cond_thread);
+   slock_unlock(thr->lock);
+
+   // Worker might be sleeping on the ring instead.
+   // The ring is created by AUDIO_CMD_INIT, and is only touched here once that has replied.
+   if (cmd != AUDIO_CMD_INIT && thr->buffer)
+      fifo_cancel_wait(thr->buffer);
+}
+
+static void audio_thread_wait_reply(thread_audio_t *thr, enum audio_thread_cmd cmd)
+{
+   slock_lock(thr->lock);
+   while (cmd != thr->reply_cmd)
+      scond_wait(thr->cond_cmd, thr->lock);
+   slock_unlock(thr->lock);
+}
+
+static ssize_t audio_thread_write(void *data, const void *buf, size_t size)
+{
+   thread_audio_t *thr = (thread_audio_t*)data;
+   if (thr->failed)
+      return -1;
+
+   // Ring won't drain while stopped, so don't wait for it.
+   if (thr->nonblock || thr->stopped)
+   {
+      size_t avail = fifo_write_avail(thr->buffer);
+      size_t write_amt = min(avail, size);
+      fifo_write(thr->buffer, buf, write_amt);
+      return write_amt;
+   }
+
+   size_t written = 0;
+   while (written < size && !thr->failed)
+   {
+      // Wait for a full chunk of room, as the worker frees it a chunk at a time anyways.
+      size_t avail = fifo_wait_write_avail(thr->buffer, min(size - written, thr->chunk_size));
+      size_t write_amt = min(size - written, avail);
+      fifo_write(thr->buffer, (const uint8_t*)buf + written, write_amt);
+      written += write_amt;
+   }
+
+   return thr->failed ? -1 : (ssize_t)written;
+}
+
+static bool audio_thread_stop(void *data)
+{
+   thread_audio_t *thr = (thread_audio_t*)data;
+   audio_thread_send_cmd(thr, AUDIO_CMD_STOP);
+   audio_thread_wait_reply(thr, AUDIO_CMD_STOP);
+   return thr->cmd_ret;
+}
+
+static bool audio_thread_start(void *data)
+{
+   thread_audio_t *thr = (thread_audio_t*)data;
+   audio_thread_send_cmd(thr, AUDIO_CMD_START);
+   audio_thread_wait_reply(thr, AUDIO_CMD_START);
+   return thr->cmd_ret;
+}
+
+static void audio_thread_set_nonblock_state(void *data, bool state)
+{
+   thread_audio_t *thr = (thread_audio_t*)data;
+   thr->nonblock = state;
+}
+
+static void audio_thread_free(void *data)
+{
+   thread_audio_t *thr = (thread_audio_t*)data;
+
+   if (thr->thread)
+   {
+      audio_thread_send_cmd(thr, AUDIO_CMD_FREE);
+      audio_thread_wait_reply(thr, AUDIO_CMD_FREE);
+      sthread_join(thr->thread);
+   }
+
+   if (thr->buffer)
+      fifo_free(thr->buffer);
+   if (thr->lock)
+      slock_free(thr->lock);
+   if (thr->cond_cmd)
+      scond_free(thr->cond_cmd);
+   if (thr->cond_thread)
+      scond_free(thr->cond_thread);
+
+   free(thr->chunk);
+   free(thr->device);
+   free(thr);
+}
+
+static bool audio_thread_use_float(void *data)
+{
+   thread_audio_t *thr = (thread_audio_t*)data;
+   return thr->use_float;
+}
+
+// Both the ring and the driver's own buffer count, so rate control sees the whole queue.
+static size_t audio_thread_write_avail(void *data)
+{
+   thread_audio_t *thr = (thread_audio_t*)data;
+   return fifo_write_avail(thr->buffer) + thr->driver_avail;
+}
+
+static size_t audio_thread_buffer_size(void *data)
+{
+   thread_audio_t *thr = (thread_audio_t*)data;
+   return thr->buffer_size + thr->driver_buffer_size;
+}
+
+static const audio_driver_t audio_thread = {
+   audio_thread_init_never_call, // Should never be called directly.
+   audio_thread_write,
+   audio_thread_stop,
+   audio_thread_start,
+   audio_thread_set_nonblock_state,
+   audio_thread_free,
+   audio_thread_use_float,
+   "Thread wrapper",
+   audio_thread_write_avail,
+   audio_thread_buffer_size,
+};
+
+static bool audio_thread_init(thread_audio_t *thr)
+{
+   thr->lock = slock_new();
+   thr->cond_cmd = scond_new();
+   thr->cond_thread = scond_new();
+   if (!thr->lock || !thr->cond_cmd || !thr->cond_thread)
+      return false;
+
+   thr->thread = sthread_create(audio_thread_loop, thr);
+   if (!thr->thread)
+      return false;
+   audio_thread_send_cmd(thr, AUDIO_CMD_INIT);
+   audio_thread_wait_reply(thr, AUDIO_CMD_INIT);
+
+   return thr->cmd_ret;
+}
+
+bool rarch_threaded_audio_init(const audio_driver_t **out_driver, void **out_data,
+      const char *device, unsigned out_rate, unsigned latency,
+      const audio_driver_t *driver)
+{
+   *out_data = NULL;
+
+   thread_audio_t *thr = (thread_audio_t*)calloc(1, sizeof(*thr));
+   if (!thr)
+      return false;
+
+   thr->audio_thread = audio_thread;
+   thr->driver   = driver;
+   thr->device   = device ? strdup(device) : NULL;
+   thr->out_rate = out_rate;
+   thr->latency  = latency;
+
+   if (!audio_thread_init(thr))
+   {
+      audio_thread_free(thr);
+      return false;
+   }
+
+   *out_driver = &thr->audio_thread;
+   *out_data   = thr;
+   return true;
+}
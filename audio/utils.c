@@ -19,8 +19,8 @@
 #include "../general.h"
 #include "../performance.h"
 
-#if defined(__SSE2__)
-#include <emmintrin.h>
+#if defined(AUDIO_CONVERT_X86)
+#include <immintrin.h>
 #elif defined(__ALTIVEC__)
 #include <altivec.h>
 #endif
@@ -43,7 +43,31 @@ void audio_convert_float_to_s16_C(int16_t *out,
    }
 }
 
-#if defined(__SSE2__)
+void audio_convert_planarize_float_C(float *out,
+      const float *in, size_t frames)
+{
+   for (size_t i = 0; i < frames; i++)
+   {
+      out[i] = in[2 * i + 0];
+      out[i + frames] = in[2 * i + 1];
+   }
+}
+
+void audio_convert_planarize_s16_C(int16_t *out,
+      const int16_t *in, size_t frames)
+{
+   for (size_t i = 0; i < frames; i++)
+   {
+      out[i] = in[2 * i + 0];
+      out[i + frames] = in[2 * i + 1];
+   }
+}
+
+#if defined(AUDIO_CONVERT_X86)
+// SIMD variants scale by 0x7fff rather than 0x8000, and round rather than truncate.
+// Out of range floats saturate.
+
+AUDIO_CONVERT_TARGET("sse2")
 void audio_convert_s16_to_float_SSE2(float *out,
       const int16_t *in, size_t samples, float gain)
 {
@@ -70,15 +94,60 @@ void audio_convert_s16_to_float_SSE2(float *out,
    audio_convert_s16_to_float_C(out, in, samples - i, gain);
 }
 
+// Sign extends directly instead of going through the high half. Same result as SSE2.
+AUDIO_CONVERT_TARGET("sse4.1")
+void audio_convert_s16_to_float_SSE41(float *out,
+      const int16_t *in, size_t samples, float gain)
+{
+   __m128 factor = _mm_set1_ps(gain / 0x7fff);
+   size_t i;
+   for (i = 0; i + 8 <= samples; i += 8, in += 8, out += 8)
+   {
+      __m128i input = _mm_loadu_si128((const __m128i *)in);
+      __m128i lo = _mm_cvtepi16_epi32(input);
+      __m128i hi = _mm_cvtepi16_epi32(_mm_unpackhi_epi64(input, input));
+
+      _mm_storeu_ps(out + 0, _mm_mul_ps(_mm_cvtepi32_ps(lo), factor));
+      _mm_storeu_ps(out + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), factor));
+   }
+
+   audio_convert_s16_to_float_C(out, in, samples - i, gain);
+}
+
+AUDIO_CONVERT_TARGET("avx2")
+void audio_convert_s16_to_float_AVX2(float *out,
+      const int16_t *in, size_t samples, float gain)
+{
+   __m256 factor = _mm256_set1_ps(gain / 0x7fff);
+   size_t i;
+   for (i = 0; i + 16 <= samples; i += 16, in += 16, out += 16)
+   {
+      __m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)in + 0));
+      __m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)in + 1));
+
+      _mm256_storeu_ps(out + 0, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), factor));
+      _mm256_storeu_ps(out + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), factor));
+   }
+
+   audio_convert_s16_to_float_SSE2(out, in, samples - i, gain);
+}
+
+AUDIO_CONVERT_TARGET("sse2")
 void audio_convert_float_to_s16_SSE2(int16_t *out,
       const float *in, size_t samples)
 {
    __m128 factor = _mm_set1_ps((float)0x7fff);
+   // Clamp before converting, huge values and NaN would otherwise wrap to -0x8000.
+   __m128 max = _mm_set1_ps((float)0x7fff);
+   __m128 min = _mm_set1_ps((float)-0x8000);
    size_t i;
    for (i = 0; i + 8 <= samples; i += 8, in += 8, out += 8)
    {
       __m128 input[2] = { _mm_loadu_ps(in + 0), _mm_loadu_ps(in + 4) };
-      __m128 res[2] = { _mm_mul_ps(input[0], factor), _mm_mul_ps(input[1], factor) };
+      __m128 res[2] = {
+         _mm_min_ps(_mm_max_ps(_mm_mul_ps(input[0], factor), min), max),
+         _mm_min_ps(_mm_max_ps(_mm_mul_ps(input[1], factor), min), max),
+      };
 
       __m128i ints[2] = { _mm_cvtps_epi32(res[0]), _mm_cvtps_epi32(res[1]) };
       __m128i packed = _mm_packs_epi32(ints[0], ints[1]);
@@ -88,6 +157,144 @@ void audio_convert_float_to_s16_SSE2(int16_t *out,
 
    audio_convert_float_to_s16_C(out, in, samples - i);
 }
+
+AUDIO_CONVERT_TARGET("avx2")
+void audio_convert_float_to_s16_AVX2(int16_t *out,
+      const float *in, size_t samples)
+{
+   __m256 factor = _mm256_set1_ps((float)0x7fff);
+   __m256 max = _mm256_set1_ps((float)0x7fff);
+   __m256 min = _mm256_set1_ps((float)-0x8000);
+   size_t i;
+   for (i = 0; i + 16 <= samples; i += 16, in += 16, out += 16)
+   {
+      __m256 res[2] = {
+         _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + 0), factor), min), max),
+         _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + 8), factor), min), max),
+      };
+
+      // Packing works per 128-bit lane, so the middle quarters come out swapped.
+      __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(res[0]), _mm256_cvtps_epi32(res[1]));
+      _mm256_storeu_si256((__m256i *)out, _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+   }
+
+   audio_convert_float_to_s16_SSE2(out, in, samples - i);
+}
+
+AUDIO_CONVERT_TARGET("sse2")
+void audio_convert_planarize_float_SSE2(float *out,
+      const float *in, size_t frames)
+{
+   float *out_r = out + frames;
+   size_t i;
+   for (i = 0; i + 4 <= frames; i += 4, in += 8)
+   {
+      __m128 a = _mm_loadu_ps(in + 0);
+      __m128 b = _mm_loadu_ps(in + 4);
+      _mm_storeu_ps(out + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+      _mm_storeu_ps(out_r + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+   }
+
+   for (; i < frames; i++, in += 2)
+   {
+      out[i]   = in[0];
+      out_r[i] = in[1];
+   }
+}
+
+AUDIO_CONVERT_TARGET("avx2")
+void audio_convert_planarize_float_AVX2(float *out,
+      const float *in, size_t frames)
+{
+   float *out_r = out + frames;
+   size_t i;
+   for (i = 0; i + 8 <= frames; i += 8, in += 16)
+   {
+      __m256 a = _mm256_loadu_ps(in + 0);
+      __m256 b = _mm256_loadu_ps(in + 8);
+
+      // Shuffles work per 128-bit lane, which leaves frames in 0 1 4 5 2 3 6 7 order.
+      __m256d l = _mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+      __m256d r = _mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+      _mm256_storeu_ps(out + i, _mm256_castpd_ps(_mm256_permute4x64_pd(l, _MM_SHUFFLE(3, 1, 2, 0))));
+      _mm256_storeu_ps(out_r + i, _mm256_castpd_ps(_mm256_permute4x64_pd(r, _MM_SHUFFLE(3, 1, 2, 0))));
+   }
+
+   for (; i < frames; i++, in += 2)
+   {
+      out[i]   = in[0];
+      out_r[i] = in[1];
+   }
+}
+
+AUDIO_CONVERT_TARGET("sse2")
+void audio_convert_planarize_s16_SSE2(int16_t *out,
+      const int16_t *in, size_t frames)
+{
+   int16_t *out_r = out + frames;
+   size_t i;
+   for (i = 0; i + 8 <= frames; i += 8, in += 16)
+   {
+      __m128i a = _mm_loadu_si128((const __m128i *)in + 0);
+      __m128i b = _mm_loadu_si128((const __m128i *)in + 1);
+
+      // Each frame is one 32-bit word. Sign extend either half, then pack it back down.
+      __m128i l = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+            _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+      __m128i r = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+
+      _mm_storeu_si128((__m128i *)(out + i), l);
+      _mm_storeu_si128((__m128i *)(out_r + i), r);
+   }
+
+   for (; i < frames; i++, in += 2)
+   {
+      out[i]   = in[0];
+      out_r[i] = in[1];
+   }
+}
+
+AUDIO_CONVERT_TARGET("avx2")
+void audio_convert_planarize_s16_AVX2(int16_t *out,
+      const int16_t *in, size_t frames)
+{
+   int16_t *out_r = out + frames;
+   size_t i;
+   for (i = 0; i + 16 <= frames; i += 16, in += 32)
+   {
+      __m256i a = _mm256_loadu_si256((const __m256i *)in + 0);
+      __m256i b = _mm256_loadu_si256((const __m256i *)in + 1);
+
+      __m256i l = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16),
+            _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16));
+      __m256i r = _mm256_packs_epi32(_mm256_srai_epi32(a, 16), _mm256_srai_epi32(b, 16));
+
+      _mm256_storeu_si256((__m256i *)(out + i), _mm256_permute4x64_epi64(l, _MM_SHUFFLE(3, 1, 2, 0)));
+      _mm256_storeu_si256((__m256i *)(out_r + i), _mm256_permute4x64_epi64(r, _MM_SHUFFLE(3, 1, 2, 0)));
+   }
+
+   for (; i < frames; i++, in += 2)
+   {
+      out[i]   = in[0];
+      out_r[i] = in[1];
+   }
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define AUDIO_CONVERT_DEFAULT(func) func##_SSE2
+#else
+#define AUDIO_CONVERT_DEFAULT(func) func##_C
+#endif
+
+void (*audio_convert_s16_to_float_x86)(float *out,
+      const int16_t *in, size_t samples, float gain) = AUDIO_CONVERT_DEFAULT(audio_convert_s16_to_float);
+void (*audio_convert_float_to_s16_x86)(int16_t *out,
+      const float *in, size_t samples) = AUDIO_CONVERT_DEFAULT(audio_convert_float_to_s16);
+void (*audio_convert_planarize_float_x86)(float *out,
+      const float *in, size_t frames) = AUDIO_CONVERT_DEFAULT(audio_convert_planarize_float);
+void (*audio_convert_planarize_s16_x86)(int16_t *out,
+      const int16_t *in, size_t frames) = AUDIO_CONVERT_DEFAULT(audio_convert_planarize_s16);
+
 #elif defined(__ALTIVEC__)
 void audio_convert_s16_to_float_altivec(float *out,
       const int16_t *in, size_t samples, float gain)
@@ -167,7 +374,33 @@ static void audio_convert_float_to_s16_neon(int16_t *out, const float *in, size_
 
 void audio_convert_init_simd(void)
 {
-#ifdef HAVE_NEON
+#if defined(AUDIO_CONVERT_X86)
+   struct rarch_cpu_features cpu;
+   rarch_get_cpu_features(&cpu);
+
+   if (cpu.simd & RARCH_SIMD_AVX2)
+   {
+      audio_convert_s16_to_float_x86    = audio_convert_s16_to_float_AVX2;
+      audio_convert_float_to_s16_x86    = audio_convert_float_to_s16_AVX2;
+      audio_convert_planarize_float_x86 = audio_convert_planarize_float_AVX2;
+      audio_convert_planarize_s16_x86   = audio_convert_planarize_s16_AVX2;
+   }
+   else if (cpu.simd & RARCH_SIMD_SSE2)
+   {
+      audio_convert_s16_to_float_x86    = cpu.simd & RARCH_SIMD_SSE41 ?
+         audio_convert_s16_to_float_SSE41 : audio_convert_s16_to_float_SSE2;
+      audio_convert_float_to_s16_x86    = audio_convert_float_to_s16_SSE2;
+      audio_convert_planarize_float_x86 = audio_convert_planarize_float_SSE2;
+      audio_convert_planarize_s16_x86   = audio_convert_planarize_s16_SSE2;
+   }
+   else
+   {
+      audio_convert_s16_to_float_x86    = audio_convert_s16_to_float_C;
+      audio_convert_float_to_s16_x86    = audio_convert_float_to_s16_C;
+      audio_convert_planarize_float_x86 = audio_convert_planarize_float_C;
+      audio_convert_planarize_s16_x86   = audio_convert_planarize_s16_C;
+   }
+#elif defined(HAVE_NEON)
    struct rarch_cpu_features cpu;
    rarch_get_cpu_features(&cpu);
    audio_convert_s16_to_float_arm = cpu.simd & RARCH_SIMD_NEON ?
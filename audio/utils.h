@@ -23,19 +23,57 @@
 #include "../config.h"
 #endif
 
-#if defined(__SSE2__)
-#define audio_convert_s16_to_float audio_convert_s16_to_float_SSE2
-#define audio_convert_float_to_s16 audio_convert_float_to_s16_SSE2
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AUDIO_CONVERT_X86
+#define AUDIO_CONVERT_TARGET(x) __attribute__((target(x)))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)) && !defined(_XBOX)
+#define AUDIO_CONVERT_X86
+#define AUDIO_CONVERT_TARGET(x)
+#endif
+
+#if defined(AUDIO_CONVERT_X86)
+// Picked at runtime by audio_convert_init_simd(). Until then, SSE2 if the build can assume it, otherwise C.
+#define audio_convert_s16_to_float audio_convert_s16_to_float_x86
+#define audio_convert_float_to_s16 audio_convert_float_to_s16_x86
+#define audio_convert_planarize_float audio_convert_planarize_float_x86
+#define audio_convert_planarize_s16 audio_convert_planarize_s16_x86
+
+extern void (*audio_convert_s16_to_float_x86)(float *out,
+      const int16_t *in, size_t samples, float gain);
+extern void (*audio_convert_float_to_s16_x86)(int16_t *out,
+      const float *in, size_t samples);
+extern void (*audio_convert_planarize_float_x86)(float *out,
+      const float *in, size_t frames);
+extern void (*audio_convert_planarize_s16_x86)(int16_t *out,
+      const int16_t *in, size_t frames);
 
+// All x86 variants give the same results, only the C fallback differs slightly.
 void audio_convert_s16_to_float_SSE2(float *out,
       const int16_t *in, size_t samples, float gain);
+void audio_convert_s16_to_float_SSE41(float *out,
+      const int16_t *in, size_t samples, float gain);
+void audio_convert_s16_to_float_AVX2(float *out,
+      const int16_t *in, size_t samples, float gain);
 
 void audio_convert_float_to_s16_SSE2(int16_t *out,
       const float *in, size_t samples);
+void audio_convert_float_to_s16_AVX2(int16_t *out,
+      const float *in, size_t samples);
+
+void audio_convert_planarize_float_SSE2(float *out,
+      const float *in, size_t frames);
+void audio_convert_planarize_float_AVX2(float *out,
+      const float *in, size_t frames);
+void audio_convert_planarize_s16_SSE2(int16_t *out,
+      const int16_t *in, size_t frames);
+void audio_convert_planarize_s16_AVX2(int16_t *out,
+      const int16_t *in, size_t frames);
 
 #elif defined(__ALTIVEC__)
 #define audio_convert_s16_to_float audio_convert_s16_to_float_altivec
 #define audio_convert_float_to_s16 audio_convert_float_to_s16_altivec
+#define audio_convert_planarize_float audio_convert_planarize_float_C
+#define audio_convert_planarize_s16 audio_convert_planarize_s16_C
 
 void audio_convert_s16_to_float_altivec(float *out,
       const int16_t *in, size_t samples, float gain);
@@ -46,6 +84,8 @@ void audio_convert_float_to_s16_altivec(int16_t *out,
 #elif defined(HAVE_NEON)
 #define audio_convert_s16_to_float audio_convert_s16_to_float_arm
 #define audio_convert_float_to_s16 audio_convert_float_to_s16_arm
+#define audio_convert_planarize_float audio_convert_planarize_float_C
+#define audio_convert_planarize_s16 audio_convert_planarize_s16_C
 
 void (*audio_convert_s16_to_float_arm)(float *out,
       const int16_t *in, size_t samples, float gain);
@@ -55,6 +95,8 @@ void (*audio_convert_float_to_s16_arm)(int16_t *out,
 #else
 #define audio_convert_s16_to_float audio_convert_s16_to_float_C
 #define audio_convert_float_to_s16 audio_convert_float_to_s16_C
+#define audio_convert_planarize_float audio_convert_planarize_float_C
+#define audio_convert_planarize_s16 audio_convert_planarize_s16_C
 #endif
 
 void audio_convert_s16_to_float_C(float *out,
@@ -62,6 +104,12 @@ void audio_convert_s16_to_float_C(float *out,
 void audio_convert_float_to_s16_C(int16_t *out,
       const float *in, size_t samples);
 
+// Interleaved stereo to all left samples followed by all right samples.
+void audio_convert_planarize_float_C(float *out,
+      const float *in, size_t frames);
+void audio_convert_planarize_s16_C(int16_t *out,
+      const int16_t *in, size_t frames);
+
 void audio_convert_init_simd(void);
 
 #ifdef HAVE_RSOUND
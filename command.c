@@ -232,8 +232,19 @@ static bool cmd_set_shader(const char *arg)
    return video_set_shader_func(type, arg, RARCH_SHADER_INDEX_MULTIPASS);
 }
 
+static bool cmd_rewind_seek(const char *arg)
+{
+   char *end = NULL;
+   unsigned long states = strtoul(arg, &end, 0);
+   if (end == arg || *end != '\0')
+      return false;
+
+   return rarch_rewind_seek(states);
+}
+
 static const struct cmd_action_map action_map[] = {
-   { "SET_SHADER", cmd_set_shader, "<shader path>" },
+   { "SET_SHADER",  cmd_set_shader,  "<shader path>" },
+   { "REWIND_SEEK", cmd_rewind_seek, "<rewind states>" },
 };
 
 static bool command_get_arg(const char *tok, const char **arg, unsigned *index)
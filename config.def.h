@@ -317,6 +317,10 @@ static const int out_latency = 64;
 // Will sync audio. (recommended) 
 static const bool audio_sync = true;
 
+// Feeds the audio driver from a separate thread, so the main thread never blocks inside the driver.
+// Half of the audio latency is then spent in a ring buffer in front of the driver.
+static const bool audio_threaded = false;
+
 // Default resampler
 #ifdef HAVE_SINC
 static const char *audio_resampler = "sinc";
@@ -324,6 +328,9 @@ static const char *audio_resampler = "sinc";
 static const char *audio_resampler = "hermite";
 #endif
 
+// Resampler quality, see enum resampler_quality. 0 lets the resampler pick its built-in default.
+static const unsigned audio_resampler_quality = 0;
+
 // Experimental rate control
 #if defined(GEKKO) || !defined(RARCH_CONSOLE)
 static const bool rate_control = true;
@@ -334,6 +341,13 @@ static const bool rate_control = false;
 // Rate control delta. Defines how much rate_control is allowed to adjust input rate.
 static const float rate_control_delta = 0.005;
 
+// Adds an integral term to rate control, so buffer fill settles on rate_control_latency
+// even if the audio clock drifts from the video clock, rather than somewhere off to the side of it.
+static const bool rate_control_pi = false;
+
+// Buffer fill in milliseconds the PI rate controller aims for. 0 aims for half the audio buffer.
+static const unsigned rate_control_latency = 0;
+
 // Default audio volume in dB. (0.0 dB == unity gain).
 static const float audio_volume = 0.0;
 
@@ -350,6 +364,20 @@ static const unsigned rewind_buffer_size = 20 << 20; // 20MiB
 // How many frames to rewind at a time.
 static const unsigned rewind_granularity = 1;
 
+// If non-zero, rewind granularity is adapted so capturing states takes at most this percentage of frame time.
+// rewind_granularity is then only used as a starting point.
+static const float rewind_budget = 0.0f;
+
+// Compression of the rewind buffer. "none", "fast" (zero byte packing) or "zlib" (deflate).
+// Compressing lets the same buffer size hold a lot more rewind history, at some CPU cost.
+static const char *rewind_compression = "none";
+
+// Generates and compresses rewind deltas on a separate thread, so only serialization is done in the main loop.
+static const bool rewind_threaded = false;
+
+// Stores a full state in the rewind buffer every N rewind states, so seeking far back is fast. 0 disables.
+static const unsigned rewind_keyframe_interval = 600;
+
 // Pause gameplay when gameplay loses focus.
 static const bool pause_nonactive = false;
 
@@ -359,6 +387,19 @@ static const unsigned autosave_interval = 0;
 // When being client over netplay, use keybinds for player 1 rather than player 2.
 static const bool netplay_client_swap_input = true;
 
+// Maximum number of clients which can connect when hosting in spectate mode.
+static const unsigned netplay_max_spectators = 16;
+
+// Frames to delay local input by over netplay, so the other side gets it before it's needed and rarely has to roll back.
+// If netplay_input_delay_auto is set, the delay is picked from the measured round trip time instead.
+// The host uses the larger of its own and the client's delay.
+static const unsigned netplay_input_delay = 0;
+static const bool netplay_input_delay_auto = false;
+
+// Host without waiting for the client. The game runs right away, and a client can join later on.
+// The host streams its current state to the client while it keeps running.
+static const bool netplay_late_join = false;
+
 // On save state load, block SRAM from being overwritten.
 // This could potentially lead to buggy games.
 static const bool block_sram_overwrite = false;
@@ -24,6 +24,7 @@
 #include "audio/utils.h"
 #include "audio/resampler.h"
 #include "gfx/thread_wrapper.h"
+#include "audio/thread_wrapper.h"
 
 #ifdef HAVE_X11
 #include "gfx/context/x11_common.h"
@@ -360,6 +361,19 @@ static void deinit_dsp_plugin(void)
 }
 #endif
 
+// Bytes of output the driver plays in the given time, the unit of write_avail() and buffer_size().
+static size_t audio_latency_to_bytes(unsigned ms)
+{
+   size_t sample_size = g_extern.audio_data.use_float ? sizeof(float) : sizeof(int16_t);
+   return (size_t)ms * g_settings.audio.out_rate / 1000 * 2 * sample_size;
+}
+
+static float audio_bytes_to_latency(double bytes)
+{
+   size_t sample_size = g_extern.audio_data.use_float ? sizeof(float) : sizeof(int16_t);
+   return 1000.0 * bytes / (2 * sample_size * g_settings.audio.out_rate);
+}
+
 void init_audio(void)
 {
    audio_convert_init_simd();
@@ -389,8 +403,20 @@ void init_audio(void)
       return;
    }
 
-   driver.audio_data = audio_init_func(*g_settings.audio.device ? g_settings.audio.device : NULL,
-         g_settings.audio.out_rate, g_settings.audio.latency);
+#ifdef HAVE_THREADS
+   if (g_settings.audio.threaded)
+   {
+      find_audio_driver(); // Need to grab the "real" audio driver interface on a reinit.
+      RARCH_LOG("Starting threaded audio driver ...\n");
+      rarch_threaded_audio_init(&driver.audio, &driver.audio_data,
+            *g_settings.audio.device ? g_settings.audio.device : NULL,
+            g_settings.audio.out_rate, g_settings.audio.latency,
+            driver.audio);
+   }
+   else
+#endif
+      driver.audio_data = audio_init_func(*g_settings.audio.device ? g_settings.audio.device : NULL,
+            g_settings.audio.out_rate, g_settings.audio.latency);
 
    if (!driver.audio_data)
    {
@@ -413,7 +439,8 @@ void init_audio(void)
 
    const char *resampler = *g_settings.audio.resampler ? g_settings.audio.resampler : NULL;
    if (!rarch_resampler_realloc(&g_extern.audio_data.resampler_data, &g_extern.audio_data.resampler,
-         resampler, g_extern.audio_data.orig_src_ratio))
+         resampler, (enum resampler_quality)g_settings.audio.resampler_quality,
+         g_extern.audio_data.orig_src_ratio))
    {
       RARCH_ERR("Failed to initialize resampler \"%s\".\n", resampler ? resampler : "(default)");
       g_extern.audio_active = false;
@@ -432,6 +459,12 @@ void init_audio(void)
       {
          g_extern.audio_data.driver_buffer_size = audio_buffer_size_func();
          g_extern.audio_data.rate_control = true;
+
+         size_t target = audio_latency_to_bytes(g_settings.audio.rate_control_latency);
+         if (!target || target >= g_extern.audio_data.driver_buffer_size)
+            target = g_extern.audio_data.driver_buffer_size / 2;
+         g_extern.audio_data.rate_control_target   = target;
+         g_extern.audio_data.rate_control_integral = 0.0;
       }
       else
          RARCH_WARN("Audio rate control was desired, but driver does not support needed features.\n");
@@ -445,6 +478,9 @@ void init_audio(void)
 #endif
 
    g_extern.measure_data.buffer_free_samples_count = 0;
+   g_extern.measure_data.buffer_underrun_count     = 0;
+   g_extern.measure_data.rate_adjust_accum         = 0.0;
+   g_extern.measure_data.rate_adjust_accum_sq      = 0.0;
 }
 
 static void compute_audio_buffer_statistics(void)
@@ -489,6 +525,20 @@ static void compute_audio_buffer_statistics(void)
    RARCH_LOG("Amount of time spent close to underrun: %.2f %%. Close to blocking: %.2f %%.\n",
          (100.0 * low_water_count) / (samples - 1),
          (100.0 * high_water_count) / (samples - 1));
+
+   uint64_t flushes  = g_extern.measure_data.buffer_free_samples_count;
+   double adjust_avg = g_extern.measure_data.rate_adjust_accum / flushes;
+   double adjust_var = g_extern.measure_data.rate_adjust_accum_sq / flushes - adjust_avg * adjust_avg;
+
+   RARCH_LOG("Average audio latency: %.2f ms, standard deviation: %.2f ms (%s rate control, target %.2f ms).\n",
+         audio_bytes_to_latency(g_extern.audio_data.driver_buffer_size - avg),
+         audio_bytes_to_latency(stddev),
+         g_settings.audio.rate_control_pi ? "PI" : "proportional",
+         audio_bytes_to_latency(g_settings.audio.rate_control_pi ?
+            g_extern.audio_data.rate_control_target : g_extern.audio_data.driver_buffer_size / 2));
+   RARCH_LOG("Audio underruns: %llu in %llu flushes. Input rate adjusted by %.4f %% on average, standard deviation: %.4f %%.\n",
+         (unsigned long long)g_extern.measure_data.buffer_underrun_count, (unsigned long long)flushes,
+         100.0 * adjust_avg, 100.0 * sqrt(max(adjust_var, 0.0)));
 }
 
 static void compute_monitor_fps_statistics(void)
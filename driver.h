@@ -38,6 +38,9 @@
 #define AUDIO_CHUNK_SIZE_NONBLOCKING 2048 // So we don't get complete line-noise when fast-forwarding audio.
 #define AUDIO_MAX_RATIO 16
 
+// How fast the integral term of the PI rate controller follows a steady error, per second of audio.
+#define AUDIO_RATE_CONTROL_KI 0.015
+
 // Specialized _POINTER that targets the full screen regardless of viewport.
 // Should not be used by a libretro implementation as coordinates returned make no sense.
 // It is only used internally for overlays.
@@ -492,6 +492,46 @@ static bool environment_cb(unsigned cmd, void *data)
          break;
       }
 
+      case RETRO_ENVIRONMENT_GET_SKIP_RENDER:
+#ifdef HAVE_NETPLAY
+         *(bool*)data = g_extern.netplay && netplay_should_skip(g_extern.netplay);
+#else
+         *(bool*)data = false;
+#endif
+         break;
+
+      case RETRO_ENVIRONMENT_SET_MEMORY_REGIONS:
+      {
+         const struct retro_memory_regions *info = (const struct retro_memory_regions*)data;
+         RARCH_LOG("Environ SET_MEMORY_REGIONS.\n");
+
+         if (info->opaque_size && (!info->serialize || !info->unserialize))
+            return false;
+
+         for (unsigned i = 0; i < info->num_regions; i++)
+         {
+            const struct retro_memory_region *region = &info->regions[i];
+            if (((uintptr_t)region->ptr & 3) || (region->size & 3))
+            {
+               RARCH_ERR("Memory region #%u is not 4-byte aligned.\n", i);
+               return false;
+            }
+            RARCH_LOG("\tRegion #%u: %u bytes%s.\n", i, (unsigned)region->size,
+                  region->flags & RETRO_MEMORY_REGION_CONST ? " (const)" : "");
+         }
+
+         struct retro_memory_region *regions = (struct retro_memory_region*)
+            calloc(info->num_regions ? info->num_regions : 1, sizeof(*regions));
+         if (!regions)
+            return false;
+         memcpy(regions, info->regions, info->num_regions * sizeof(*regions));
+
+         free((void*)g_extern.system.mem_regions.regions);
+         g_extern.system.mem_regions = *info;
+         g_extern.system.mem_regions.regions = regions;
+         break;
+      }
+
       default:
          RARCH_LOG("Environ UNSUPPORTED (#%u).\n", cmd);
          return false;
@@ -13,15 +13,79 @@
  *  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include "fifo_buffer.h"
 #include <stdint.h>
 
+#ifdef HAVE_THREADS
+#include "thread.h"
+#endif
+
+// first is only written by the consumer and end only by the producer.
+// The other side reads them with acquire semantics, so that the data copied
+// before an index is published is visible once the index is.
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+#define FIFO_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define FIFO_STORE(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+#define FIFO_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#elif defined(__GNUC__)
+static inline size_t FIFO_LOAD(const size_t *ptr)
+{
+   size_t val = *(const volatile size_t*)ptr;
+   __sync_synchronize();
+   return val;
+}
+#define FIFO_STORE(ptr, val) do { __sync_synchronize(); *(volatile size_t*)(ptr) = (val); } while (0)
+#define FIFO_FENCE() __sync_synchronize()
+#elif defined(_WIN32)
+#if defined(_XBOX)
+#include <xtl.h>
+#else
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+static inline size_t FIFO_LOAD(const size_t *ptr)
+{
+   size_t val = *(const volatile size_t*)ptr;
+   MemoryBarrier();
+   return val;
+}
+#define FIFO_STORE(ptr, val) do { MemoryBarrier(); *(volatile size_t*)(ptr) = (val); } while (0)
+#define FIFO_FENCE() MemoryBarrier()
+#else
+#error "No memory barriers for this compiler."
+#endif
+
+#define FIFO_CACHE_LINE 64
+
 struct fifo_buffer
 {
    uint8_t *buffer;
    size_t bufsize;
+
+   // Keep the indices on separate cache lines, so that the producer and consumer
+   // don't invalidate each other's line on every update.
+   uint8_t pad0[FIFO_CACHE_LINE];
    size_t first;
+   uint8_t pad1[FIFO_CACHE_LINE];
    size_t end;
+   uint8_t pad2[FIFO_CACHE_LINE];
+
+#ifdef HAVE_THREADS
+   slock_t *lock;
+   scond_t *read_cond;
+   scond_t *write_cond;
+   // Bytes a sleeping reader or writer waits for, 0 if none is sleeping.
+   // There is at most one of each.
+   volatile size_t read_wait;
+   volatile size_t write_wait;
+   // Set by fifo_cancel_wait(), consumed by the next wait on that side.
+   bool read_cancel;
+   bool write_cancel;
+#endif
 };
 
 fifo_buffer_t *fifo_new(size_t size)
@@ -38,19 +102,38 @@ fifo_buffer_t *fifo_new(size_t size)
    }
    buf->bufsize = size + 1;
 
+#ifdef HAVE_THREADS
+   buf->lock = slock_new();
+   buf->read_cond = scond_new();
+   buf->write_cond = scond_new();
+   if (!buf->lock || !buf->read_cond || !buf->write_cond)
+   {
+      fifo_free(buf);
+      return NULL;
+   }
+#endif
+
    return buf;
 }
 
 void fifo_free(fifo_buffer_t *buffer)
 {
+#ifdef HAVE_THREADS
+   if (buffer->lock)
+      slock_free(buffer->lock);
+   if (buffer->read_cond)
+      scond_free(buffer->read_cond);
+   if (buffer->write_cond)
+      scond_free(buffer->write_cond);
+#endif
    free(buffer->buffer);
    free(buffer);
 }
 
 size_t fifo_read_avail(fifo_buffer_t *buffer)
 {
-   size_t first = buffer->first;
-   size_t end = buffer->end;
+   size_t first = FIFO_LOAD(&buffer->first);
+   size_t end = FIFO_LOAD(&buffer->end);
    if (end < first)
       end += buffer->bufsize;
    return end - first;
@@ -58,14 +141,30 @@ size_t fifo_read_avail(fifo_buffer_t *buffer)
 
 size_t fifo_write_avail(fifo_buffer_t *buffer)
 {
-   size_t first = buffer->first;
-   size_t end = buffer->end;
+   size_t first = FIFO_LOAD(&buffer->first);
+   size_t end = FIFO_LOAD(&buffer->end);
    if (end < first)
       end += buffer->bufsize;
 
    return (buffer->bufsize - 1) - (end - first);
 }
 
+#ifdef HAVE_THREADS
+// Only takes the lock if the other side sleeps in fifo_wait(), and now has what it waits for.
+static void fifo_wake(fifo_buffer_t *buffer, size_t (*avail)(fifo_buffer_t*),
+      volatile size_t *wait, scond_t *cond)
+{
+   FIFO_FENCE();
+   size_t wanted = *wait;
+   if (!wanted || avail(buffer) < wanted)
+      return;
+
+   slock_lock(buffer->lock);
+   scond_signal(cond);
+   slock_unlock(buffer->lock);
+}
+#endif
+
 void fifo_write(fifo_buffer_t *buffer, const void *in_buf, size_t size)
 {
    size_t first_write = size;
@@ -79,7 +178,10 @@ void fifo_write(fifo_buffer_t *buffer, const void *in_buf, size_t size)
    memcpy(buffer->buffer + buffer->end, in_buf, first_write);
    memcpy(buffer->buffer, (const uint8_t*)in_buf + first_write, rest_write);
 
-   buffer->end = (buffer->end + size) % buffer->bufsize;
+   FIFO_STORE(&buffer->end, (buffer->end + size) % buffer->bufsize);
+#ifdef HAVE_THREADS
+   fifo_wake(buffer, fifo_read_avail, &buffer->read_wait, buffer->read_cond);
+#endif
 }
 
 
@@ -96,6 +198,58 @@ void fifo_read(fifo_buffer_t *buffer, void *in_buf, size_t size)
    memcpy(in_buf, (const uint8_t*)buffer->buffer + buffer->first, first_read);
    memcpy((uint8_t*)in_buf + first_read, buffer->buffer, rest_read);
 
-   buffer->first = (buffer->first + size) % buffer->bufsize;
+   FIFO_STORE(&buffer->first, (buffer->first + size) % buffer->bufsize);
+#ifdef HAVE_THREADS
+   fifo_wake(buffer, fifo_write_avail, &buffer->write_wait, buffer->write_cond);
+#endif
+}
+
+#ifdef HAVE_THREADS
+static size_t fifo_wait(fifo_buffer_t *buffer, size_t (*avail)(fifo_buffer_t*), size_t size,
+      volatile size_t *wait, bool *cancel, scond_t *cond)
+{
+   size_t ret = avail(buffer);
+   if (ret >= size)
+      return ret;
+
+   // Could never be satisfied.
+   if (size > buffer->bufsize - 1)
+      size = buffer->bufsize - 1;
+
+   slock_lock(buffer->lock);
+   *wait = size;
+   // Pairs with the fence in fifo_wake(). Either we see the index
+   // the other side just published, or it sees that we are waiting.
+   FIFO_FENCE();
+   while ((ret = avail(buffer)) < size && !*cancel)
+      scond_wait(cond, buffer->lock);
+   *wait = 0;
+   *cancel = false;
+   slock_unlock(buffer->lock);
+
+   return ret;
+}
+
+size_t fifo_wait_write_avail(fifo_buffer_t *buffer, size_t size)
+{
+   return fifo_wait(buffer, fifo_write_avail, size, &buffer->write_wait,
+         &buffer->write_cancel, buffer->write_cond);
+}
+
+size_t fifo_wait_read_avail(fifo_buffer_t *buffer, size_t size)
+{
+   return fifo_wait(buffer, fifo_read_avail, size, &buffer->read_wait,
+         &buffer->read_cancel, buffer->read_cond);
+}
+
+void fifo_cancel_wait(fifo_buffer_t *buffer)
+{
+   slock_lock(buffer->lock);
+   buffer->read_cancel = true;
+   buffer->write_cancel = true;
+   scond_signal(buffer->read_cond);
+   scond_signal(buffer->write_cond);
+   slock_unlock(buffer->lock);
 }
+#endif
 
@@ -32,4 +32,24 @@ void fifo_free(fifo_buffer_t *buffer);
 size_t fifo_read_avail(fifo_buffer_t *buffer);
 size_t fifo_write_avail(fifo_buffer_t *buffer);
 
+// One producer thread (fifo_write) and one consumer thread (fifo_read) may use
+// a buffer at the same time without locking. The avail functions may be called from either.
+
+#ifdef HAVE_THREADS
+// Blocking helpers for a producer and a consumer on separate threads.
+// They only sleep while the buffer is too full or too empty, and fifo_write()/fifo_read()
+// only take a lock to wake the other side if it is actually sleeping.
+
+// Waits until at least size bytes can be written. Returns fifo_write_avail(),
+// which is less than size if the wait was cancelled.
+size_t fifo_wait_write_avail(fifo_buffer_t *buffer, size_t size);
+// Waits until at least size bytes can be read. Returns fifo_read_avail(),
+// which is less than size if the wait was cancelled.
+size_t fifo_wait_read_avail(fifo_buffer_t *buffer, size_t size);
+// Wakes up the current or next wait on each side, which then returns early.
+// Used to make the other thread re-check its state, e.g. when a thread goes away
+// or a command is pending. Callers must not assume the wait was satisfied.
+void fifo_cancel_wait(fifo_buffer_t *buffer);
+#endif
+
 #endif
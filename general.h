@@ -218,14 +218,18 @@ struct settings
       char device[PATH_MAX];
       unsigned latency;
       bool sync;
+      bool threaded;
 
       char dsp_plugin[PATH_MAX];
 
       bool rate_control;
       float rate_control_delta;
+      bool rate_control_pi;
+      unsigned rate_control_latency;
       float volume; // dB scale
 
       char resampler[32];
+      unsigned resampler_quality;
    } audio;
 
    struct
@@ -265,6 +269,11 @@ struct settings
    bool rewind_enable;
    size_t rewind_buffer_size;
    unsigned rewind_granularity;
+   float rewind_budget;
+   char rewind_compression[32];
+   bool rewind_threaded;
+   unsigned rewind_keyframe_interval;
+   char rewind_backing_file[PATH_MAX];
 
    float slowmotion_ratio;
 
@@ -276,6 +285,11 @@ struct settings
    bool savestate_auto_save;
    bool savestate_auto_load;
 
+   unsigned netplay_max_spectators;
+   unsigned netplay_input_delay;
+   bool netplay_input_delay_auto;
+   bool netplay_late_join;
+
    bool network_cmd_enable;
    uint16_t network_cmd_port;
    bool stdin_cmd_enable;
@@ -380,6 +394,9 @@ struct global
       char valid_extensions[PATH_MAX];
       
       retro_keyboard_event_t key_event;
+
+      // Set if the implementation exposes its state as memory regions. The region array is owned by us.
+      struct retro_memory_regions mem_regions;
    } system;
 
    struct
@@ -413,6 +430,8 @@ struct global
       bool rate_control; 
       double orig_src_ratio;
       size_t driver_buffer_size;
+      size_t rate_control_target; // Buffer fill in bytes for the PI controller.
+      double rate_control_integral;
 
       float volume_db;
       float volume_gain;
@@ -424,6 +443,9 @@ struct global
 #define AUDIO_BUFFER_FREE_SAMPLES_COUNT (8 * 1024)
       unsigned buffer_free_samples[AUDIO_BUFFER_FREE_SAMPLES_COUNT];
       uint64_t buffer_free_samples_count;
+      uint64_t buffer_underrun_count; // Flushes which found the driver buffer empty.
+      double rate_adjust_accum;
+      double rate_adjust_accum_sq;
 
 #define MEASURE_FRAME_TIME_SAMPLES_COUNT (2 * 1024)
       rarch_time_t frame_time_samples[MEASURE_FRAME_TIME_SAMPLES_COUNT];
@@ -455,6 +477,17 @@ struct global
    void *state_buf;
    size_t state_size;
    bool frame_is_reverse;
+   // If the implementation exposes its memory regions, a rewind state is the opaque part in state_buf
+   // followed by every non-const region, and is diffed in place instead of being serialized.
+   struct state_manager_region *state_regions;
+   unsigned num_state_regions;
+
+   // Current capture interval. Adapted to the cost of pushing states if rewind_budget is set.
+   unsigned rewind_granularity;
+   unsigned rewind_counter;
+   rarch_perf_tick_t rewind_last_frame;
+   float rewind_frame_time; // Moving averages in perf counter ticks.
+   float rewind_push_time;
 
 #ifdef HAVE_BSV_MOVIE
    // Movie playback/recording support.
@@ -654,6 +687,7 @@ void rarch_load_state(void);
 void rarch_save_state(void);
 void rarch_state_slot_increase(void);
 void rarch_state_slot_decrease(void);
+bool rarch_rewind_seek(unsigned states);
 /////////
 
 // Public data structures
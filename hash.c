@@ -18,9 +18,22 @@
 
 #include "general.h"
 #include "hash.h"
+#include "performance.h"
 #include <string.h>
 #include <stdio.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HASH_SIMD_X86
+#define HASH_TARGET(x) __attribute__((target(x)))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)) && !defined(_XBOX)
+#define HASH_SIMD_X86
+#define HASH_TARGET(x)
+#endif
+
+#ifdef HASH_SIMD_X86
+#include <immintrin.h>
+#endif
+
 #define SWAP32(x) ((uint32_t)(           \
          (((uint32_t)(x) & 0x000000ff) << 24) | \
          (((uint32_t)(x) & 0x0000ff00) <<  8) | \
@@ -255,3 +268,94 @@ uint32_t crc32_calculate(const uint8_t *data, size_t length)
 }
 #endif
 
+
+// CRC32C, reflected Castagnoli polynomial.
+#define CRC32C_POLY 0x82f63b78
+
+// Slicing-by-8 tables, filled in on first use.
+static uint32_t crc32c_table[8][256];
+
+static void crc32c_init_table(void)
+{
+   for (unsigned i = 0; i < 256; i++)
+   {
+      uint32_t crc = i;
+      for (unsigned j = 0; j < 8; j++)
+         crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+      crc32c_table[0][i] = crc;
+   }
+
+   for (unsigned i = 0; i < 256; i++)
+      for (unsigned j = 1; j < 8; j++)
+         crc32c_table[j][i] = (crc32c_table[j - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[j - 1][i] & 0xff];
+}
+
+static uint32_t crc32c_c(uint32_t crc, const uint8_t *data, size_t length)
+{
+   for (; length && ((uintptr_t)data & 3); length--)
+      crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *data++) & 0xff];
+
+   for (; length >= 8; length -= 8, data += 8)
+   {
+      // Assemble little-endian words by hand so this works regardless of host endianness.
+      uint32_t lo = crc ^ (data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24));
+      uint32_t hi = data[4] | (data[5] << 8) | (data[6] << 16) | ((uint32_t)data[7] << 24);
+      crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff] ^
+         crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24] ^
+         crc32c_table[3][hi & 0xff] ^ crc32c_table[2][(hi >> 8) & 0xff] ^
+         crc32c_table[1][(hi >> 16) & 0xff] ^ crc32c_table[0][hi >> 24];
+   }
+
+   while (length--)
+      crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *data++) & 0xff];
+
+   return crc;
+}
+
+#ifdef HASH_SIMD_X86
+HASH_TARGET("sse4.2")
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *data, size_t length)
+{
+   for (; length && ((uintptr_t)data & 7); length--)
+      crc = _mm_crc32_u8(crc, *data++);
+
+#if defined(__x86_64__) || defined(_M_X64)
+   uint64_t crc64 = crc;
+   for (; length >= 8; length -= 8, data += 8)
+      crc64 = _mm_crc32_u64(crc64, *(const uint64_t*)data);
+   crc = (uint32_t)crc64;
+#else
+   for (; length >= 4; length -= 4, data += 4)
+      crc = _mm_crc32_u32(crc, *(const uint32_t*)data);
+#endif
+
+   while (length--)
+      crc = _mm_crc32_u8(crc, *data++);
+
+   return crc;
+}
+#endif
+
+typedef uint32_t (*crc32c_func_t)(uint32_t, const uint8_t*, size_t);
+
+static crc32c_func_t crc32c_func(void)
+{
+#ifdef HASH_SIMD_X86
+   struct rarch_cpu_features cpu;
+   rarch_get_cpu_features(&cpu);
+   if (cpu.simd & RARCH_SIMD_SSE42)
+      return crc32c_sse42;
+#endif
+
+   crc32c_init_table();
+   return crc32c_c;
+}
+
+uint32_t crc32c_calculate(const void *data, size_t length)
+{
+   static crc32c_func_t func;
+   if (!func)
+      func = crc32c_func();
+
+   return ~func(~0u, (const uint8_t*)data, length);
+}
@@ -48,5 +48,9 @@ uint32_t crc32_calculate(const uint8_t *data, size_t length);
 uint32_t crc32_adjust(uint32_t crc, uint8_t data);
 #endif
 
+// CRC32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the CPU has it.
+// Meant for cheaply fingerprinting large buffers such as save states.
+uint32_t crc32c_calculate(const void *data, size_t length);
+
 #endif
 
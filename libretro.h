@@ -415,6 +415,21 @@ enum retro_mod
 #define RETRO_ENVIRONMENT_SET_KEYBOARD_CALLBACK 12
                                            // const struct retro_keyboard_callback * --
                                            // Sets a callback function used to notify core about keyboard events.
+#define RETRO_ENVIRONMENT_SET_MEMORY_REGIONS 13
+                                           // const struct retro_memory_regions * --
+                                           // Describes the memory holding the mutable state of the implementation.
+                                           // The frontend can then capture state for rewind by reading these regions directly,
+                                           // rather than having every byte copied out by retro_serialize() first.
+                                           // State which is not covered by the regions (e.g. CPU registers) is captured with
+                                           // retro_memory_regions::serialize.
+                                           // retro_serialize() must still be implemented, and is used for regular save states.
+                                           // The region array is copied, but the memory it points to must stay valid until retro_unload_game().
+                                           // This function should be called inside retro_load_game().
+                                           //
+#define RETRO_ENVIRONMENT_GET_SKIP_RENDER 14
+                                           // bool * --
+                                           // Set to true if the frontend will discard video and audio of the current retro_run(), e.g. during netplay replay.
+                                           // The implementation may then skip rendering, but must still emulate the frame exactly.
 
 
 // Callback type passed in RETRO_ENVIRONMENT_SET_KEYBOARD_CALLBACK. Called by the frontend in response to keyboard events.
@@ -429,6 +444,28 @@ struct retro_keyboard_callback
     retro_keyboard_event_t callback;
 };
 
+// The region never changes after retro_load_game(), e.g. ROM mapped as memory. The frontend may skip it.
+#define RETRO_MEMORY_REGION_CONST (1 << 0)
+
+struct retro_memory_region
+{
+   void *ptr;      // Must be 4-byte aligned.
+   size_t size;    // In bytes. Must be a multiple of 4.
+   unsigned flags; // RETRO_MEMORY_REGION_* flags.
+};
+
+struct retro_memory_regions
+{
+   const struct retro_memory_region *regions;
+   unsigned num_regions;
+
+   // Serializes the state not covered by regions, which is at most opaque_size bytes.
+   // If opaque_size is 0, serialize and unserialize are not called, and can be NULL.
+   size_t opaque_size;
+   bool (*serialize)(void *data, size_t size);
+   bool (*unserialize)(const void *data, size_t size);
+};
+
 enum retro_pixel_format
 {
    // 0RGB1555, native endian. 0 bit must be set to 0.
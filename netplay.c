@@ -23,8 +23,20 @@
 #include "autosave.h"
 #include "dynamic.h"
 #include "message.h"
+#include "performance.h"
+#include "hash.h"
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#ifdef HAVE_ZLIB
+#ifdef WANT_MINIZ
+#include "deps/miniz/zlib.h"
+#else
+#include <zlib.h>
+#endif
+#endif
 
 // Checks if input port/index is controlled by netplay or not.
 static bool netplay_is_alive(netplay_t *handle);
@@ -32,12 +44,11 @@ static bool netplay_is_alive(netplay_t *handle);
 static bool netplay_poll(netplay_t *handle);
 static int16_t netplay_input_state(netplay_t *handle, bool port, unsigned device, unsigned index, unsigned id);
 
-// If we're fast-forward replaying to resync, check if we should actually show frame.
-static bool netplay_should_skip(netplay_t *handle);
 static bool netplay_can_poll(netplay_t *handle);
 static void netplay_set_spectate_input(netplay_t *handle, int16_t input);
 
 static bool netplay_send_cmd(netplay_t *handle, uint32_t cmd, const void *data, size_t size);
+static bool netplay_join_receive(netplay_t *handle);
 static bool netplay_get_cmd(netplay_t *handle);
 
 #define PREV_PTR(x) ((x) == 0 ? handle->buffer_size - 1 : (x) - 1)
@@ -45,7 +56,10 @@ static bool netplay_get_cmd(netplay_t *handle);
 
 struct delta_frame
 {
-   void *state;
+   // Xor delta from the state of the previous frame. Unused for the base frame.
+   uint32_t *delta;
+   size_t delta_size;
+   size_t delta_capacity;
 
    uint16_t real_input_state;
    uint16_t simulated_input_state;
@@ -54,12 +68,117 @@ struct delta_frame
    bool used_real;
 };
 
+// Input packets carry at most this many frames, see send_chunk().
 #define UDP_FRAME_PACKETS 16
-#define MAX_SPECTATORS 16
+#define UDP_PACKET_HEADER_SIZE (2 * sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint16_t))
+#define UDP_PACKET_MAX_SIZE (UDP_PACKET_HEADER_SIZE + UDP_FRAME_PACKETS * sizeof(uint16_t))
+
+// Mixed into implementation_magic_value(). Bump it whenever the handshake or the packet format changes,
+// so mismatched builds fail the implementation check rather than hang halfway through the handshake.
+// 1: Client header carries the requested input delay.
+// 2: Ack driven input packets.
+// 3: Host tells the client whether it joins a game in progress.
+// 4: State checksum and resync commands.
+#define NETPLAY_PROTOCOL_VERSION 4
+
+// Our input which the other side might not have acked yet. Both sides run at most the rollback window
+// plus the input delay ahead of each other, so this holds everything it can still be missing.
+#define INPUT_HISTORY_SIZE 64
+
+// Local input is sent this many frames ahead at most.
+#define MAX_INPUT_DELAY 8
+#define INPUT_DELAY_AUTO 0xffffffffu
+
+// Input queued for a spectator which isn't read in time. Once full, the spectator is dropped.
+// Roughly 15 seconds worth of input for a two player game.
+#define SPECTATE_QUEUE_SIZE (64 * 1024)
+#define SPECTATE_LISTEN_BACKLOG 16
+
+// Queued spectator input is only sent every few frames, to save on syscalls and packet overhead.
+#define SPECTATE_BATCH_FRAMES 4
+
+// Set in the nick size byte by spectators which understand compact input frames (see spectate_encode_frame()),
+// and echoed by the host if it will send them. Hosts from before compact frames take it as part of the nick size,
+// and drop the spectator for sending an invalid nick. They would reject the implementation magic value anyway.
+#define SPECTATE_NICK_COMPACT 0x80
+// Frame header for a frame identical to the previous one.
+#define SPECTATE_FRAME_REPEAT 0x8000
+#define SPECTATE_FRAME_MAX_WORDS 0x7fff
+
+struct spectator
+{
+   int fd;
+   bool compact; // Wants compact input frames.
+   bool keyed;   // Has received a frame to delta against.
+   uint8_t *queue; // Ring buffer of input not yet sent.
+   size_t queue_ptr; // Oldest byte not yet sent.
+   size_t queue_size;
+};
+
+// Late joining. The host compresses and queues this much of its state per frame, and only
+// when the socket has taken most of what was queued before, so a frame never does much work.
+#define JOIN_CHUNK_SIZE (128 * 1024)
+// Sanity limits for what a client accepts from the host.
+#define JOIN_MAX_RECORD_SIZE (16 * 1024 * 1024)
+#define JOIN_MAX_FRAMES (1 << 20)
+// The joining client gets this long for each read and write of the handshake, which runs inside a host frame.
+#define JOIN_HANDSHAKE_TIMEOUT_MS 500
+
+enum join_state
+{
+   JOIN_NONE = 0,
+   JOIN_WAITING,  // Host, running alone until a client connects.
+   JOIN_SENDING,  // Host, streaming its state to the client.
+   JOIN_CATCH_UP  // Client, has the state and has to run the frames the host ran since.
+};
+
+struct join_transfer
+{
+   enum join_state state;
+
+   uint8_t *data; // State at the start of the transfer.
+   size_t size;
+   size_t ptr; // Bytes of data compressed and queued so far.
+   uint32_t frame; // Frame the state is from.
+#ifdef HAVE_ZLIB
+   z_stream stream;
+   bool stream_init;
+#endif
+
+   // Compressed state not sent yet, from queue_ptr up to queue_size.
+   uint8_t *queue;
+   size_t queue_ptr;
+   size_t queue_size;
+   size_t queue_capacity;
+
+   // Host input from frame onwards, which the client replays to catch up.
+   uint16_t *input;
+   size_t input_count;
+   size_t input_capacity;
+   uint16_t self_state, other_state; // Input of the frame being run.
+
+   rarch_time_t start;
+   rarch_time_t last_frame;
+   uint32_t min_frame; // When resyncing, don't start before packets of the old history are stale.
+};
+
+// Every CHECK_FRAMES frames, both sides hash the state of the frame once all input before it
+// is confirmed, and send the hash over. Either side can be ahead, so hashes are kept for a while.
+#define CHECK_FRAMES 8
+#define CHECK_HISTORY 16
+
+struct state_check
+{
+   uint32_t frame;
+   uint32_t crc;
+   bool valid;
+};
 
 #define NETPLAY_CMD_ACK 0
 #define NETPLAY_CMD_NAK 1
 #define NETPLAY_CMD_FLIP_PLAYERS 2
+#define NETPLAY_CMD_CRC 3
+#define NETPLAY_CMD_RESYNC 4
 
 struct netplay
 {
@@ -81,12 +200,24 @@ struct netplay
    size_t read_ptr; // Ptr to where we are reading. Generally, other_ptr <= read_ptr <= self_ptr.
    size_t tmp_ptr; // A temporary pointer used on replay.
 
+   // Only the state of the oldest frame we can roll back to is kept in full.
+   // Every later frame is stored as a delta against the frame before it.
+   size_t base_ptr;
+   uint32_t base_frame_count;
+   void *base_state;
+   void *last_state; // State of the most recently serialized frame.
+   void *tmp_state;
+   void *tmp_delta;
    size_t state_size;
+   size_t aligned_state_size;
 
    bool is_replay; // Are we replaying old frames?
    bool can_poll; // We don't want to poll several times on a frame.
 
-   uint32_t packet_buffer[UDP_FRAME_PACKETS * 2]; // To compat UDP packet loss we also send old data along with the packets.
+   // To combat UDP packet loss, we resend our input until the other side acks it.
+   uint16_t input_history[INPUT_HISTORY_SIZE]; // Our input, indexed by frame % INPUT_HISTORY_SIZE.
+   uint32_t input_history_frame; // Frame after the newest one in input_history.
+   uint32_t other_ack; // The other side has all our input before this frame.
    uint32_t frame_count;
    uint32_t read_frame_count;
    uint32_t other_frame_count;
@@ -100,10 +231,40 @@ struct netplay
    // Spectating.
    bool spectate;
    bool spectate_client;
-   int spectate_fds[MAX_SPECTATORS];
+   struct spectator *spectators;
+   unsigned max_spectators;
+   unsigned spectate_batch;
    uint16_t *spectate_input;
    size_t spectate_input_ptr;
    size_t spectate_input_size;
+   size_t spectate_input_count; // Words in the current frame when spectating compact frames.
+   uint16_t *spectate_prev; // Input of the previous frame, which compact frames are a delta against.
+   size_t spectate_prev_count;
+   size_t spectate_prev_size;
+   uint8_t *spectate_frame;
+   uint8_t *spectate_key_frame;
+   size_t spectate_frame_size;
+   bool spectate_compact;
+   bool other_compact;
+
+   struct netplay_stats stats;
+
+   // Our input for a frame is sampled and sent this many frames before it is used.
+   // Input from the other side can arrive up to this far ahead of frame_count.
+   unsigned input_delay;
+
+   rarch_time_t rtt; // Measured when connecting.
+   unsigned frames; // Frames we can roll back.
+   uint32_t start_frame; // First frame with the other side, which is not 0 after a late join.
+   struct join_transfer join;
+
+   // Desync detection, indexed by frame / CHECK_FRAMES % CHECK_HISTORY.
+   struct state_check self_check[CHECK_HISTORY];
+   struct state_check other_check[CHECK_HISTORY];
+   bool desynced; // A check failed since the history was started.
+   // On the host, a check failed and the state is resent on the next frame.
+   // On the client, the host is about to resend it.
+   bool resync;
 
    // Player flipping
    // Flipping state. If ptr >= flip_frame, we apply the flip.
@@ -146,6 +307,54 @@ static bool recv_all(int fd, void *data_, size_t size)
    return true;
 }
 
+static bool recv_skip(int fd, size_t size)
+{
+   uint8_t tmp[256];
+   while (size)
+   {
+      size_t chunk = size < sizeof(tmp) ? size : sizeof(tmp);
+      if (!recv_all(fd, tmp, chunk))
+         return false;
+      size -= chunk;
+   }
+   return true;
+}
+
+static bool socket_nonblock(int fd, bool nonblock)
+{
+#if defined(_WIN32)
+   u_long mode = nonblock;
+   return ioctlsocket(fd, FIONBIO, &mode) == 0;
+#elif defined(__CELLOS_LV2__) && !defined(__PSL1GHT__)
+   int i = nonblock;
+   return setsockopt(fd, SOL_SOCKET, SO_NBIO, &i, sizeof(int)) == 0;
+#else
+   int flags = fcntl(fd, F_GETFL);
+   return fcntl(fd, F_SETFL, nonblock ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK)) == 0;
+#endif
+}
+
+// Bounds every blocking send() and recv() on the socket. 0 blocks indefinitely again.
+static bool socket_timeout(int fd, unsigned ms)
+{
+#if defined(_WIN32)
+   DWORD tv = ms;
+#else
+   struct timeval tv = { ms / 1000, (ms % 1000) * 1000 };
+#endif
+   return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, CONST_CAST &tv, sizeof(tv)) == 0 &&
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, CONST_CAST &tv, sizeof(tv)) == 0;
+}
+
+static bool socket_would_block(void)
+{
+#ifdef _WIN32
+   return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+   return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
 static void warn_hangup(void)
 {
    RARCH_WARN("Netplay has disconnected. Will continue without connection ...\n");
@@ -237,7 +446,7 @@ static void log_connection(const struct sockaddr_storage *their_addr,
 }
 #endif
 
-static int init_tcp_connection(const struct addrinfo *res, bool server, bool spectate,
+static int init_tcp_connection(const struct addrinfo *res, bool server, bool listen_only,
       struct sockaddr *other_addr, socklen_t addr_size)
 {
    bool ret = true;
@@ -256,13 +465,13 @@ static int init_tcp_connection(const struct addrinfo *res, bool server, bool spe
          goto end;
       }
    }
-   else if (spectate)
+   else if (listen_only)
    {
       int yes = 1;
       setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, CONST_CAST &yes, sizeof(int));
 
       if (bind(fd, res->ai_addr, res->ai_addrlen) < 0 ||
-            listen(fd, MAX_SPECTATORS) < 0)
+            listen(fd, SPECTATE_LISTEN_BACKLOG) < 0)
       {
          ret = false;
          goto end;
@@ -301,7 +510,7 @@ end:
    return fd;
 }
 
-static bool init_tcp_socket(netplay_t *handle, const char *server, uint16_t port, bool spectate)
+static bool init_tcp_socket(netplay_t *handle, const char *server, uint16_t port, bool listen_only)
 {
    struct addrinfo hints, *res = NULL;
    memset(&hints, 0, sizeof(hints));
@@ -330,7 +539,7 @@ static bool init_tcp_socket(netplay_t *handle, const char *server, uint16_t port
    while (tmp_info)
    {
       int fd;
-      if ((fd = init_tcp_connection(tmp_info, server, handle->spectate,
+      if ((fd = init_tcp_connection(tmp_info, server, listen_only,
                (struct sockaddr*)&handle->other_addr, sizeof(handle->other_addr))) >= 0)
       {
          ret = true;
@@ -428,7 +637,8 @@ static bool init_socket(netplay_t *handle, const char *server, uint16_t port)
    if (!netplay_init_network())
       return false;
 
-   if (!init_tcp_socket(handle, server, port, handle->spectate))
+   // Spectators and late joining clients are accepted later on, while running.
+   if (!init_tcp_socket(handle, server, port, handle->spectate || handle->join.state == JOIN_WAITING))
       return false;
    if (!handle->spectate && !init_udp_socket(handle, server, port))
       return false;
@@ -466,14 +676,17 @@ static uint32_t implementation_magic_value(void)
    for (size_t i = 0; i < len; i++)
       res ^= ver[i] << ((i & 0xf) + 16);
 
+   res ^= NETPLAY_PROTOCOL_VERSION << 24;
+
    return res;
 }
 
-static bool send_nickname(netplay_t *handle, int fd)
+static bool send_nickname(netplay_t *handle, int fd, uint8_t flags)
 {
    uint8_t nick_size = strlen(handle->nick);
+   uint8_t nick_header = nick_size | flags;
 
-   if (!send_all(fd, &nick_size, sizeof(nick_size)))
+   if (!send_all(fd, &nick_header, sizeof(nick_header)))
    {
       RARCH_ERR("Failed to send nick size.\n");
       return false;
@@ -498,6 +711,9 @@ static bool get_nickname(netplay_t *handle, int fd)
       return false;
    }
 
+   handle->other_compact = nick_size & SPECTATE_NICK_COMPACT;
+   nick_size &= ~SPECTATE_NICK_COMPACT;
+
    if (nick_size >= sizeof(handle->other_nick))
    {
       RARCH_ERR("Invalid nick size.\n");
@@ -509,22 +725,104 @@ static bool get_nickname(netplay_t *handle, int fd)
       RARCH_ERR("Failed to receive nick.\n");
       return false;
    }
+   handle->other_nick[nick_size] = '\0';
+
+   return true;
+}
+
+static uint32_t requested_input_delay(void)
+{
+   if (g_settings.netplay_input_delay_auto)
+      return INPUT_DELAY_AUTO;
+   return g_settings.netplay_input_delay < MAX_INPUT_DELAY ? g_settings.netplay_input_delay : MAX_INPUT_DELAY;
+}
+
+// Input has to make the one way trip before the other side runs the frame, to never be late.
+static unsigned resolve_input_delay(uint32_t request, rarch_time_t rtt)
+{
+   if (request != INPUT_DELAY_AUTO)
+      return request < MAX_INPUT_DELAY ? request : MAX_INPUT_DELAY;
+
+   float fps = g_extern.system.av_info.timing.fps;
+   if (fps <= 0.0f)
+      fps = 60.0f;
+
+   unsigned delay = (unsigned)ceil(rtt * fps / 2000000.0);
+   return delay < MAX_INPUT_DELAY ? delay : MAX_INPUT_DELAY;
+}
+
+// The host measures round trip time and decides the input delay for both sides.
+static bool negotiate_input_delay(netplay_t *handle, uint32_t client_request)
+{
+   uint32_t ping = 0;
+   rarch_time_t start = rarch_get_time_usec();
+   if (!send_all(handle->fd, &ping, sizeof(ping)) || !recv_all(handle->fd, &ping, sizeof(ping)))
+   {
+      RARCH_ERR("Failed to measure round trip time to client.\n");
+      return false;
+   }
+   rarch_time_t rtt = rarch_get_time_usec() - start;
+
+   unsigned host_delay = resolve_input_delay(requested_input_delay(), rtt);
+   unsigned client_delay = resolve_input_delay(client_request, rtt);
+   handle->input_delay = host_delay > client_delay ? host_delay : client_delay;
+
+   uint32_t delay = htonl(handle->input_delay);
+   if (!send_all(handle->fd, &delay, sizeof(delay)))
+   {
+      RARCH_ERR("Failed to send input delay to client.\n");
+      return false;
+   }
+
+   RARCH_LOG("Netplay round trip time is %u ms, using %u frames of input delay.\n",
+         (unsigned)(rtt / 1000), handle->input_delay);
+
+   // The client starts once it gets the delay. Start at about the same time,
+   // otherwise we run ahead and have to roll back further for the rest of the session.
+   // A late joining client starts once it has our state, see netplay_join_send().
+   handle->rtt = rtt;
+   if (handle->join.state == JOIN_NONE)
+      rarch_sleep(rtt / 2000);
+   return true;
+}
+
+static bool get_input_delay(netplay_t *handle)
+{
+   uint32_t ping, delay;
+   if (!recv_all(handle->fd, &ping, sizeof(ping)) ||
+         !send_all(handle->fd, &ping, sizeof(ping)) ||
+         !recv_all(handle->fd, &delay, sizeof(delay)))
+   {
+      RARCH_ERR("Failed to receive input delay from host.\n");
+      return false;
+   }
+
+   delay = ntohl(delay);
+   if (delay > MAX_INPUT_DELAY)
+   {
+      RARCH_ERR("Host asked for %u frames of input delay, but at most %u are supported.\n",
+            delay, MAX_INPUT_DELAY);
+      return false;
+   }
 
+   handle->input_delay = delay;
+   RARCH_LOG("Netplay is using %u frames of input delay.\n", handle->input_delay);
    return true;
 }
 
 static bool send_info(netplay_t *handle)
 {
-   uint32_t header[3] = {
+   uint32_t header[4] = {
       htonl(g_extern.cart_crc),
       htonl(implementation_magic_value()),
-      htonl(pretro_get_memory_size(RETRO_MEMORY_SAVE_RAM))
+      htonl(pretro_get_memory_size(RETRO_MEMORY_SAVE_RAM)),
+      htonl(requested_input_delay())
    };
 
    if (!send_all(handle->fd, header, sizeof(header)))
       return false;
 
-   if (!send_nickname(handle, handle->fd))
+   if (!send_nickname(handle, handle->fd, 0))
    {
       RARCH_ERR("Failed to send nick to host.\n");
       return false;
@@ -546,6 +844,19 @@ static bool send_info(netplay_t *handle)
       return false;
    }
 
+   uint32_t late_join;
+   if (!recv_all(handle->fd, &late_join, sizeof(late_join)))
+   {
+      RARCH_ERR("Failed to receive start mode from host.\n");
+      return false;
+   }
+
+   if (!get_input_delay(handle))
+      return false;
+
+   if (ntohl(late_join) && !netplay_join_receive(handle))
+      return false;
+
    char msg[512];
    snprintf(msg, sizeof(msg), "Connected to: \"%s\"", handle->other_nick);
    RARCH_LOG("%s\n", msg);
@@ -556,7 +867,7 @@ static bool send_info(netplay_t *handle)
 
 static bool get_info(netplay_t *handle)
 {
-   uint32_t header[3];
+   uint32_t header[4];
 
    if (!recv_all(handle->fd, header, sizeof(header)))
    {
@@ -597,12 +908,23 @@ static bool get_info(netplay_t *handle)
       return false;
    }
 
-   if (!send_nickname(handle, handle->fd))
+   if (!send_nickname(handle, handle->fd, 0))
    {
       RARCH_ERR("Failed to send nickname to client.\n");
       return false;
    }
 
+   // Tell the client whether it joins a game in progress.
+   uint32_t late_join = htonl(handle->join.state != JOIN_NONE);
+   if (!send_all(handle->fd, &late_join, sizeof(late_join)))
+   {
+      RARCH_ERR("Failed to send start mode to client.\n");
+      return false;
+   }
+
+   if (!negotiate_input_delay(handle, ntohl(header[3])))
+      return false;
+
 #ifndef HAVE_SOCKET_LEGACY
    log_connection(&handle->other_addr, 0, handle->other_nick);
 #endif
@@ -673,7 +995,7 @@ static bool bsv_parse_header(const uint32_t *header, uint32_t magic)
 
 static bool get_info_spectate(netplay_t *handle)
 {
-   if (!send_nickname(handle, handle->fd))
+   if (!send_nickname(handle, handle->fd, SPECTATE_NICK_COMPACT))
    {
       RARCH_ERR("Failed to send nickname to host.\n");
       return false;
@@ -685,6 +1007,8 @@ static bool get_info_spectate(netplay_t *handle)
       return false;
    }
 
+   handle->spectate_compact = handle->other_compact;
+
    char msg[512];
    snprintf(msg, sizeof(msg), "Connected to \"%s\"", handle->other_nick);
    msg_queue_push(g_extern.msg_queue, msg, 1, 180);
@@ -726,190 +1050,978 @@ static bool get_info_spectate(netplay_t *handle)
    return ret;
 }
 
-static void init_buffers(netplay_t *handle)
+static bool init_buffers(netplay_t *handle)
 {
    handle->buffer = (struct delta_frame*)calloc(handle->buffer_size, sizeof(*handle->buffer));
-   handle->state_size = pretro_serialize_size();
+   if (!handle->buffer)
+      return false;
+
    for (unsigned i = 0; i < handle->buffer_size; i++)
-   {
-      handle->buffer[i].state = malloc(handle->state_size);
       handle->buffer[i].is_simulated = true;
-   }
+
+   handle->state_size = pretro_serialize_size();
+   handle->aligned_state_size = (handle->state_size + 3) & ~3;
+
+   handle->base_state = calloc(1, handle->aligned_state_size);
+   handle->last_state = calloc(1, handle->aligned_state_size);
+   handle->tmp_state  = calloc(1, handle->aligned_state_size);
+   handle->tmp_delta  = malloc(state_delta_max_size(handle->aligned_state_size));
+
+   return handle->base_state && handle->last_state && handle->tmp_state && handle->tmp_delta;
 }
 
-netplay_t *netplay_new(const char *server, uint16_t port,
-      unsigned frames, const struct retro_callbacks *cb,
-      bool spectate,
-      const char *nick)
+static void deinit_buffers(netplay_t *handle)
 {
-   if (frames > UDP_FRAME_PACKETS)
-      frames = UDP_FRAME_PACKETS;
+   if (handle->buffer)
+   {
+      for (unsigned i = 0; i < handle->buffer_size; i++)
+         free(handle->buffer[i].delta);
+   }
+
+   free(handle->buffer);
+   free(handle->base_state);
+   free(handle->last_state);
+   free(handle->tmp_state);
+   free(handle->tmp_delta);
+   handle->buffer = NULL;
+   handle->base_state = NULL;
+   handle->last_state = NULL;
+   handle->tmp_state = NULL;
+   handle->tmp_delta = NULL;
+}
 
-   netplay_t *handle = (netplay_t*)calloc(1, sizeof(*handle));
-   if (!handle)
-      return NULL;
+static void netplay_compare_checks(netplay_t *handle, unsigned slot)
+{
+   const struct state_check *self = &handle->self_check[slot];
+   const struct state_check *other = &handle->other_check[slot];
+   if (!self->valid || !other->valid || self->frame != other->frame)
+      return;
 
-   handle->fd = -1;
-   handle->udp_fd = -1;
-   handle->cbs = *cb;
-   handle->port = server ? 0 : 1;
-   handle->spectate = spectate;
-   handle->spectate_client = server != NULL;
-   strlcpy(handle->nick, nick, sizeof(handle->nick));
+   handle->stats.state_checks++;
+   if (self->crc == other->crc || handle->desynced)
+      return;
 
-   if (!init_socket(handle, server, port))
+   handle->desynced = true;
+   handle->stats.desyncs++;
+   RARCH_WARN("Netplay desync detected at frame %u.\n", self->frame);
+
+   // Only the host has the say on what the state is.
+   if (handle->port == 1)
    {
-      free(handle);
-      return NULL;
+      msg_queue_push(g_extern.msg_queue, "Netplay desync detected, resending state to client ...", 1, 180);
+      handle->resync = true;
    }
+}
 
-   if (spectate)
+// Hashes the state of a frame which has no more predicted input before it, and sends the hash
+// to the other side. The state is the same on both sides unless the cores diverged.
+static void netplay_check_state(netplay_t *handle, uint32_t frame, const void *state)
+{
+   if (frame % CHECK_FRAMES || handle->resync || !handle->has_connection)
+      return;
+
+   unsigned slot = (frame / CHECK_FRAMES) % CHECK_HISTORY;
+   struct state_check *check = &handle->self_check[slot];
+   if (check->valid && check->frame == frame)
+      return;
+
+   rarch_time_t start = rarch_get_time_usec();
+   RARCH_PERFORMANCE_INIT(netplay_state_crc);
+   RARCH_PERFORMANCE_START(netplay_state_crc);
+   uint32_t crc = crc32c_calculate(state, handle->state_size);
+   RARCH_PERFORMANCE_STOP(netplay_state_crc);
+   handle->stats.state_hashes++;
+   handle->stats.state_hash_usec += rarch_get_time_usec() - start;
+
+   check->frame = frame;
+   check->crc = crc;
+   check->valid = true;
+
+   uint32_t data[2] = { htonl(frame), htonl(crc) };
+   if (!netplay_send_cmd(handle, NETPLAY_CMD_CRC, data, sizeof(data)))
    {
-      if (server)
-      {
-         if (!get_info_spectate(handle))
-            goto error;
-      }
+      warn_hangup();
+      handle->has_connection = false;
+      return;
+   }
+
+   netplay_compare_checks(handle, slot);
+}
 
-      for (unsigned i = 0; i < MAX_SPECTATORS; i++)
-         handle->spectate_fds[i] = -1;
+// Serializes the state of the frame we're about to run into the history.
+// Frames are always serialized in order, starting from the base frame on replay.
+static void netplay_serialize_frame(netplay_t *handle, size_t ptr, uint32_t frame_count)
+{
+   pretro_serialize(handle->tmp_state, handle->state_size);
+
+   if (frame_count == handle->base_frame_count)
+   {
+      memcpy(handle->base_state, handle->tmp_state, handle->aligned_state_size);
+      netplay_check_state(handle, frame_count, handle->base_state);
    }
    else
    {
-      if (server)
+      struct delta_frame *frame = &handle->buffer[ptr];
+      size_t size = state_delta_generate(handle->tmp_delta,
+            handle->last_state, handle->tmp_state, handle->aligned_state_size);
+
+      // Don't hold on to memory after a burst of large deltas.
+      if (size > frame->delta_capacity || size < frame->delta_capacity / 4)
       {
-         if (!send_info(handle))
-            goto error;
+         free(frame->delta);
+         frame->delta = (uint32_t*)malloc(size ? size : sizeof(uint32_t));
+         frame->delta_capacity = frame->delta ? size : 0;
+      }
+
+      if (frame->delta)
+      {
+         memcpy(frame->delta, handle->tmp_delta, size);
+         frame->delta_size = size;
       }
       else
       {
-         if (!get_info(handle))
-            goto error;
+         RARCH_ERR("Failed to allocate netplay state delta.\n");
+         frame->delta_size = 0;
       }
-
-      handle->buffer_size = frames + 1;
-
-      init_buffers(handle);
-      handle->has_connection = true;
    }
 
-   return handle;
-
-error:
-   if (handle->fd >= 0)
-      close(handle->fd);
-   if (handle->udp_fd >= 0)
-      close(handle->udp_fd);
-
-   free(handle);
-   return NULL;
+   void *tmp = handle->last_state;
+   handle->last_state = handle->tmp_state;
+   handle->tmp_state = tmp;
 }
 
-
-static bool netplay_is_alive(netplay_t *handle)
+// Folds the deltas of frames we can no longer roll back past into the base state.
+static void netplay_advance_base(netplay_t *handle, uint32_t frame_count)
 {
-   return handle->has_connection;
+   while (handle->base_frame_count < frame_count)
+   {
+      handle->base_ptr = NEXT_PTR(handle->base_ptr);
+      handle->base_frame_count++;
+
+      struct delta_frame *frame = &handle->buffer[handle->base_ptr];
+      state_delta_apply(handle->base_state, frame->delta, frame->delta_size);
+      frame->delta_size = 0;
+
+      netplay_check_state(handle, handle->base_frame_count, handle->base_state);
+   }
 }
 
-static bool send_chunk(netplay_t *handle)
+// Sets up the rollback history, which starts at frame on both sides.
+static bool netplay_start(netplay_t *handle, uint32_t frame)
 {
-   const struct sockaddr *addr = NULL;
-   if (handle->addr)
-      addr = handle->addr->ai_addr;
-   else if (handle->has_client_addr)
-      addr = (const struct sockaddr*)&handle->their_addr;
-
-   if (addr)
+   // Input from the other side arrives up to input_delay frames ahead, which needs room as well.
+   handle->buffer_size = handle->frames + 1 + handle->input_delay;
+   if (!init_buffers(handle))
    {
-      if (sendto(handle->udp_fd, CONST_CAST handle->packet_buffer,
-               sizeof(handle->packet_buffer), 0, addr,
-               sizeof(struct sockaddr)) != sizeof(handle->packet_buffer))
-      {
-         warn_hangup();
-         handle->has_connection = false;
-         return false;
-      }
+      deinit_buffers(handle);
+      return false;
    }
+
+   // After a resync, the history starts over.
+   handle->self_ptr = 0;
+   handle->other_ptr = 0;
+   handle->read_ptr = 0;
+   handle->base_ptr = 0;
+
+   handle->start_frame = frame;
+   handle->frame_count = frame;
+   handle->read_frame_count = frame;
+   handle->other_frame_count = frame;
+   handle->base_frame_count = frame;
+   handle->input_history_frame = frame;
+   handle->other_ack = frame;
+   memset(handle->self_check, 0, sizeof(handle->self_check));
+   memset(handle->other_check, 0, sizeof(handle->other_check));
+   handle->desynced = false;
+   handle->has_connection = true;
    return true;
 }
 
-#define MAX_RETRIES 16
-#define RETRY_MS 500
-
-static int poll_input(netplay_t *handle, bool block)
+static void join_free(struct join_transfer *join)
 {
-   int max_fd = (handle->fd > handle->udp_fd ? handle->fd : handle->udp_fd) + 1;
-
-   struct timeval tv = {0};
-   tv.tv_sec = 0;
-   tv.tv_usec = block ? (RETRY_MS * 1000) : 0;
-
-   do
-   { 
-      handle->timeout_cnt++;
-
-      // select() does not take pointer to const struct timeval.
-      // Technically possible for select() to modify tmp_tv, so we go paranoia mode.
-      struct timeval tmp_tv = tv;
+#ifdef HAVE_ZLIB
+   if (join->stream_init)
+      deflateEnd(&join->stream);
+   join->stream_init = false;
+#endif
 
-      fd_set fds;
-      FD_ZERO(&fds);
-      FD_SET(handle->udp_fd, &fds);
-      FD_SET(handle->fd, &fds);
+   free(join->data);
+   free(join->queue);
+   free(join->input);
+   join->data = NULL;
+   join->queue = NULL;
+   join->input = NULL;
+   join->ptr = 0;
+   join->queue_ptr = 0;
+   join->queue_size = 0;
+   join->queue_capacity = 0;
+   join->input_count = 0;
+   join->input_capacity = 0;
+}
 
-      if (select(max_fd, &fds, NULL, NULL, &tmp_tv) < 0)
-         return -1;
+static bool join_reserve(struct join_transfer *join, size_t size)
+{
+   if (join->queue_size + size <= join->queue_capacity)
+      return true;
 
-      // Somewhat hacky,
-      // but we aren't using the TCP connection for anything useful atm.
-      if (FD_ISSET(handle->fd, &fds) && !netplay_get_cmd(handle))
-         return -1; 
+   size_t capacity = join->queue_capacity * 2;
+   if (capacity < join->queue_size + size)
+      capacity = join->queue_size + size;
 
-      if (FD_ISSET(handle->udp_fd, &fds))
-         return 1;
+   uint8_t *queue = (uint8_t*)realloc(join->queue, capacity);
+   if (!queue)
+      return false;
 
-      if (block && !send_chunk(handle))
-      {
-         warn_hangup();
-         handle->has_connection = false;
-         return -1;
-      }
+   join->queue = queue;
+   join->queue_capacity = capacity;
+   return true;
+}
 
-      if (block)
-      {
-         RARCH_LOG("Network is stalling, resending packet... Count %u of %d ...\n",
-               handle->timeout_cnt, MAX_RETRIES);
-      }
-   } while ((handle->timeout_cnt < MAX_RETRIES) && block);
+static bool join_queue(struct join_transfer *join, const void *data, size_t size)
+{
+   if (!join_reserve(join, size))
+      return false;
 
-   if (block)
-      return -1;
-   return 0;
+   memcpy(join->queue + join->queue_size, data, size);
+   join->queue_size += size;
+   return true;
 }
 
-// Grab our own input state and send this over the network.
-static bool get_self_input_state(netplay_t *handle)
+// The state is sent as records of a 32-bit big endian size followed by that much of the stream.
+// A record of size 0 ends it. The stream is deflated if the host has zlib, raw otherwise.
+// The client acks the state, and then gets the frame it joins at and the input leading up to it.
+static bool join_compress_chunk(struct join_transfer *join)
 {
-   struct delta_frame *ptr = &handle->buffer[handle->self_ptr];
-
-   uint32_t state = 0;
-   if (handle->frame_count > 0) // First frame we always give zero input since relying on input from first frame screws up when we use -F 0.
+   if (join->queue_ptr)
    {
-      retro_input_state_t cb = handle->cbs.state_cb;
-      for (unsigned i = 0; i < RARCH_FIRST_META_KEY; i++)
-      {
-         int16_t tmp = cb(g_settings.input.netplay_client_swap_input ? 0 : !handle->port,
-               RETRO_DEVICE_JOYPAD, 0, i);
-         state |= tmp ? 1 << i : 0;
-      }
+      memmove(join->queue, join->queue + join->queue_ptr, join->queue_size - join->queue_ptr);
+      join->queue_size -= join->queue_ptr;
+      join->queue_ptr = 0;
    }
 
-   memmove(handle->packet_buffer, handle->packet_buffer + 2,
-         sizeof (handle->packet_buffer) - 2 * sizeof(uint32_t));
-   handle->packet_buffer[(UDP_FRAME_PACKETS - 1) * 2] = htonl(handle->frame_count); 
-   handle->packet_buffer[(UDP_FRAME_PACKETS - 1) * 2 + 1] = htonl(state);
+   size_t chunk = join->size - join->ptr;
+   if (chunk > JOIN_CHUNK_SIZE)
+      chunk = JOIN_CHUNK_SIZE;
 
-   if (!send_chunk(handle))
+   size_t header = join->queue_size;
+   if (!join_reserve(join, sizeof(uint32_t)))
+      return false;
+   join->queue_size += sizeof(uint32_t);
+
+#ifdef HAVE_ZLIB
+   int flush = join->ptr + chunk == join->size ? Z_FINISH : Z_NO_FLUSH;
+   join->stream.next_in = join->data + join->ptr;
+   join->stream.avail_in = chunk;
+
+   for (;;)
+   {
+      if (!join_reserve(join, JOIN_CHUNK_SIZE))
+         return false;
+
+      join->stream.next_out = join->queue + join->queue_size;
+      join->stream.avail_out = join->queue_capacity - join->queue_size;
+      int ret = deflate(&join->stream, flush);
+      join->queue_size = join->queue_capacity - join->stream.avail_out;
+
+      if (ret == Z_STREAM_END)
+         break;
+      if (ret != Z_OK && ret != Z_BUF_ERROR)
+         return false;
+      if (flush == Z_NO_FLUSH && join->stream.avail_out)
+         break;
+   }
+#else
+   if (!join_queue(join, join->data + join->ptr, chunk))
+      return false;
+#endif
+   join->ptr += chunk;
+
+   // Deflate might hold on to all of the chunk. Don't send an empty record, it would end the stream.
+   uint32_t size = join->queue_size - header - sizeof(uint32_t);
+   if (!size)
+      join->queue_size = header;
+   else
+   {
+      size = htonl(size);
+      memcpy(join->queue + header, &size, sizeof(size));
+   }
+
+   uint32_t end = 0;
+   if (join->ptr == join->size && !join_queue(join, &end, sizeof(end)))
+      return false;
+
+   return true;
+}
+
+// Sends as much queued state as the socket takes without blocking.
+static bool join_flush(struct join_transfer *join, int fd)
+{
+   while (join->queue_ptr < join->queue_size)
+   {
+      ssize_t ret = send(fd, CONST_CAST (join->queue + join->queue_ptr), join->queue_size - join->queue_ptr, 0);
+      if (ret < 0 && socket_would_block())
+         return true;
+      if (ret <= 0)
+         return false;
+
+      join->queue_ptr += ret;
+   }
+
+   join->queue_ptr = 0;
+   join->queue_size = 0;
+   return true;
+}
+
+static bool netplay_join_begin(netplay_t *handle)
+{
+   struct join_transfer *join = &handle->join;
+
+   join->size = pretro_serialize_size();
+   if (!join->size)
+   {
+      RARCH_ERR("Implementation does not support save states, cannot join a game in progress.\n");
+      return false;
+   }
+
+   join->data = (uint8_t*)malloc(join->size);
+   if (!join->data || !pretro_serialize(join->data, join->size))
+      return false;
+
+#ifdef HAVE_ZLIB
+   if (deflateInit(&join->stream, Z_BEST_SPEED) != Z_OK)
+      return false;
+   join->stream_init = true;
+   uint32_t compressed = 1;
+#else
+   uint32_t compressed = 0;
+#endif
+
+   join->ptr = 0;
+   join->frame = handle->frame_count;
+   join->min_frame = 0;
+   join->input_count = 0;
+   handle->stats.join_state_size = join->size;
+   handle->stats.join_transfer_size = 0;
+   handle->stats.join_frames = 0;
+   handle->stats.join_frame_usec = 0;
+   handle->stats.join_frame_usec_max = 0;
+   handle->stats.join_send_usec_max = 0;
+
+   uint32_t header[3] = { htonl(join->size), htonl(compressed), htonl(join->frame) };
+   if (!join_queue(join, header, sizeof(header)))
+      return false;
+
+   // From here on, the client is never allowed to block us until it has the state.
+   if (!socket_nonblock(handle->fd, true))
+      return false;
+
+   // The end of the transfer is small, and shouldn't wait for the state before it to be acked.
+   int yes = 1;
+   setsockopt(handle->fd, IPPROTO_TCP, TCP_NODELAY, CONST_CAST &yes, sizeof(int));
+
+   join->start = rarch_get_time_usec();
+   join->state = JOIN_SENDING;
+   return true;
+}
+
+// Accepts a client into a game in progress. The handshake is the regular one,
+// and the state is streamed over the next frames, see netplay_join_send().
+static void netplay_join_accept(netplay_t *handle)
+{
+   fd_set fds;
+   FD_ZERO(&fds);
+   FD_SET(handle->fd, &fds);
+
+   struct timeval tmp_tv = {0};
+   if (select(handle->fd + 1, &fds, NULL, NULL, &tmp_tv) <= 0 || !FD_ISSET(handle->fd, &fds))
+      return;
+
+   socklen_t addr_size = sizeof(handle->other_addr);
+   int new_fd = accept(handle->fd, (struct sockaddr*)&handle->other_addr, &addr_size);
+   if (new_fd < 0)
+   {
+      RARCH_ERR("Failed to accept incoming client.\n");
+      return;
+   }
+
+   int listen_fd = handle->fd;
+   handle->fd = new_fd;
+
+   // The handshake blocks for a round trip or two, which counts towards the first frame of the transfer.
+   // A client which stalls halfway through only holds us up until the timeout.
+   handle->join.last_frame = rarch_get_time_usec();
+
+   if (!socket_timeout(new_fd, JOIN_HANDSHAKE_TIMEOUT_MS) || !get_info(handle) || !netplay_join_begin(handle))
+   {
+      RARCH_ERR("Client failed to join.\n");
+      join_free(&handle->join);
+      handle->join.state = JOIN_WAITING;
+      handle->fd = listen_fd;
+      close(new_fd);
+      return;
+   }
+
+   close(listen_fd);
+}
+
+// Called every frame while sending the state. Once it is all out, the client gets the input
+// we ran with since, and both sides start the rollback history at the current frame.
+static void netplay_join_send(netplay_t *handle)
+{
+   struct join_transfer *join = &handle->join;
+   struct netplay_stats *stats = &handle->stats;
+
+   rarch_time_t start = rarch_get_time_usec();
+   rarch_time_t frame_usec = start - join->last_frame;
+   join->last_frame = start;
+
+   stats->join_frames++;
+   stats->join_frame_usec += frame_usec;
+   if (frame_usec > stats->join_frame_usec_max)
+      stats->join_frame_usec_max = frame_usec;
+
+   if (join->ptr < join->size && join->queue_size - join->queue_ptr < JOIN_CHUNK_SIZE &&
+         !join_compress_chunk(join))
+      goto error;
+
+   size_t queued = join->queue_size - join->queue_ptr;
+   if (!join_flush(join, handle->fd))
+      goto error;
+   stats->join_transfer_size += queued - (join->queue_size - join->queue_ptr);
+
+   rarch_time_t send_usec = rarch_get_time_usec() - start;
+   if (send_usec > stats->join_send_usec_max)
+      stats->join_send_usec_max = send_usec;
+
+   if (join->ptr < join->size || join->queue_size || handle->frame_count < join->min_frame)
+      return;
+
+   // Our socket being drained doesn't mean the client has it all yet. Keep running on our own until it acks.
+   // When resyncing, commands the client sent before it knew come first. Skip them.
+   uint32_t ack;
+   do
+   {
+      fd_set fds;
+      FD_ZERO(&fds);
+      FD_SET(handle->fd, &fds);
+
+      struct timeval tmp_tv = {0};
+      if (select(handle->fd + 1, &fds, NULL, NULL, &tmp_tv) <= 0 || !FD_ISSET(handle->fd, &fds))
+         return;
+
+      if (!socket_nonblock(handle->fd, false) || !recv_all(handle->fd, &ack, sizeof(ack)))
+         goto error;
+      ack = ntohl(ack);
+
+      if ((ack >> 16) && !recv_skip(handle->fd, ack & 0xffff))
+         goto error;
+   } while (ack >> 16);
+
+   if (ack != NETPLAY_CMD_ACK)
+      goto error;
+
+   // The rest is small, and the client is waiting for it.
+   stats->join_usec = rarch_get_time_usec() - join->start;
+
+   uint32_t frame = htonl(handle->frame_count);
+   for (size_t i = 0; i < join->input_count; i++)
+      join->input[i] = htons(join->input[i]);
+
+   if (!send_all(handle->fd, &frame, sizeof(frame)) ||
+         !send_all(handle->fd, join->input, join->input_count * sizeof(uint16_t)) ||
+         !socket_timeout(handle->fd, 0))
+      goto error;
+
+   // As when starting regularly, give the client a head start so we don't run ahead of it for the
+   // rest of the session. This is the one frame of the transfer we hold up, by half a round trip.
+   rarch_sleep(handle->rtt / 2000);
+   rarch_time_t sleep_usec = rarch_get_time_usec() - start - send_usec;
+   stats->join_frame_usec += sleep_usec;
+   if (frame_usec + sleep_usec > stats->join_frame_usec_max)
+      stats->join_frame_usec_max = frame_usec + sleep_usec;
+
+   RARCH_LOG("Sent %u KiB of state as %u KiB in %u ms (%.1f KiB/s), over %u frames.\n",
+         (unsigned)(stats->join_state_size / 1024), (unsigned)(stats->join_transfer_size / 1024),
+         (unsigned)(stats->join_usec / 1000),
+         stats->join_usec ? stats->join_transfer_size * 1000000.0 / 1024.0 / stats->join_usec : 0.0,
+         stats->join_frames);
+   RARCH_LOG("Frame time while sending: %.2f ms average, %.2f ms worst, %.2f ms worst spent sending.\n",
+         stats->join_frames ? stats->join_frame_usec / 1000.0 / stats->join_frames : 0.0,
+         stats->join_frame_usec_max / 1000.0, stats->join_send_usec_max / 1000.0);
+
+   join_free(join);
+   join->state = JOIN_NONE;
+   if (!netplay_start(handle, handle->frame_count))
+   {
+      RARCH_ERR("Failed to allocate netplay buffers.\n");
+      handle->has_connection = false;
+   }
+   return;
+
+error:
+   RARCH_ERR("Failed to send state to joining client.\n");
+   join_free(join);
+   join->state = JOIN_NONE;
+   warn_hangup();
+}
+
+// Receives the host's state, and the input it ran with since. The frames are caught up on
+// on the first frame, when the frontend has set up netplay's callbacks.
+static bool netplay_join_receive(netplay_t *handle)
+{
+   struct join_transfer *join = &handle->join;
+   struct netplay_stats *stats = &handle->stats;
+   rarch_time_t start = rarch_get_time_usec();
+   bool ret = false;
+   uint8_t *record = NULL;
+   size_t record_capacity = 0;
+
+#ifdef HAVE_ZLIB
+   if (inflateInit(&join->stream) != Z_OK)
+      return false;
+   join->stream_init = true;
+#endif
+
+   uint32_t header[3];
+   if (!recv_all(handle->fd, header, sizeof(header)))
+   {
+      RARCH_ERR("Failed to receive state header from host.\n");
+      goto end;
+   }
+   stats->join_transfer_size = sizeof(header);
+
+   join->size = ntohl(header[0]);
+   join->frame = ntohl(header[2]);
+   bool compressed = ntohl(header[1]);
+
+   if (join->size != pretro_serialize_size())
+   {
+      RARCH_ERR("Serialization size mismatch, got %u, expected %u.\n",
+            (unsigned)join->size, (unsigned)pretro_serialize_size());
+      goto end;
+   }
+
+#ifndef HAVE_ZLIB
+   if (compressed)
+   {
+      RARCH_ERR("Host sent a compressed state, but zlib support is not compiled in.\n");
+      goto end;
+   }
+#endif
+
+   join->data = (uint8_t*)malloc(join->size);
+   if (!join->data)
+      goto end;
+
+   for (;;)
+   {
+      uint32_t size;
+      if (!recv_all(handle->fd, &size, sizeof(size)))
+      {
+         RARCH_ERR("Failed to receive state from host.\n");
+         goto end;
+      }
+      size = ntohl(size);
+
+      if (!size)
+         break;
+      if (size > JOIN_MAX_RECORD_SIZE)
+      {
+         RARCH_ERR("Host sent an invalid state.\n");
+         goto end;
+      }
+
+      if (size > record_capacity)
+      {
+         uint8_t *tmp = (uint8_t*)realloc(record, size);
+         if (!tmp)
+            goto end;
+         record = tmp;
+         record_capacity = size;
+      }
+
+      if (!recv_all(handle->fd, record, size))
+      {
+         RARCH_ERR("Failed to receive state from host.\n");
+         goto end;
+      }
+      stats->join_transfer_size += sizeof(size) + size;
+
+      if (!compressed)
+      {
+         if (size > join->size - join->ptr)
+         {
+            RARCH_ERR("Host sent an invalid state.\n");
+            goto end;
+         }
+         memcpy(join->data + join->ptr, record, size);
+         join->ptr += size;
+      }
+#ifdef HAVE_ZLIB
+      else
+      {
+         join->stream.next_in = record;
+         join->stream.avail_in = size;
+         join->stream.next_out = join->data + join->ptr;
+         join->stream.avail_out = join->size - join->ptr;
+
+         int res = inflate(&join->stream, Z_NO_FLUSH);
+         join->ptr = join->size - join->stream.avail_out;
+         if ((res != Z_OK && res != Z_STREAM_END) || join->stream.avail_in)
+         {
+            RARCH_ERR("Host sent an invalid state.\n");
+            goto end;
+         }
+      }
+#endif
+   }
+
+   stats->join_usec = rarch_get_time_usec() - start;
+
+   uint32_t frame, ack = 0;
+   if (join->ptr != join->size || !send_all(handle->fd, &ack, sizeof(ack)) ||
+         !recv_all(handle->fd, &frame, sizeof(frame)))
+   {
+      RARCH_ERR("Failed to receive state from host.\n");
+      goto end;
+   }
+
+   frame = ntohl(frame);
+   if (frame < join->frame || frame - join->frame > JOIN_MAX_FRAMES)
+   {
+      RARCH_ERR("Host sent an invalid join frame.\n");
+      goto end;
+   }
+
+   join->input_count = frame - join->frame;
+   join->input = (uint16_t*)malloc((join->input_count + 1) * sizeof(uint16_t));
+   if (!join->input || !recv_all(handle->fd, join->input, join->input_count * sizeof(uint16_t)))
+   {
+      RARCH_ERR("Failed to receive input from host.\n");
+      goto end;
+   }
+
+   for (size_t i = 0; i < join->input_count; i++)
+      join->input[i] = ntohs(join->input[i]);
+
+   if (!pretro_unserialize(join->data, join->size))
+   {
+      RARCH_ERR("Failed to load state from host.\n");
+      goto end;
+   }
+
+   stats->join_state_size = join->size;
+   RARCH_LOG("Received %u KiB of state as %u KiB in %u ms (%.1f KiB/s), %u frames to catch up on.\n",
+         (unsigned)(stats->join_state_size / 1024), (unsigned)(stats->join_transfer_size / 1024),
+         (unsigned)(stats->join_usec / 1000),
+         stats->join_usec ? stats->join_transfer_size * 1000000.0 / 1024.0 / stats->join_usec : 0.0,
+         (unsigned)join->input_count);
+
+   handle->frame_count = join->frame;
+   join->state = JOIN_CATCH_UP;
+   ret = true;
+
+end:
+#ifdef HAVE_ZLIB
+   inflateEnd(&join->stream);
+   join->stream_init = false;
+#endif
+   free(record);
+   return ret;
+}
+
+// Runs the frames the host ran while we received its state, with video and audio skipped.
+static void netplay_join_catch_up(netplay_t *handle)
+{
+   struct join_transfer *join = &handle->join;
+   rarch_time_t start = rarch_get_time_usec();
+
+   join->self_state = 0;
+   for (size_t i = 0; i < join->input_count; i++)
+   {
+      join->other_state = join->input[i];
+#if defined(HAVE_THREADS) && !defined(RARCH_CONSOLE)
+      lock_autosave();
+#endif
+      pretro_run();
+#if defined(HAVE_THREADS) && !defined(RARCH_CONSOLE)
+      unlock_autosave();
+#endif
+      handle->frame_count++;
+   }
+
+   handle->stats.join_frames = join->input_count;
+   handle->stats.join_frame_usec = rarch_get_time_usec() - start;
+   RARCH_LOG("Caught up on %u frames in %u ms.\n",
+         handle->stats.join_frames, (unsigned)(handle->stats.join_frame_usec / 1000));
+
+   join_free(join);
+   join->state = JOIN_NONE;
+   if (!netplay_start(handle, handle->frame_count))
+   {
+      RARCH_ERR("Failed to allocate netplay buffers.\n");
+      warn_hangup();
+   }
+}
+
+netplay_t *netplay_new(const char *server, uint16_t port,
+      unsigned frames, const struct retro_callbacks *cb,
+      bool spectate,
+      const char *nick, unsigned max_spectators)
+{
+   if (frames > UDP_FRAME_PACKETS)
+      frames = UDP_FRAME_PACKETS;
+
+   netplay_t *handle = (netplay_t*)calloc(1, sizeof(*handle));
+   if (!handle)
+      return NULL;
+
+   handle->fd = -1;
+   handle->udp_fd = -1;
+   handle->cbs = *cb;
+   handle->port = server ? 0 : 1;
+   handle->spectate = spectate;
+   handle->spectate_client = server != NULL;
+   handle->frames = frames;
+   strlcpy(handle->nick, nick, sizeof(handle->nick));
+
+   if (!server && !spectate && g_settings.netplay_late_join)
+      handle->join.state = JOIN_WAITING;
+
+   if (!init_socket(handle, server, port))
+   {
+      free(handle);
+      return NULL;
+   }
+
+   if (spectate)
+   {
+      if (server)
+      {
+         if (!get_info_spectate(handle))
+            goto error;
+      }
+
+      handle->max_spectators = max_spectators;
+      if (max_spectators)
+      {
+         handle->spectators = (struct spectator*)calloc(max_spectators, sizeof(*handle->spectators));
+         if (!handle->spectators)
+            goto error;
+
+         for (unsigned i = 0; i < max_spectators; i++)
+            handle->spectators[i].fd = -1;
+      }
+   }
+   else
+   {
+      if (server)
+      {
+         if (!send_info(handle))
+            goto error;
+      }
+      else if (handle->join.state == JOIN_NONE)
+      {
+         if (!get_info(handle))
+            goto error;
+      }
+
+      // Otherwise, the rollback history starts once the client has joined.
+      if (handle->join.state == JOIN_NONE && !netplay_start(handle, 0))
+         goto error;
+   }
+
+   return handle;
+
+error:
+   if (handle->fd >= 0)
+      close(handle->fd);
+   if (handle->udp_fd >= 0)
+      close(handle->udp_fd);
+
+   join_free(&handle->join);
+   free(handle);
+   return NULL;
+}
+
+
+static bool netplay_is_alive(netplay_t *handle)
+{
+   return handle->has_connection || handle->join.state == JOIN_SENDING || handle->join.state == JOIN_CATCH_UP;
+}
+
+// An input packet holds a contiguous run of up to UDP_FRAME_PACKETS frames which the other side doesn't have yet,
+// starting with the oldest one, and acks its input by telling it the next frame we need. All values are big endian.
+//
+// uint32_t frame: newest frame in the packet.
+// uint32_t ack: we have all input from the other side before this frame.
+// uint8_t count: frames in the packet, frame - count + 1 up to frame.
+// uint16_t changed: bit i is set if frame - count + 1 + i has different input than the frame before it.
+//    The first frame always has its bit set.
+// uint16_t input[]: input of every frame with its bit set.
+//
+// Only unacked input is resent, so on a good connection packets usually carry a frame or two,
+// and under loss they grow to carry everything the other side is missing.
+static size_t build_packet(netplay_t *handle, uint8_t *packet)
+{
+   uint32_t newest = handle->input_history_frame - 1;
+   uint32_t first = handle->other_ack;
+   if (first > newest)
+      first = newest;
+   if (newest - first >= INPUT_HISTORY_SIZE)
+      first = newest - INPUT_HISTORY_SIZE + 1;
+   // The other side can't use anything after the oldest frame it misses, so that one always goes first.
+   if (newest - first >= UDP_FRAME_PACKETS)
+      newest = first + UDP_FRAME_PACKETS - 1;
+   unsigned count = newest - first + 1;
+
+   uint32_t frame = htonl(newest);
+   uint32_t ack = htonl(handle->read_frame_count);
+   memcpy(packet, &frame, sizeof(frame));
+   memcpy(packet + 4, &ack, sizeof(ack));
+   packet[8] = count;
+
+   uint8_t *out = packet + UDP_PACKET_HEADER_SIZE;
+   uint16_t changed = 0;
+   for (unsigned i = 0; i < count; i++)
+   {
+      uint16_t input = handle->input_history[(first + i) % INPUT_HISTORY_SIZE];
+      if (i && input == handle->input_history[(first + i - 1) % INPUT_HISTORY_SIZE])
+         continue;
+
+      changed |= 1 << i;
+      uint16_t input_net = htons(input);
+      memcpy(out, &input_net, sizeof(input_net));
+      out += sizeof(input_net);
+   }
+
+   changed = htons(changed);
+   memcpy(packet + 9, &changed, sizeof(changed));
+   return out - packet;
+}
+
+static bool send_chunk(netplay_t *handle)
+{
+   const struct sockaddr *addr = NULL;
+   if (handle->addr)
+      addr = handle->addr->ai_addr;
+   else if (handle->has_client_addr)
+      addr = (const struct sockaddr*)&handle->their_addr;
+
+   if (addr)
+   {
+      uint8_t packet[UDP_PACKET_MAX_SIZE];
+      size_t size = build_packet(handle, packet);
+
+      if (sendto(handle->udp_fd, CONST_CAST packet, size, 0, addr,
+               sizeof(struct sockaddr)) != (ssize_t)size)
+      {
+         warn_hangup();
+         handle->has_connection = false;
+         return false;
+      }
+   }
+   return true;
+}
+
+#define MAX_RETRIES 16
+#define RETRY_MS 500
+
+static int poll_input(netplay_t *handle, bool block)
+{
+   int max_fd = (handle->fd > handle->udp_fd ? handle->fd : handle->udp_fd) + 1;
+
+   struct timeval tv = {0};
+   tv.tv_sec = 0;
+   tv.tv_usec = block ? (RETRY_MS * 1000) : 0;
+
+   do
+   { 
+      // Only retries while stalling count, not every frame we polled without getting new input.
+      if (block)
+         handle->timeout_cnt++;
+
+      // select() does not take pointer to const struct timeval.
+      // Technically possible for select() to modify tmp_tv, so we go paranoia mode.
+      struct timeval tmp_tv = tv;
+
+      fd_set fds;
+      FD_ZERO(&fds);
+      FD_SET(handle->udp_fd, &fds);
+      FD_SET(handle->fd, &fds);
+
+      if (select(max_fd, &fds, NULL, NULL, &tmp_tv) < 0)
+         return -1;
+
+      // Somewhat hacky,
+      // but we aren't using the TCP connection for anything useful atm.
+      if (FD_ISSET(handle->fd, &fds) && !netplay_get_cmd(handle))
+         return -1; 
+
+      // The history is about to be thrown away, and what follows on the TCP connection is the state.
+      if (handle->resync)
+         return 0;
+
+      if (FD_ISSET(handle->udp_fd, &fds))
+         return 1;
+
+      if (block && !send_chunk(handle))
+      {
+         warn_hangup();
+         handle->has_connection = false;
+         return -1;
+      }
+
+      if (block)
+      {
+         RARCH_LOG("Network is stalling, resending packet... Count %u of %d ...\n",
+               handle->timeout_cnt, MAX_RETRIES);
+      }
+   } while ((handle->timeout_cnt < MAX_RETRIES) && block);
+
+   if (block)
+      return -1;
+   return 0;
+}
+
+static void queue_input_packet(netplay_t *handle, uint32_t frame, uint16_t state)
+{
+   handle->input_history[frame % INPUT_HISTORY_SIZE] = state;
+   handle->input_history_frame = frame + 1;
+}
+
+static uint16_t sample_self_input_state(netplay_t *handle)
+{
+   uint16_t state = 0;
+   retro_input_state_t cb = handle->cbs.state_cb;
+   for (unsigned i = 0; i < RARCH_FIRST_META_KEY; i++)
+   {
+      int16_t tmp = cb(g_settings.input.netplay_client_swap_input ? 0 : !handle->port,
+            RETRO_DEVICE_JOYPAD, 0, i);
+      state |= tmp ? 1 << i : 0;
+   }
+   return state;
+}
+
+// Grab our own input state and send this over the network.
+// With input delay, it is used input_delay frames from now.
+static bool get_self_input_state(netplay_t *handle)
+{
+   struct delta_frame *ptr = &handle->buffer[(handle->self_ptr + handle->input_delay) % handle->buffer_size];
+
+   uint16_t state = 0;
+   if (handle->frame_count != handle->start_frame) // First frame we always give zero input since relying on input from first frame screws up when we use -F 0.
+      state = sample_self_input_state(handle);
+
+   // Nothing was sampled for the frames before the delay kicks in.
+   if (handle->frame_count == handle->start_frame)
+   {
+      for (unsigned i = 0; i < handle->input_delay; i++)
+         queue_input_packet(handle, handle->start_frame + i, 0);
+   }
+   queue_input_packet(handle, handle->frame_count + handle->input_delay, state);
+
+   if (!send_chunk(handle))
    {
       warn_hangup();
       handle->has_connection = false;
@@ -921,6 +2033,12 @@ static bool get_self_input_state(netplay_t *handle)
    return true;
 }
 
+// We have run as many frames ahead of the last confirmed frame as we can roll back.
+static bool netplay_buffer_full(netplay_t *handle)
+{
+   return handle->frame_count - handle->other_frame_count >= handle->buffer_size - 1 - handle->input_delay;
+}
+
 // TODO: Somewhat better prediction. :P
 static void simulate_input(netplay_t *handle)
 {
@@ -932,15 +2050,41 @@ static void simulate_input(netplay_t *handle)
    handle->buffer[ptr].used_real = false;
 }
 
-static void parse_packet(netplay_t *handle, uint32_t *buffer, unsigned size)
+static void parse_packet(netplay_t *handle, const uint8_t *packet, size_t size)
 {
-   for (unsigned i = 0; i < size * 2; i++)
-      buffer[i] = ntohl(buffer[i]);
+   uint32_t newest, ack;
+   uint16_t changed;
+   memcpy(&newest, packet, sizeof(newest));
+   memcpy(&ack, packet + 4, sizeof(ack));
+   memcpy(&changed, packet + 9, sizeof(changed));
+   newest = ntohl(newest);
+   ack = ntohl(ack);
+   changed = ntohs(changed);
+
+   unsigned count = packet[8];
+   const uint8_t *input = packet + UDP_PACKET_HEADER_SIZE;
+   const uint8_t *end = packet + size;
+
+   // Packets can arrive out of order.
+   if (ack > handle->other_ack)
+      handle->other_ack = ack;
+
+   if (count == 0 || count > UDP_FRAME_PACKETS || !(changed & 1) || newest + 1 < count)
+      return;
 
-   for (unsigned i = 0; i < size && handle->read_frame_count <= handle->frame_count; i++)
+   uint16_t state = 0;
+   uint32_t frame = newest - count + 1;
+   for (unsigned i = 0; i < count && handle->read_frame_count <= handle->frame_count + handle->input_delay;
+         i++, frame++)
    {
-      uint32_t frame = buffer[2 * i + 0];
-      uint32_t state = buffer[2 * i + 1];
+      if (changed & (1 << i))
+      {
+         if (input + sizeof(state) > end)
+            return;
+         memcpy(&state, input, sizeof(state));
+         state = ntohs(state);
+         input += sizeof(state);
+      }
 
       if (frame == handle->read_frame_count)
       {
@@ -953,18 +2097,48 @@ static void parse_packet(netplay_t *handle, uint32_t *buffer, unsigned size)
    }
 }
 
-static bool receive_data(netplay_t *handle, uint32_t *buffer, size_t size)
+// Returns the size of the packet, 0 if it is malformed, or -1 on failure.
+static ssize_t receive_data(netplay_t *handle, uint8_t *packet, size_t size)
 {
    socklen_t addrlen = sizeof(handle->their_addr);
-   if (recvfrom(handle->udp_fd, NONCONST_CAST buffer, size, 0, (struct sockaddr*)&handle->their_addr, &addrlen) != (ssize_t)size)
-      return false;
+   ssize_t ret = recvfrom(handle->udp_fd, NONCONST_CAST packet, size, 0, (struct sockaddr*)&handle->their_addr, &addrlen);
+   if (ret < 0)
+      return -1;
    handle->has_client_addr = true;
+   return ret < (ssize_t)UDP_PACKET_HEADER_SIZE ? 0 : ret;
+}
+
+// While the client joins, we run with our own input only, and keep it for the client to catch up with.
+static bool netplay_join_poll(netplay_t *handle)
+{
+   struct join_transfer *join = &handle->join;
+   handle->can_poll = false;
+
+   if (join->state != JOIN_SENDING)
+      return true;
+
+   if (join->input_count >= join->input_capacity)
+   {
+      size_t capacity = join->input_capacity ? join->input_capacity * 2 : 256;
+      uint16_t *input = (uint16_t*)realloc(join->input, capacity * sizeof(uint16_t));
+      if (!input)
+         return false;
+      join->input = input;
+      join->input_capacity = capacity;
+   }
+
+   join->self_state = sample_self_input_state(handle);
+   join->other_state = 0;
+   join->input[join->input_count++] = join->self_state;
    return true;
 }
 
 // Poll network to see if we have anything new. If our network buffer is full, we simply have to block for new input data.
 static bool netplay_poll(netplay_t *handle)
 {
+   if (handle->join.state != JOIN_NONE)
+      return netplay_join_poll(handle);
+
    if (!handle->has_connection)
       return false;
 
@@ -974,7 +2148,7 @@ static bool netplay_poll(netplay_t *handle)
       return false;
 
    // We skip reading the first frame so the host has a chance to grab our host info so we don't block forever :')
-   if (handle->frame_count == 0)
+   if (handle->frame_count == handle->start_frame)
    {
       handle->buffer[0].used_real = true;
       handle->buffer[0].is_simulated = false;
@@ -985,7 +2159,11 @@ static bool netplay_poll(netplay_t *handle)
    }
 
    // We might have reached the end of the buffer, where we simply have to block.
-   int res = poll_input(handle, handle->other_ptr == handle->self_ptr);
+   // Not if the history is about to be thrown away.
+   bool stall = netplay_buffer_full(handle) && !handle->resync;
+   rarch_time_t stall_start = stall ? rarch_get_time_usec() : 0;
+
+   int res = poll_input(handle, stall);
    if (res == -1)
    {
       handle->has_connection = false;
@@ -998,30 +2176,37 @@ static bool netplay_poll(netplay_t *handle)
       uint32_t first_read = handle->read_frame_count;
       do 
       {
-         uint32_t buffer[UDP_FRAME_PACKETS * 2];
-         if (!receive_data(handle, buffer, sizeof(buffer)))
+         uint8_t packet[UDP_PACKET_MAX_SIZE];
+         ssize_t size = receive_data(handle, packet, sizeof(packet));
+         if (size < 0)
          {
             warn_hangup();
             handle->has_connection = false;
             return false;
          }
-         parse_packet(handle, buffer, UDP_FRAME_PACKETS);
+         if (size)
+            parse_packet(handle, packet, size);
 
       } while ((handle->read_frame_count <= handle->frame_count) && 
-            poll_input(handle, (handle->other_ptr == handle->self_ptr) && 
-               (first_read == handle->read_frame_count)) == 1);
+            poll_input(handle, stall && (first_read == handle->read_frame_count)) == 1);
    }
    else
    {
       // Cannot allow this. Should not happen though.
-      if (handle->self_ptr == handle->other_ptr)
+      if (stall && !handle->resync)
       {
          warn_hangup();
          return false;
       }
    }
 
-   if (handle->read_ptr != handle->self_ptr)
+   if (stall)
+   {
+      handle->stats.stalls++;
+      handle->stats.stall_usec += rarch_get_time_usec() - stall_start;
+   }
+
+   if (handle->read_frame_count <= handle->frame_count)
       simulate_input(handle);
    else
       handle->buffer[PREV_PTR(handle->self_ptr)].used_real = true;
@@ -1034,6 +2219,17 @@ static bool netplay_send_cmd(netplay_t *handle, uint32_t cmd, const void *data,
    cmd = (cmd << 16) | (size & 0xffff);
    cmd = htonl(cmd);
 
+   // Small commands go in one go, or Nagle holds the argument back until the header is acked,
+   // and the other side blocks on it.
+   uint8_t buf[64];
+   if (sizeof(cmd) + size <= sizeof(buf))
+   {
+      memcpy(buf, &cmd, sizeof(cmd));
+      if (size)
+         memcpy(buf + sizeof(cmd), data, size);
+      return send_all(handle->fd, buf, sizeof(cmd) + size);
+   }
+
    if (!send_all(handle->fd, &cmd, sizeof(cmd)))
       return false;
 
@@ -1055,13 +2251,24 @@ static bool netplay_cmd_nak(netplay_t *handle)
    return send_all(handle->fd, &cmd, sizeof(cmd));
 }
 
+static bool netplay_handle_cmd(netplay_t *handle, uint32_t cmd);
+
+// Commands the other side sent in the meantime can come before the response.
 static bool netplay_get_response(netplay_t *handle)
 {
-   uint32_t response;
-   if (!recv_all(handle->fd, &response, sizeof(response)))
-      return false;
+   for (;;)
+   {
+      uint32_t response;
+      if (!recv_all(handle->fd, &response, sizeof(response)))
+         return false;
+
+      response = ntohl(response);
+      if (!(response >> 16))
+         return response == NETPLAY_CMD_ACK;
 
-   return ntohl(response) == NETPLAY_CMD_ACK;
+      if (!netplay_handle_cmd(handle, response))
+         return false;
+   }
 }
 
 static bool netplay_get_cmd(netplay_t *handle)
@@ -1070,8 +2277,11 @@ static bool netplay_get_cmd(netplay_t *handle)
    if (!recv_all(handle->fd, &cmd, sizeof(cmd)))
       return false;
 
-   cmd = ntohl(cmd);
+   return netplay_handle_cmd(handle, ntohl(cmd));
+}
 
+static bool netplay_handle_cmd(netplay_t *handle, uint32_t cmd)
+{
    size_t cmd_size = cmd & 0xffff;
    cmd = cmd >> 16;
 
@@ -1108,12 +2318,48 @@ static bool netplay_get_cmd(netplay_t *handle)
          return netplay_cmd_ack(handle);
       }
 
+      // Neither of these are acked, as they can cross a command going the other way.
+      case NETPLAY_CMD_CRC:
+      {
+         uint32_t data[2];
+         if (cmd_size != sizeof(data) || !recv_all(handle->fd, data, sizeof(data)))
+         {
+            RARCH_ERR("Failed to receive CMD_CRC argument.\n");
+            return false;
+         }
+
+         uint32_t frame = ntohl(data[0]);
+         unsigned slot = (frame / CHECK_FRAMES) % CHECK_HISTORY;
+         handle->other_check[slot].frame = frame;
+         handle->other_check[slot].crc = ntohl(data[1]);
+         handle->other_check[slot].valid = true;
+         netplay_compare_checks(handle, slot);
+         return true;
+      }
+
+      case NETPLAY_CMD_RESYNC:
+         if (cmd_size || handle->port == 1)
+         {
+            RARCH_ERR("Unexpected CMD_RESYNC.\n");
+            return false;
+         }
+
+         RARCH_LOG("Host is resending its state.\n");
+         msg_queue_push(g_extern.msg_queue, "Netplay desync detected, receiving state from host ...", 1, 180);
+         handle->resync = true;
+         return true;
+
       default:
          RARCH_ERR("Unknown netplay command received.\n");
          return netplay_cmd_nak(handle);
    }
 }
 
+void netplay_get_stats(netplay_t *handle, struct netplay_stats *stats)
+{
+   *stats = handle->stats;
+}
+
 void netplay_flip_players(netplay_t *handle)
 {
    uint32_t flip_frame = handle->frame_count + 2 * UDP_FRAME_PACKETS;
@@ -1126,6 +2372,12 @@ void netplay_flip_players(netplay_t *handle)
       goto error;
    }
 
+   if (!handle->has_connection)
+   {
+      msg = "Cannot flip players without a client.";
+      goto error;
+   }
+
    if (handle->port == 0)
    {
       msg = "Cannot flip players if you're not the host.";
@@ -1179,7 +2431,9 @@ int16_t netplay_input_state(netplay_t *handle, bool port, unsigned device, unsig
 
    port = netplay_flip_port(handle, port);
 
-   if ((port ? 1 : 0) == handle->port)
+   if (handle->join.state != JOIN_NONE)
+      input_state = (port ? 1 : 0) == handle->port ? handle->join.other_state : handle->join.self_state;
+   else if ((port ? 1 : 0) == handle->port)
    {
       if (handle->buffer[ptr].is_simulated)
          input_state = handle->buffer[ptr].simulated_input_state;
@@ -1198,20 +2452,33 @@ void netplay_free(netplay_t *handle)
 
    if (handle->spectate)
    {
-      for (unsigned i = 0; i < MAX_SPECTATORS; i++)
-         if (handle->spectate_fds[i] >= 0)
-            close(handle->spectate_fds[i]);
+      for (unsigned i = 0; i < handle->max_spectators; i++)
+      {
+         if (handle->spectators[i].fd >= 0)
+            close(handle->spectators[i].fd);
+         free(handle->spectators[i].queue);
+      }
 
+      free(handle->spectators);
       free(handle->spectate_input);
+      free(handle->spectate_prev);
+      free(handle->spectate_frame);
+      free(handle->spectate_key_frame);
    }
    else
    {
+#ifdef PERF_TEST
+      const struct netplay_stats *stats = &handle->stats;
+      RARCH_LOG("[PERF]: Netplay: %u frames, %u replays (%u frames, %llu usec), %u stalls (%llu usec).\n",
+            stats->frames, stats->replays, stats->replayed_frames, (unsigned long long)stats->replay_usec,
+            stats->stalls, (unsigned long long)stats->stall_usec);
+      RARCH_LOG("[PERF]: Netplay: %u state hashes (%llu usec), %u checks, %u desyncs, %u resyncs.\n",
+            stats->state_hashes, (unsigned long long)stats->state_hash_usec,
+            stats->state_checks, stats->desyncs, stats->resyncs);
+#endif
       close(handle->udp_fd);
-
-      for (unsigned i = 0; i < handle->buffer_size; i++)
-         free(handle->buffer[i].state);
-
-      free(handle->buffer);
+      deinit_buffers(handle);
+      join_free(&handle->join);
    }
 
    if (handle->addr)
@@ -1220,14 +2487,59 @@ void netplay_free(netplay_t *handle)
    free(handle);
 }
 
-static bool netplay_should_skip(netplay_t *handle)
+bool netplay_should_skip(netplay_t *handle)
 {
-   return handle->is_replay && handle->has_connection;
+   return (handle->is_replay && handle->has_connection) || handle->join.state == JOIN_CATCH_UP;
+}
+
+// Throws away the history after a desync. The host streams its state to the client as on
+// a late join, and both sides start over on the frame the transfer ends on.
+static void netplay_resync(netplay_t *handle)
+{
+   struct join_transfer *join = &handle->join;
+
+   handle->resync = false;
+   handle->has_connection = false;
+   handle->stats.resyncs++;
+   deinit_buffers(handle);
+
+   if (handle->port == 1)
+   {
+      join->last_frame = rarch_get_time_usec();
+      if (!netplay_send_cmd(handle, NETPLAY_CMD_RESYNC, NULL, 0) || !netplay_join_begin(handle))
+      {
+         RARCH_ERR("Failed to resend state to client.\n");
+         join_free(join);
+         join->state = JOIN_NONE;
+         warn_hangup();
+         return;
+      }
+
+      // Until the client gets the resync command, it runs ahead with its old history, and sends input
+      // up to input_delay frames ahead of that. None of it may be mistaken for input of the new history.
+      join->min_frame = handle->frame_count + handle->frames + 2 * handle->input_delay + 1;
+   }
+   else if (!netplay_join_receive(handle))
+   {
+      join_free(join);
+      warn_hangup();
+   }
 }
 
 static void netplay_pre_frame_net(netplay_t *handle)
 {
-   pretro_serialize(handle->buffer[handle->self_ptr].state, handle->state_size);
+   if (handle->resync)
+      netplay_resync(handle);
+   if (handle->join.state == JOIN_WAITING)
+      netplay_join_accept(handle);
+   if (handle->join.state == JOIN_SENDING)
+      netplay_join_send(handle);
+   if (handle->join.state == JOIN_CATCH_UP)
+      netplay_join_catch_up(handle);
+
+   // Nothing to roll back until the client has joined.
+   if (handle->join.state == JOIN_NONE && handle->buffer)
+      netplay_serialize_frame(handle, handle->self_ptr, handle->frame_count);
    handle->can_poll = true;
 
    input_poll_net();
@@ -1253,18 +2565,32 @@ int16_t input_state_spectate(unsigned port, unsigned device, unsigned index, uns
    return res;
 }
 
+static void netplay_spectate_hangup(netplay_t *handle)
+{
+   RARCH_ERR("Connection with host was cut.\n");
+   msg_queue_clear(g_extern.msg_queue);
+   msg_queue_push(g_extern.msg_queue, "Connection with host was cut.", 1, 180);
+
+   pretro_set_input_state(g_extern.netplay->cbs.state_cb);
+   handle->spectate_compact = false;
+}
+
 static int16_t netplay_get_spectate_input(netplay_t *handle, bool port, unsigned device, unsigned index, unsigned id)
 {
+   if (handle->spectate_compact)
+   {
+      // The whole frame was read up front.
+      if (handle->spectate_input_ptr < handle->spectate_input_count)
+         return swap_if_big16(handle->spectate_input[handle->spectate_input_ptr++]);
+      return 0;
+   }
+
    int16_t inp;
    if (recv_all(handle->fd, NONCONST_CAST &inp, sizeof(inp)))
       return swap_if_big16(inp);
    else
    {
-      RARCH_ERR("Connection with host was cut.\n");
-      msg_queue_clear(g_extern.msg_queue);
-      msg_queue_push(g_extern.msg_queue, "Connection with host was cut.", 1, 180);
-
-      pretro_set_input_state(g_extern.netplay->cbs.state_cb);
+      netplay_spectate_hangup(handle);
       return g_extern.netplay->cbs.state_cb(port, device, index, id);
    }
 }
@@ -1274,10 +2600,57 @@ int16_t input_state_spectate_client(unsigned port, unsigned device, unsigned ind
    return netplay_get_spectate_input(g_extern.netplay, port, device, index, id);
 }
 
+// Reads a compact input frame from the host, see spectate_encode_frame().
+static bool netplay_get_spectate_frame(netplay_t *handle)
+{
+   uint16_t header;
+   if (!recv_all(handle->fd, NONCONST_CAST &header, sizeof(header)))
+      return false;
+   header = swap_if_big16(header);
+
+   handle->spectate_input_ptr = 0;
+   if (header == SPECTATE_FRAME_REPEAT)
+      return true;
+   if (header > SPECTATE_FRAME_MAX_WORDS)
+      return false;
+
+   size_t count = header;
+   if (count > handle->spectate_input_size)
+   {
+      uint16_t *input = (uint16_t*)realloc(handle->spectate_input, count * sizeof(uint16_t));
+      if (!input)
+         return false;
+      handle->spectate_input = input;
+      handle->spectate_input_size = count;
+   }
+
+   // Words past the end of the previous frame are deltas against 0.
+   for (size_t i = handle->spectate_input_count; i < count; i++)
+      handle->spectate_input[i] = 0;
+   handle->spectate_input_count = count;
+
+   uint8_t mask[(SPECTATE_FRAME_MAX_WORDS + 7) / 8];
+   if (!recv_all(handle->fd, NONCONST_CAST mask, (count + 7) / 8))
+      return false;
+
+   for (size_t i = 0; i < count; i++)
+   {
+      if ((mask[i >> 3] & (1 << (i & 7))) &&
+            !recv_all(handle->fd, NONCONST_CAST &handle->spectate_input[i], sizeof(uint16_t)))
+         return false;
+   }
+
+   return true;
+}
+
 static void netplay_pre_frame_spectate(netplay_t *handle)
 {
    if (handle->spectate_client)
+   {
+      if (handle->spectate_compact && !netplay_get_spectate_frame(handle))
+         netplay_spectate_hangup(handle);
       return;
+   }
 
    fd_set fds;
    FD_ZERO(&fds);
@@ -1300,9 +2673,9 @@ static void netplay_pre_frame_spectate(netplay_t *handle)
    }
 
    int index = -1;
-   for (unsigned i = 0; i < MAX_SPECTATORS; i++)
+   for (unsigned i = 0; i < handle->max_spectators; i++)
    {
-      if (handle->spectate_fds[i] == -1)
+      if (handle->spectators[i].fd == -1)
       {
          index = i;
          break;
@@ -1311,10 +2684,20 @@ static void netplay_pre_frame_spectate(netplay_t *handle)
 
    // No vacant client streams :(
    if (index == -1)
+   {
+      RARCH_WARN("Spectator limit (%u) reached, refusing connection.\n", handle->max_spectators);
+      close(new_fd);
+      return;
+   }
+
+#ifndef _WIN32
+   // We select() on spectators when sending.
+   if (new_fd >= FD_SETSIZE)
    {
       close(new_fd);
       return;
    }
+#endif
 
    if (!get_nickname(handle, new_fd))
    {
@@ -1323,7 +2706,8 @@ static void netplay_pre_frame_spectate(netplay_t *handle)
       return;
    }
 
-   if (!send_nickname(handle, new_fd))
+   bool compact = handle->other_compact;
+   if (!send_nickname(handle, new_fd, compact ? SPECTATE_NICK_COMPACT : 0))
    {
       RARCH_ERR("Failed to send nickname to client.\n");
       close(new_fd);
@@ -1351,7 +2735,23 @@ static void netplay_pre_frame_spectate(netplay_t *handle)
    }
 
    free(header);
-   handle->spectate_fds[index] = new_fd;
+
+   // From here on, spectators are never allowed to block us.
+   struct spectator *spec = &handle->spectators[index];
+   if (!spec->queue)
+      spec->queue = (uint8_t*)malloc(SPECTATE_QUEUE_SIZE);
+   if (!spec->queue || !socket_nonblock(new_fd, true))
+   {
+      RARCH_ERR("Failed to set up spectator stream.\n");
+      close(new_fd);
+      return;
+   }
+
+   spec->fd = new_fd;
+   spec->compact = compact;
+   spec->keyed = false;
+   spec->queue_ptr = 0;
+   spec->queue_size = 0;
 
 #ifndef HAVE_SOCKET_LEGACY
    log_connection(&their_addr, index, handle->other_nick);
@@ -1369,13 +2769,20 @@ void netplay_pre_frame(netplay_t *handle)
 static void netplay_post_frame_net(netplay_t *handle)
 {
    handle->frame_count++;
+   if (handle->join.state != JOIN_NONE || !handle->buffer)
+      return;
+   handle->stats.frames++;
+
+   // Input which arrived ahead of time for frames we haven't run yet can't have been mispredicted.
+   uint32_t read_frame_count = handle->read_frame_count < handle->frame_count ?
+      handle->read_frame_count : handle->frame_count;
 
    // Nothing to do...
-   if (handle->other_frame_count == handle->read_frame_count)
+   if (handle->other_frame_count == read_frame_count)
       return;
 
    // Skip ahead if we predicted correctly. Skip until our simulation failed.
-   while (handle->other_frame_count < handle->read_frame_count)
+   while (handle->other_frame_count < read_frame_count)
    {
       const struct delta_frame *ptr = &handle->buffer[handle->other_ptr];
       if ((ptr->simulated_input_state != ptr->real_input_state) && !ptr->used_real)
@@ -1384,18 +2791,48 @@ static void netplay_post_frame_net(netplay_t *handle)
       handle->other_frame_count++;
    }
 
-   if (handle->other_frame_count < handle->read_frame_count)
+   // We never roll back past other_ptr. Frames up to frame_count - 1 have been serialized.
+   netplay_advance_base(handle, handle->other_frame_count < handle->frame_count ?
+         handle->other_frame_count : handle->frame_count - 1);
+
+   if (handle->other_frame_count < read_frame_count)
    {
       // Replay frames
+      rarch_time_t replay_start = rarch_get_time_usec();
+      unsigned depth = handle->frame_count - handle->other_frame_count;
+
       handle->is_replay = true;
       handle->tmp_ptr = handle->other_ptr;
       handle->tmp_frame_count = handle->other_frame_count;
 
-      pretro_unserialize(handle->buffer[handle->other_ptr].state, handle->state_size);
+      pretro_unserialize(handle->base_state, handle->state_size);
+
+      // Frames before read_frame_count now run with real input, and are never rolled back to again.
+      // Only serialize from there on, starting with a new base.
+      handle->base_ptr = (handle->other_ptr + read_frame_count - handle->other_frame_count) % handle->buffer_size;
+      handle->base_frame_count = read_frame_count;
+
+      // Frames still without real input were predicted from older input than we have now.
+      // Predict them again, or every frame until their real input arrives replays them once more.
+      uint16_t prediction = handle->buffer[PREV_PTR(handle->read_ptr)].real_input_state;
+
       bool first = true;
       while (first || (handle->tmp_ptr != handle->self_ptr))
       {
-         pretro_serialize(handle->buffer[handle->tmp_ptr].state, handle->state_size);
+         if (handle->tmp_frame_count >= read_frame_count)
+         {
+            struct delta_frame *ptr = &handle->buffer[handle->tmp_ptr];
+            if (handle->tmp_frame_count >= handle->read_frame_count)
+               ptr->simulated_input_state = prediction;
+            netplay_serialize_frame(handle, handle->tmp_ptr, handle->tmp_frame_count);
+         }
+         else if (handle->tmp_frame_count != handle->other_frame_count && handle->tmp_frame_count % CHECK_FRAMES == 0)
+         {
+            // Never becomes the base, so this is the only time its state is around to check.
+            // The first frame is the old base, which has been checked already.
+            pretro_serialize(handle->tmp_state, handle->state_size);
+            netplay_check_state(handle, handle->tmp_frame_count, handle->tmp_state);
+         }
 #if defined(HAVE_THREADS) && !defined(RARCH_CONSOLE)
          lock_autosave();
 #endif
@@ -1408,10 +2845,131 @@ static void netplay_post_frame_net(netplay_t *handle)
          first = false;
       }
 
-      handle->other_ptr = handle->read_ptr;
-      handle->other_frame_count = handle->read_frame_count;
+      handle->other_ptr = handle->base_ptr;
+      handle->other_frame_count = read_frame_count;
       handle->is_replay = false;
+
+      handle->stats.replays++;
+      handle->stats.replayed_frames += depth;
+      handle->stats.replay_depth[depth < NETPLAY_MAX_REPLAY_DEPTH ? depth : NETPLAY_MAX_REPLAY_DEPTH]++;
+      handle->stats.replay_usec += rarch_get_time_usec() - replay_start;
+   }
+}
+
+static void spectator_drop(netplay_t *handle, unsigned index, const char *reason)
+{
+   struct spectator *spec = &handle->spectators[index];
+   RARCH_LOG("Client (#%u) %s ...\n", index, reason);
+
+   char msg[512];
+   snprintf(msg, sizeof(msg), "Client (#%u) %s.", index, reason);
+   msg_queue_push(g_extern.msg_queue, msg, 1, 180);
+
+   close(spec->fd);
+   spec->fd = -1;
+}
+
+static bool spectator_queue(struct spectator *spec, const uint8_t *data, size_t size)
+{
+   if (size > SPECTATE_QUEUE_SIZE - spec->queue_size)
+      return false;
+
+   size_t write_ptr = (spec->queue_ptr + spec->queue_size) % SPECTATE_QUEUE_SIZE;
+   size_t first = SPECTATE_QUEUE_SIZE - write_ptr;
+   if (first > size)
+      first = size;
+
+   memcpy(spec->queue + write_ptr, data, first);
+   memcpy(spec->queue, data + first, size - first);
+   spec->queue_size += size;
+   return true;
+}
+
+// Sends as much queued input as the socket takes without blocking.
+static bool spectator_flush(struct spectator *spec)
+{
+   while (spec->queue_size)
+   {
+      size_t chunk = SPECTATE_QUEUE_SIZE - spec->queue_ptr;
+      if (chunk > spec->queue_size)
+         chunk = spec->queue_size;
+
+      ssize_t ret = send(spec->fd, CONST_CAST (spec->queue + spec->queue_ptr), chunk, 0);
+      if (ret < 0 && socket_would_block())
+         return true;
+      if (ret <= 0)
+         return false;
+
+      spec->queue_ptr = (spec->queue_ptr + ret) % SPECTATE_QUEUE_SIZE;
+      spec->queue_size -= ret;
    }
+
+   return true;
+}
+
+// A compact frame is a 16-bit word count, followed by a bitmask of the words which changed from
+// the previous frame, and then only the changed words. A frame identical to the previous one is
+// just SPECTATE_FRAME_REPEAT. Input barely changes from frame to frame, so this is a lot smaller
+// than the raw words. prev can be NULL to encode a frame which doesn't depend on the previous one.
+static size_t spectate_encode_frame(uint8_t *out, const uint16_t *input, size_t count,
+      const uint16_t *prev, size_t prev_count)
+{
+   if (prev && count == prev_count && !memcmp(input, prev, count * sizeof(uint16_t)))
+   {
+      uint16_t header = swap_if_big16(SPECTATE_FRAME_REPEAT);
+      memcpy(out, &header, sizeof(header));
+      return sizeof(header);
+   }
+
+   uint16_t header = swap_if_big16(count);
+   memcpy(out, &header, sizeof(header));
+
+   uint8_t *mask = out + sizeof(header);
+   uint8_t *words = mask + (count + 7) / 8;
+   memset(mask, 0, (count + 7) / 8);
+
+   for (size_t i = 0; i < count; i++)
+   {
+      uint16_t old = prev && i < prev_count ? prev[i] : 0;
+      if (input[i] == old)
+         continue;
+
+      mask[i >> 3] |= 1 << (i & 7);
+      memcpy(words, &input[i], sizeof(uint16_t));
+      words += sizeof(uint16_t);
+   }
+
+   return words - out;
+}
+
+// Makes room to encode the current frame, and to keep it for the next delta.
+static bool spectate_reserve_frames(netplay_t *handle, size_t count)
+{
+   if (count > handle->spectate_prev_size)
+   {
+      uint16_t *prev = (uint16_t*)realloc(handle->spectate_prev, count * sizeof(uint16_t));
+      if (!prev)
+         return false;
+      handle->spectate_prev = prev;
+      handle->spectate_prev_size = count;
+   }
+
+   size_t max_size = sizeof(uint16_t) + (count + 7) / 8 + count * sizeof(uint16_t);
+   if (max_size > handle->spectate_frame_size)
+   {
+      uint8_t *frame = (uint8_t*)realloc(handle->spectate_frame, max_size);
+      if (frame)
+         handle->spectate_frame = frame;
+      uint8_t *key_frame = (uint8_t*)realloc(handle->spectate_key_frame, max_size);
+      if (key_frame)
+         handle->spectate_key_frame = key_frame;
+      if (!frame || !key_frame)
+         return false;
+
+      handle->spectate_frame_size = max_size;
+   }
+
+   return true;
 }
 
 static void netplay_post_frame_spectate(netplay_t *handle)
@@ -1419,27 +2977,94 @@ static void netplay_post_frame_spectate(netplay_t *handle)
    if (handle->spectate_client)
       return;
 
-   for (unsigned i = 0; i < MAX_SPECTATORS; i++)
+   const uint16_t *input = handle->spectate_input;
+   size_t count = handle->spectate_input_ptr;
+   handle->spectate_input_ptr = 0;
+
+   // Compact frames are encoded once and shared by every spectator.
+   size_t compact_count = count;
+   if (compact_count > SPECTATE_FRAME_MAX_WORDS)
+      compact_count = SPECTATE_FRAME_MAX_WORDS;
+
+   size_t frame_size = 0, key_frame_size = 0;
+   bool compact = spectate_reserve_frames(handle, compact_count);
+   if (compact)
+   {
+      frame_size = spectate_encode_frame(handle->spectate_frame, input, compact_count,
+            handle->spectate_prev, handle->spectate_prev_count);
+   }
+
+   for (unsigned i = 0; i < handle->max_spectators; i++)
    {
-      if (handle->spectate_fds[i] == -1)
+      struct spectator *spec = &handle->spectators[i];
+      if (spec->fd == -1)
          continue;
 
-      if (!send_all(handle->spectate_fds[i],
-               handle->spectate_input, handle->spectate_input_ptr * sizeof(int16_t)))
+      bool ret;
+      if (!spec->compact)
+         ret = spectator_queue(spec, (const uint8_t*)input, count * sizeof(uint16_t));
+      else if (!compact)
+         ret = false;
+      else if (spec->keyed)
+         ret = spectator_queue(spec, handle->spectate_frame, frame_size);
+      else
       {
-         RARCH_LOG("Client (#%u) disconnected ...\n", i);
-
-         char msg[512];
-         snprintf(msg, sizeof(msg), "Client (#%u) disconnected.", i);
-         msg_queue_push(g_extern.msg_queue, msg, 1, 180);
+         // New spectators have nothing to apply a delta to yet.
+         if (!key_frame_size)
+            key_frame_size = spectate_encode_frame(handle->spectate_key_frame, input, compact_count, NULL, 0);
+         ret = spectator_queue(spec, handle->spectate_key_frame, key_frame_size);
+      }
 
-         close(handle->spectate_fds[i]);
-         handle->spectate_fds[i] = -1;
-         break;
+      if (!ret)
+      {
+         spectator_drop(handle, i, "fell too far behind");
+         continue;
       }
+      spec->keyed = true;
    }
 
-   handle->spectate_input_ptr = 0;
+   // Remember this frame for the next delta.
+   if (compact)
+   {
+      memcpy(handle->spectate_prev, input, compact_count * sizeof(uint16_t));
+      handle->spectate_prev_count = compact_count;
+   }
+
+   if (++handle->spectate_batch < SPECTATE_BATCH_FRAMES)
+      return;
+   handle->spectate_batch = 0;
+
+   fd_set fds;
+   FD_ZERO(&fds);
+   int max_fd = -1;
+
+   for (unsigned i = 0; i < handle->max_spectators; i++)
+   {
+      struct spectator *spec = &handle->spectators[i];
+      if (spec->fd == -1 || !spec->queue_size)
+         continue;
+
+      FD_SET(spec->fd, &fds);
+      if (spec->fd > max_fd)
+         max_fd = spec->fd;
+   }
+
+   if (max_fd < 0)
+      return;
+
+   struct timeval tmp_tv = {0};
+   if (select(max_fd + 1, NULL, &fds, NULL, &tmp_tv) <= 0)
+      return;
+
+   for (unsigned i = 0; i < handle->max_spectators; i++)
+   {
+      struct spectator *spec = &handle->spectators[i];
+      if (spec->fd == -1 || !FD_ISSET(spec->fd, &fds))
+         continue;
+
+      if (!spectator_flush(spec))
+         spectator_drop(handle, i, "disconnected");
+   }
 }
 
 // Here we check if we have new input and replay from recorded input.
@@ -43,16 +43,54 @@ struct retro_callbacks
 
 bool netplay_init_network(void);
 
+// Replays deeper than this are counted in the last bucket.
+#define NETPLAY_MAX_REPLAY_DEPTH 16
+
+struct netplay_stats
+{
+   unsigned frames; // Frames run, not counting replays.
+   unsigned replays; // Times a misprediction made us roll back.
+   unsigned replayed_frames;
+   unsigned replay_depth[NETPLAY_MAX_REPLAY_DEPTH + 1]; // Histogram of frames replayed per rollback.
+   uint64_t replay_usec; // Time spent replaying, including unserializing.
+   unsigned stalls; // Frames where we had to block for input from the other side.
+   uint64_t stall_usec;
+
+   // Late join, or the last resync. On the host, the state streamed to the client, and the frames run while streaming it.
+   // On the client, the state received, and the frames run to catch up with the host.
+   size_t join_state_size;
+   size_t join_transfer_size; // Compressed size of the state.
+   uint64_t join_usec; // Time until the state was transferred.
+   unsigned join_frames;
+   uint64_t join_frame_usec; // Total time of these frames.
+   uint64_t join_frame_usec_max;
+   uint64_t join_send_usec_max; // Longest time the host spent compressing and sending in a frame.
+
+   // Desync detection. Hashes of our state, and the ones compared with the other side's.
+   unsigned state_hashes;
+   uint64_t state_hash_usec;
+   unsigned state_checks;
+   unsigned desyncs; // Checks which didn't match, not counting those until the next resync.
+   unsigned resyncs; // Times the host resent its state after a desync.
+};
+
 // Creates a new netplay handle. A NULL host means we're hosting (player 1). :)
+// When hosting in spectate mode, up to max_spectators clients are accepted.
 netplay_t *netplay_new(const char *server,
       uint16_t port, unsigned frames,
       const struct retro_callbacks *cb, bool spectate,
-      const char *nick);
+      const char *nick, unsigned max_spectators);
 void netplay_free(netplay_t *handle);
 
+// Rollback statistics since the handle was created. Only meaningful for regular netplay.
+void netplay_get_stats(netplay_t *handle, struct netplay_stats *stats);
+
 // On regular netplay, flip who controls player 1 and 2.
 void netplay_flip_players(netplay_t *handle);
 
+// True while replaying frames to resync, or catching up after a late join. Video and audio of these frames are discarded.
+bool netplay_should_skip(netplay_t *handle);
+
 // Call this before running retro_run()
 void netplay_pre_frame(netplay_t *handle);
 // Call this after running retro_run()
@@ -72,7 +72,9 @@ void rarch_perf_log(void)
    for (unsigned i = 0; i < perf_ptr; i++)
       RARCH_PERFORMANCE_LOG(perf_counters[i]->ident, *perf_counters[i]);
 }
+#endif
 
+// Also used outside of PERF_TEST builds, e.g. to budget rewind.
 rarch_perf_tick_t rarch_get_perf_counter(void)
 {
    rarch_perf_tick_t time = 0;
@@ -110,7 +112,6 @@ rarch_perf_tick_t rarch_get_perf_counter(void)
 
    return time;
 }
-#endif
 
 rarch_time_t rarch_get_time_usec(void)
 {
@@ -171,9 +172,9 @@ static void x86_cpuid(int func, int flags[4])
          "cpuid\n"
          "xchg %%" REG_b ", %%" REG_S "\n"
          : "=a"(flags[0]), "=S"(flags[1]), "=c"(flags[2]), "=d"(flags[3])
-         : "a"(func));
+         : "a"(func), "c"(0));
 #elif defined(_MSC_VER)
-   __cpuid(flags, func);
+   __cpuidex(flags, func, 0);
 #else
    RARCH_WARN("Unknown compiler. Cannot check CPUID with inline assembly.\n");
    memset(flags, 0, 4 * sizeof(int));
@@ -194,7 +195,8 @@ void rarch_get_cpu_features(struct rarch_cpu_features *cpu)
    memcpy(vendor, vendor_shuffle, sizeof(vendor_shuffle));
    RARCH_LOG("[CPUID]: Vendor: %s\n", vendor);
 
-   if (flags[0] < 1) // Does CPUID not support func = 1? (unlikely ...)
+   const int max_func = flags[0];
+   if (max_func < 1) // Does CPUID not support func = 1? (unlikely ...)
       return;
 
    x86_cpuid(1, flags);
@@ -205,13 +207,33 @@ void rarch_get_cpu_features(struct rarch_cpu_features *cpu)
    if (flags[3] & (1 << 26))
       cpu->simd |= RARCH_SIMD_SSE2;
 
+   if (flags[2] & (1 << 19))
+      cpu->simd |= RARCH_SIMD_SSE41;
+
+   if (flags[2] & (1 << 20))
+      cpu->simd |= RARCH_SIMD_SSE42;
+
    const int avx_flags = (1 << 27) | (1 << 28);
    if ((flags[2] & avx_flags) == avx_flags)
       cpu->simd |= RARCH_SIMD_AVX;
 
+   if ((cpu->simd & RARCH_SIMD_AVX) && (flags[2] & (1 << 12)))
+      cpu->simd |= RARCH_SIMD_FMA3;
+
+   if (max_func >= 7)
+   {
+      x86_cpuid(7, flags);
+      if ((cpu->simd & RARCH_SIMD_AVX) && (flags[1] & (1 << 5)))
+         cpu->simd |= RARCH_SIMD_AVX2;
+   }
+
    RARCH_LOG("[CPUID]: SSE:  %u\n", !!(cpu->simd & RARCH_SIMD_SSE));
    RARCH_LOG("[CPUID]: SSE2: %u\n", !!(cpu->simd & RARCH_SIMD_SSE2));
+   RARCH_LOG("[CPUID]: SSE4.1: %u\n", !!(cpu->simd & RARCH_SIMD_SSE41));
+   RARCH_LOG("[CPUID]: SSE4.2: %u\n", !!(cpu->simd & RARCH_SIMD_SSE42));
    RARCH_LOG("[CPUID]: AVX:  %u\n", !!(cpu->simd & RARCH_SIMD_AVX));
+   RARCH_LOG("[CPUID]: AVX2: %u\n", !!(cpu->simd & RARCH_SIMD_AVX2));
+   RARCH_LOG("[CPUID]: FMA3: %u\n", !!(cpu->simd & RARCH_SIMD_FMA3));
 #elif defined(ANDROID) && defined(ANDROID_ARM)
    uint64_t cpu_flags = android_getCpuFeatures();
 
@@ -158,9 +158,10 @@ struct ffemu
    
    struct ffemu_params params;
 
+   // Only used to sleep when the fifos are full or empty.
+   // The fifos themselves are lock-free, with the main thread as producer and ffemu_thread as consumer.
    scond_t *cond;
    slock_t *cond_lock;
-   slock_t *lock;
    fifo_buffer_t *audio_fifo;
    fifo_buffer_t *video_fifo;
    fifo_buffer_t *attr_fifo;
@@ -282,6 +283,7 @@ static bool ffemu_init_audio(ffemu_t *handle)
       rarch_resampler_realloc(&audio->resampler_data,
             &audio->resampler,
             *g_settings.audio.resampler ? g_settings.audio.resampler : NULL,
+            (enum resampler_quality)g_settings.audio.resampler_quality,
             audio->ratio);
    }
    else
@@ -555,19 +557,20 @@ static void ffemu_thread(void *data);
 
 static bool init_thread(ffemu_t *handle)
 {
-   handle->lock = slock_new();
    handle->cond_lock = slock_new();
    handle->cond = scond_new();
    handle->audio_fifo = fifo_new(32000 * sizeof(int16_t) * handle->params.channels * MAX_FRAMES / 60); // Some arbitrary max size.
    handle->attr_fifo = fifo_new(sizeof(struct ffemu_video_data) * MAX_FRAMES);
+   // One extra frame, as a frame is written before its attributes,
+   // and the encoder reads the attributes before the frame.
    handle->video_fifo = fifo_new(handle->params.fb_width * handle->params.fb_height *
-            handle->video.pix_size * MAX_FRAMES);
+            handle->video.pix_size * (MAX_FRAMES + 1));
 
    handle->alive = true;
    handle->can_sleep = true;
    handle->thread = sthread_create(ffemu_thread, handle);
 
-   assert(handle->lock && handle->cond_lock &&
+   assert(handle->cond_lock &&
       handle->cond && handle->audio_fifo &&
       handle->attr_fifo && handle->video_fifo && handle->thread);
 
@@ -587,7 +590,6 @@ static void deinit_thread(ffemu_t *handle)
    scond_signal(handle->cond);
    sthread_join(handle->thread);
 
-   slock_free(handle->lock);
    slock_free(handle->cond_lock);
    scond_free(handle->cond);
 
@@ -708,9 +710,7 @@ bool ffemu_push_video(ffemu_t *handle, const struct ffemu_video_data *data)
 
    for (;;)
    {
-      slock_lock(handle->lock);
       unsigned avail = fifo_write_avail(handle->attr_fifo);
-      slock_unlock(handle->lock);
 
       if (!handle->alive)
          return false;
@@ -731,8 +731,6 @@ bool ffemu_push_video(ffemu_t *handle, const struct ffemu_video_data *data)
       slock_unlock(handle->cond_lock);
    }
 
-   slock_lock(handle->lock);
-
    // Tightly pack our frame to conserve memory. libretro tends to use a very large pitch.
    struct ffemu_video_data attr_data = *data;
 
@@ -741,13 +739,13 @@ bool ffemu_push_video(ffemu_t *handle, const struct ffemu_video_data *data)
    else
       attr_data.pitch = attr_data.width * handle->video.pix_size;
 
-   fifo_write(handle->attr_fifo, &attr_data, sizeof(attr_data));
-
    int offset = 0;
    for (unsigned y = 0; y < attr_data.height; y++, offset += data->pitch)
       fifo_write(handle->video_fifo, (const uint8_t*)data->data + offset, attr_data.pitch);
 
-   slock_unlock(handle->lock);
+   // The encoder thread polls attr_fifo, so it must only see the attributes
+   // once the frame itself is in video_fifo.
+   fifo_write(handle->attr_fifo, &attr_data, sizeof(attr_data));
    scond_signal(handle->cond);
 
    return true;
@@ -757,9 +755,7 @@ bool ffemu_push_audio(ffemu_t *handle, const struct ffemu_audio_data *data)
 {
    for (;;)
    {
-      slock_lock(handle->lock);
       unsigned avail = fifo_write_avail(handle->audio_fifo);
-      slock_unlock(handle->lock);
 
       if (!handle->alive)
          return false;
@@ -780,9 +776,7 @@ bool ffemu_push_audio(ffemu_t *handle, const struct ffemu_audio_data *data)
       slock_unlock(handle->cond_lock);
    }
 
-   slock_lock(handle->lock);
    fifo_write(handle->audio_fifo, data->data, data->frames * handle->params.channels * sizeof(int16_t));
-   slock_unlock(handle->lock);
    scond_signal(handle->cond);
 
    return true;
@@ -879,24 +873,6 @@ static bool ffemu_push_video_thread(ffemu_t *handle, const struct ffemu_video_da
    return true;
 }
 
-static void planarize_float(float *out, const float *in, size_t frames)
-{
-   for (size_t i = 0; i < frames; i++)
-   {
-      out[i] = in[2 * i + 0];
-      out[i + frames] = in[2 * i + 1];
-   }
-}
-
-static void planarize_s16(int16_t *out, const int16_t *in, size_t frames)
-{
-   for (size_t i = 0; i < frames; i++)
-   {
-      out[i] = in[2 * i + 0];
-      out[i + frames] = in[2 * i + 1];
-   }
-}
-
 static void planarize_audio(ffemu_t *handle)
 {
    if (!handle->audio.is_planar)
@@ -913,10 +889,10 @@ static void planarize_audio(ffemu_t *handle)
    }
 
    if (handle->audio.use_float)
-      planarize_float((float*)handle->audio.planar_buf,
+      audio_convert_planarize_float((float*)handle->audio.planar_buf,
             (const float*)handle->audio.buffer, handle->audio.frames_in_buffer);
    else
-      planarize_s16((int16_t*)handle->audio.planar_buf,
+      audio_convert_planarize_s16((int16_t*)handle->audio.planar_buf,
             (const int16_t*)handle->audio.buffer, handle->audio.frames_in_buffer);
 }
 
@@ -1196,13 +1172,11 @@ static void ffemu_thread(void *data)
       bool avail_video = false;
       bool avail_audio = false;
 
-      slock_lock(ff->lock);
       if (fifo_read_avail(ff->attr_fifo) >= sizeof(attr_buf))
          avail_video = true;
 
       if (fifo_read_avail(ff->audio_fifo) >= audio_buf_size)
          avail_audio = true;
-      slock_unlock(ff->lock);
 
       if (!avail_video && !avail_audio)
       {
@@ -1221,10 +1195,8 @@ static void ffemu_thread(void *data)
 
       if (avail_video)
       {
-         slock_lock(ff->lock);
          fifo_read(ff->attr_fifo, &attr_buf, sizeof(attr_buf));
          fifo_read(ff->video_fifo, video_buf, attr_buf.height * attr_buf.pitch);
-         slock_unlock(ff->lock);
          scond_signal(ff->cond);
 
          attr_buf.data = video_buf;
@@ -1233,9 +1205,7 @@ static void ffemu_thread(void *data)
 
       if (avail_audio)
       {
-         slock_lock(ff->lock);
          fifo_read(ff->audio_fifo, audio_buf, audio_buf_size);
-         slock_unlock(ff->lock);
          scond_signal(ff->cond);
 
          struct ffemu_audio_data aud = {0};
@@ -177,7 +177,7 @@ static void take_screenshot(void)
 }
 #endif
 
-static void readjust_audio_input_rate(void)
+static void readjust_audio_input_rate(size_t samples)
 {
    int avail = audio_write_avail_func();
    //RARCH_LOG_OUTPUT("Audio buffer is %u%% full\n",
@@ -185,12 +185,36 @@ static void readjust_audio_input_rate(void)
 
    unsigned write_index = g_extern.measure_data.buffer_free_samples_count++ & (AUDIO_BUFFER_FREE_SAMPLES_COUNT - 1);
    g_extern.measure_data.buffer_free_samples[write_index] = avail;
+   if (avail >= (int)g_extern.audio_data.driver_buffer_size)
+      g_extern.measure_data.buffer_underrun_count++;
 
-   int half_size = g_extern.audio_data.driver_buffer_size / 2;
-   int delta_mid = avail - half_size;
-   double direction = (double)delta_mid / half_size;
+   double direction;
+   if (g_settings.audio.rate_control_pi)
+   {
+      // Proportional term as below, but around the target fill. The integral term soaks up
+      // any steady drift between audio and video clocks, which otherwise keeps fill off target.
+      int size   = g_extern.audio_data.driver_buffer_size;
+      int target = g_extern.audio_data.rate_control_target;
+      int range  = max(target, size - target);
+      double error = (double)(target - (size - avail)) / range;
+
+      double seconds  = (double)(samples >> 1) / g_settings.audio.in_rate;
+      double integral = g_extern.audio_data.rate_control_integral + error * AUDIO_RATE_CONTROL_KI * seconds;
+      integral = max(min(integral, 1.0), -1.0);
+      g_extern.audio_data.rate_control_integral = integral;
+
+      direction = max(min(error + integral, 1.0), -1.0);
+   }
+   else
+   {
+      int half_size = g_extern.audio_data.driver_buffer_size / 2;
+      int delta_mid = avail - half_size;
+      direction = (double)delta_mid / half_size;
+   }
 
    double adjust = 1.0 + g_settings.audio.rate_control_delta * direction;
+   g_extern.measure_data.rate_adjust_accum    += adjust - 1.0;
+   g_extern.measure_data.rate_adjust_accum_sq += (adjust - 1.0) * (adjust - 1.0);
 
    g_extern.audio_data.src_ratio = g_extern.audio_data.orig_src_ratio * adjust;
 
@@ -395,7 +419,7 @@ static bool audio_flush(const int16_t *data, size_t samples)
    src_data.data_out = g_extern.audio_data.outsamples;
 
    if (g_extern.audio_data.rate_control)
-      readjust_audio_input_rate();
+      readjust_audio_input_rate(samples);
 
    src_data.ratio = g_extern.audio_data.src_ratio;
    if (g_extern.is_slowmotion)
@@ -1437,20 +1461,119 @@ static void deinit_cheats(void)
       cheat_manager_free(g_extern.cheat);
 }
 
+// Returns the size of a rewind state made up of memory regions, or 0 if the implementation doesn't expose any.
+static size_t init_rewind_regions(void)
+{
+   const struct retro_memory_regions *mem = &g_extern.system.mem_regions;
+   if (!mem->regions)
+      return 0;
+
+   struct state_manager_region *regions = (struct state_manager_region*)
+      calloc(mem->num_regions + 1, sizeof(*regions));
+   if (!regions)
+      return 0;
+
+   // The opaque part comes first. It is serialized into state_buf, which isn't allocated yet.
+   size_t size = (mem->opaque_size + 3) & ~3;
+   unsigned num_regions = 0;
+   regions[num_regions++].size = size;
+
+   for (unsigned i = 0; i < mem->num_regions; i++)
+   {
+      if (mem->regions[i].flags & RETRO_MEMORY_REGION_CONST)
+         continue;
+
+      regions[num_regions].data = mem->regions[i].ptr;
+      regions[num_regions].size = mem->regions[i].size;
+      size += mem->regions[i].size;
+      num_regions++;
+   }
+
+   g_extern.state_regions     = regions;
+   g_extern.num_state_regions = num_regions;
+   return size;
+}
+
+static bool rewind_serialize(void *data)
+{
+   if (!g_extern.state_regions)
+      return pretro_serialize(data, g_extern.state_size);
+
+   const struct retro_memory_regions *mem = &g_extern.system.mem_regions;
+   if (mem->opaque_size && !mem->serialize(data, mem->opaque_size))
+      return false;
+
+   uint8_t *out = (uint8_t*)data + g_extern.state_regions[0].size;
+   for (unsigned i = 1; i < g_extern.num_state_regions; i++)
+   {
+      memcpy(out, g_extern.state_regions[i].data, g_extern.state_regions[i].size);
+      out += g_extern.state_regions[i].size;
+   }
+   return true;
+}
+
+static bool rewind_unserialize(const void *data)
+{
+   if (!g_extern.state_regions)
+      return pretro_unserialize(data, g_extern.state_size);
+
+   const uint8_t *in = (const uint8_t*)data + g_extern.state_regions[0].size;
+   for (unsigned i = 1; i < g_extern.num_state_regions; i++)
+   {
+      memcpy((void*)g_extern.state_regions[i].data, in, g_extern.state_regions[i].size);
+      in += g_extern.state_regions[i].size;
+   }
+
+   const struct retro_memory_regions *mem = &g_extern.system.mem_regions;
+   return !mem->opaque_size || mem->unserialize(data, mem->opaque_size);
+}
+
+static void rewind_capture(void)
+{
+   if (g_extern.state_regions)
+   {
+      // Only the opaque part is copied, the regions are diffed straight from the implementation's memory.
+      const struct retro_memory_regions *mem = &g_extern.system.mem_regions;
+      if (mem->opaque_size && !mem->serialize(g_extern.state_buf, mem->opaque_size))
+         return;
+
+      state_manager_push_regions(g_extern.state_manager, g_extern.state_regions, g_extern.num_state_regions);
+   }
+   else
+   {
+      void *state_buf = state_manager_get_capture_buffer(g_extern.state_manager);
+      if (!state_buf)
+         state_buf = g_extern.state_buf;
+      if (pretro_serialize(state_buf, g_extern.state_size))
+         state_manager_push(g_extern.state_manager, state_buf);
+   }
+}
+
 static void init_rewind(void)
 {
    if (!g_settings.rewind_enable)
       return;
 
-   g_extern.state_size = pretro_serialize_size();
-   if (!g_extern.state_size)
+   size_t aligned_state_size = init_rewind_regions();
+   if (aligned_state_size)
    {
-      RARCH_ERR("Implementation does not support save states. Cannot use rewind.\n");
-      return;
+      RARCH_LOG("Implementation exposes its memory. Rewinding will diff %u regions in place.\n",
+            g_extern.num_state_regions - 1);
+      g_extern.state_size = aligned_state_size;
+   }
+   else
+   {
+      g_extern.state_size = pretro_serialize_size();
+      if (!g_extern.state_size)
+      {
+         RARCH_ERR("Implementation does not support save states. Cannot use rewind.\n");
+         return;
+      }
+
+      // Make sure we allocate at least 4-byte multiple.
+      aligned_state_size = (g_extern.state_size + 3) & ~3;
    }
 
-   // Make sure we allocate at least 4-byte multiple.
-   size_t aligned_state_size = (g_extern.state_size + 3) & ~3;
    g_extern.state_buf = calloc(1, aligned_state_size);
 
    if (!g_extern.state_buf)
@@ -1459,7 +1582,7 @@ static void init_rewind(void)
       return;
    }
 
-   if (!pretro_serialize(g_extern.state_buf, g_extern.state_size))
+   if (!rewind_serialize(g_extern.state_buf))
    {
       RARCH_ERR("Failed to perform initial serialization for rewind.\n");
       free(g_extern.state_buf);
@@ -1467,21 +1590,53 @@ static void init_rewind(void)
       return;
    }
 
+   if (g_extern.state_regions)
+      g_extern.state_regions[0].data = g_extern.state_buf;
+
    RARCH_LOG("Initing rewind buffer with size: %u MB\n", (unsigned)(g_settings.rewind_buffer_size / 1000000));
-   g_extern.state_manager = state_manager_new(aligned_state_size, g_settings.rewind_buffer_size, g_extern.state_buf);
+   g_extern.state_manager = state_manager_new(aligned_state_size, g_settings.rewind_buffer_size, g_extern.state_buf,
+         g_settings.rewind_compression, g_settings.rewind_keyframe_interval, g_settings.rewind_backing_file);
 
    if (!g_extern.state_manager)
+   {
       RARCH_WARN("Failed to init rewind buffer. Rewinding will be disabled.\n");
+      return;
+   }
+
+   if (g_settings.rewind_threaded && !state_manager_start_thread(g_extern.state_manager))
+      RARCH_WARN("Failed to start rewind thread. Rewind deltas will be generated on the main thread.\n");
+
+   g_extern.rewind_granularity = g_settings.rewind_granularity ? g_settings.rewind_granularity : 1;
+   g_extern.rewind_counter     = 0;
+   g_extern.rewind_last_frame  = 0;
+   g_extern.rewind_frame_time  = 0.0f;
+   g_extern.rewind_push_time   = 0.0f;
+
+   if (g_settings.rewind_budget > 0.0f)
+      RARCH_LOG("Adapting rewind granularity to a budget of %.1f%% of frame time.\n", g_settings.rewind_budget);
 }
 
 static void deinit_rewind(void)
 {
+#ifdef PERF_TEST
+   if (g_extern.state_manager && g_extern.rewind_frame_time > 0.0f)
+   {
+      RARCH_LOG("[PERF]: Rewind: granularity %u, avg push %.0f ticks, %.2f%% of frame time.\n",
+            g_extern.rewind_granularity, g_extern.rewind_push_time,
+            100.0f * g_extern.rewind_push_time / (g_extern.rewind_frame_time * g_extern.rewind_granularity));
+   }
+#endif
+
    if (g_extern.state_manager)
       state_manager_free(g_extern.state_manager);
    g_extern.state_manager = NULL;
 
    free(g_extern.state_buf);
    g_extern.state_buf = NULL;
+
+   free(g_extern.state_regions);
+   g_extern.state_regions = NULL;
+   g_extern.num_state_regions = 0;
 }
 
 #ifdef HAVE_BSV_MOVIE
@@ -1556,13 +1711,15 @@ static void init_netplay(void)
       RARCH_LOG("Connecting to netplay host...\n");
       g_extern.netplay_is_client = true;
    }
+   else if (g_settings.netplay_late_join && !g_extern.netplay_is_spectate)
+      RARCH_LOG("Hosting netplay, a client can join at any time...\n");
    else
       RARCH_LOG("Waiting for client...\n");
 
    g_extern.netplay = netplay_new(g_extern.netplay_is_client ? g_extern.netplay_server : NULL,
          g_extern.netplay_port ? g_extern.netplay_port : RARCH_DEFAULT_PORT,
          g_extern.netplay_sync_frames, &cbs, g_extern.netplay_is_spectate,
-         g_extern.netplay_nick);
+         g_extern.netplay_nick, g_settings.netplay_max_spectators);
 
    if (!g_extern.netplay)
    {
@@ -2052,6 +2209,57 @@ static inline void setup_rewind_audio(void)
    g_extern.audio_data.data_ptr = 0;
 }
 
+// Weight of new samples in the moving averages. Changes in cost take effect over a second or two.
+#define REWIND_BUDGET_WEIGHT (1.0f / 64.0f)
+#define REWIND_MAX_GRANULARITY 60
+
+static void update_rewind_frame_time(void)
+{
+   rarch_perf_tick_t now = rarch_get_perf_counter();
+   rarch_perf_tick_t last = g_extern.rewind_last_frame;
+   g_extern.rewind_last_frame = now;
+
+   if (!last || now <= last)
+      return;
+
+   // Ignore outliers, e.g. after being paused or loading a state.
+   float frame_time = (float)(now - last);
+   if (g_extern.rewind_frame_time <= 0.0f)
+      g_extern.rewind_frame_time = frame_time;
+   else if (frame_time < 8.0f * g_extern.rewind_frame_time)
+      g_extern.rewind_frame_time += (frame_time - g_extern.rewind_frame_time) * REWIND_BUDGET_WEIGHT;
+}
+
+// Capture just often enough that pushing states, amortized over the frames in between,
+// takes at most rewind_budget percent of frame time.
+static void update_rewind_granularity(rarch_perf_tick_t push_time)
+{
+   if (g_settings.rewind_budget <= 0.0f)
+      return;
+
+   if (g_extern.rewind_push_time <= 0.0f)
+      g_extern.rewind_push_time = (float)push_time;
+   else
+      g_extern.rewind_push_time += ((float)push_time - g_extern.rewind_push_time) * REWIND_BUDGET_WEIGHT;
+
+   float budget = g_extern.rewind_frame_time * g_settings.rewind_budget / 100.0f;
+   if (budget <= 0.0f)
+      return;
+
+   float frames = g_extern.rewind_push_time / budget;
+   unsigned granularity = frames >= REWIND_MAX_GRANULARITY ? REWIND_MAX_GRANULARITY : (unsigned)frames + 1;
+
+   if (granularity != g_extern.rewind_granularity)
+   {
+#ifdef PERF_TEST
+      RARCH_LOG("[PERF]: Rewind granularity %u -> %u (push %.0f ticks, frame %.0f ticks).\n",
+            g_extern.rewind_granularity, granularity, g_extern.rewind_push_time, g_extern.rewind_frame_time);
+#endif
+      g_extern.rewind_granularity = granularity;
+      g_extern.rewind_counter %= granularity;
+   }
+}
+
 static void check_rewind(void)
 {
    flush_rewind_audio();
@@ -2077,7 +2285,7 @@ static void check_rewind(void)
          setup_rewind_audio();
 
          msg_queue_push(g_extern.msg_queue, "Rewinding.", 0, g_extern.is_paused ? 1 : 30);
-         pretro_unserialize(buf, g_extern.state_size);
+         rewind_unserialize(buf);
 
 #ifdef HAVE_BSV_MOVIE
          if (g_extern.bsv.movie)
@@ -2086,19 +2294,27 @@ static void check_rewind(void)
       }
       else
          msg_queue_push(g_extern.msg_queue, "Reached end of rewind buffer.", 0, 30);
+
+      g_extern.rewind_last_frame = 0;
    }
    else
    {
-      static unsigned cnt = 0;
-      cnt = (cnt + 1) % (g_settings.rewind_granularity ? g_settings.rewind_granularity : 1); // Avoid possible SIGFPE.
+      if (g_settings.rewind_budget > 0.0f)
+         update_rewind_frame_time();
+
+      g_extern.rewind_counter = (g_extern.rewind_counter + 1) % g_extern.rewind_granularity;
 #ifdef HAVE_BSV_MOVIE
-      if (cnt == 0 || g_extern.bsv.movie)
+      if (g_extern.rewind_counter == 0 || g_extern.bsv.movie)
 #else
-      if (cnt == 0)
+      if (g_extern.rewind_counter == 0)
 #endif
       {
-         pretro_serialize(g_extern.state_buf, g_extern.state_size);
-         state_manager_push(g_extern.state_manager, g_extern.state_buf);
+         RARCH_PERFORMANCE_INIT(rewind_push);
+         RARCH_PERFORMANCE_START(rewind_push);
+         rarch_perf_tick_t start = rarch_get_perf_counter();
+         rewind_capture();
+         update_rewind_granularity(rarch_get_perf_counter() - start);
+         RARCH_PERFORMANCE_STOP(rewind_push);
       }
    }
 
@@ -2108,6 +2324,32 @@ static void check_rewind(void)
          audio_sample_batch_rewind : audio_sample_batch);
 }
 
+bool rarch_rewind_seek(unsigned states)
+{
+   if (!g_extern.state_manager)
+      return false;
+
+#ifdef HAVE_BSV_MOVIE
+   if (g_extern.bsv.movie)
+   {
+      RARCH_WARN("Cannot seek in rewind buffer while a movie is active.\n");
+      return false;
+   }
+#endif
+
+   void *buf;
+   if (!state_manager_seek(g_extern.state_manager, states, &buf))
+      return false;
+
+   rewind_unserialize(buf);
+
+   char msg[64];
+   snprintf(msg, sizeof(msg), "Rewound %u states.", states);
+   msg_queue_clear(g_extern.msg_queue);
+   msg_queue_push(g_extern.msg_queue, msg, 1, 60);
+   return true;
+}
+
 static void check_slowmotion(void)
 {
    g_extern.is_slowmotion = input_key_pressed_func(RARCH_SLOWMOTION);
@@ -2132,6 +2374,7 @@ static void movie_record_toggle(void)
    else
    {
       g_settings.rewind_granularity = 1;
+      g_extern.rewind_granularity = 1;
 
       char path[PATH_MAX];
       if (g_extern.state_slot > 0)
@@ -2592,6 +2835,7 @@ void rarch_main_clear_state(void)
 
    free(g_extern.system.environment);
    free(g_extern.system.environment_split);
+   free((void*)g_extern.system.mem_regions.regions);
 
    if (g_extern.log_file)
       fclose(g_extern.log_file);
@@ -20,47 +20,450 @@
 #include <string.h>
 #include <limits.h>
 #include "general.h"
+#include "performance.h"
+
+#ifdef HAVE_THREADS
+#include "thread.h"
+#endif
+
+#ifdef HAVE_MMAP
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_ZLIB
+#ifdef WANT_MINIZ
+#include "deps/miniz/zlib.h"
+#else
+#include <zlib.h>
+#endif
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define REWIND_SIMD_X86
+#define REWIND_TARGET(x) __attribute__((target(x)))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)) && !defined(_XBOX)
+#define REWIND_SIMD_X86
+#define REWIND_TARGET(x)
+#endif
+
+#ifdef REWIND_SIMD_X86
+#include <immintrin.h>
+#endif
+
+// A delta is stored as a number of spans, each laid out as [offset][len][len words of xor].
+// Unchanged runs shorter than this many words are folded into the surrounding span
+// as zero xor words, as it's cheaper than the span overhead.
+#define REWIND_SPAN_GAP 4
+#define REWIND_SPAN_OVERHEAD 2
+
+// Every delta is stored as one contiguous entry in the ring buffer. Entries never wrap
+// around the end of the buffer, and end with their size so we can walk backwards.
+// Every keyframe_interval states, an entry also carries a full copy of the state
+// the delta takes us back to, placed after the (4-byte aligned) delta.
+struct rewind_entry
+{
+   uint32_t size;       // Size of entry in bytes, including header and trailing size word.
+   uint32_t flags;
+   uint32_t delta_size; // Size of the delta as stored.
+   uint32_t raw_size;   // Size of the span encoded delta before compression.
+};
+
+#define REWIND_ENTRY_OVERHEAD (sizeof(struct rewind_entry) + sizeof(uint32_t))
+#define REWIND_ENTRY_COMPRESSED          (1 << 0)
+#define REWIND_ENTRY_KEYFRAME            (1 << 1)
+#define REWIND_ENTRY_KEYFRAME_COMPRESSED (1 << 2)
+
+#define REWIND_ALIGN(x) (((x) + 3) & ~(size_t)3)
+
+struct rewind_keyframe
+{
+   uint64_t frame;
+   size_t offset;
+};
+
+enum rewind_compression
+{
+   REWIND_COMPRESSION_NONE = 0,
+   REWIND_COMPRESSION_FAST,
+#ifdef HAVE_ZLIB
+   REWIND_COMPRESSION_ZLIB,
+#endif
+};
+
+typedef size_t (*find_change_t)(const uint32_t *old_state, const uint32_t *new_state, size_t i, size_t size);
 
 struct state_manager
 {
-   uint64_t *buffer;
-   size_t buf_size;
-   size_t buf_size_mask;
+   uint8_t *buffer;
+   size_t capacity;
+#ifdef HAVE_MMAP
+   int backing_fd; // Buffer is a shared mapping of this file if >= 0.
+#endif
+   size_t head;     // Where the next entry is written.
+   size_t tail;     // Oldest entry.
+   size_t wrap_end; // End of valid data if we have wrapped around.
+   size_t entries;
+   uint64_t frame;  // Number of the state in tmp_state. Entry N takes us from state N to N - 1.
+
+   // Keyframe entries currently in the buffer, oldest first, as a growable ring.
+   struct rewind_keyframe *keyframes;
+   size_t keyframes_first;
+   size_t keyframes_count;
+   size_t keyframes_size;
+   unsigned keyframe_interval;
+
    uint32_t *tmp_state;
-   size_t top_ptr;
-   size_t bottom_ptr;
    size_t state_size;
    bool first_pop;
+
+   enum rewind_compression compression;
+   uint32_t *delta;       // Scratch for compression, holds a span encoded delta.
+   uint8_t *packed;       // Scratch for compression, holds a compressed delta.
+   uint8_t *packed_key;   // Scratch for compression, holds a compressed keyframe.
+   size_t max_delta_size;
+   size_t max_packed_size;
+#ifdef HAVE_ZLIB
+   z_stream deflate;
+   z_stream inflate;
+   bool deflate_inited;
+   bool inflate_inited;
+#endif
+
+   find_change_t find_change;
+
+   // States are serialized straight into these, so a worker thread can diff one of them
+   // while the next one is being captured. Only allocated when threaded.
+   uint32_t *capture[2];
+   unsigned capture_index;
+
+#ifdef HAVE_THREADS
+   sthread_t *thread;
+   slock_t *lock;
+   scond_t *cond;
+   const uint32_t *pending; // State the worker thread should push, or NULL if idle.
+   bool alive;
+#endif
 };
 
-static inline size_t nearest_pow2_size(size_t v)
+// Returns index of the first word >= i which differs between the states, or size if none do.
+static size_t find_change_c(const uint32_t *old_state, const uint32_t *new_state, size_t i, size_t size)
+{
+   for (; i < size; i++)
+      if (old_state[i] != new_state[i])
+         return i;
+   return size;
+}
+
+#ifdef REWIND_SIMD_X86
+REWIND_TARGET("sse2")
+static size_t find_change_sse2(const uint32_t *old_state, const uint32_t *new_state, size_t i, size_t size)
+{
+   // Most of a save state is unchanged from frame to frame, so test 16 words at a time.
+   for (; i + 16 <= size; i += 16)
+   {
+      const __m128i *a = (const __m128i*)(old_state + i);
+      const __m128i *b = (const __m128i*)(new_state + i);
+      __m128i eq0 = _mm_cmpeq_epi32(_mm_loadu_si128(a + 0), _mm_loadu_si128(b + 0));
+      __m128i eq1 = _mm_cmpeq_epi32(_mm_loadu_si128(a + 1), _mm_loadu_si128(b + 1));
+      __m128i eq2 = _mm_cmpeq_epi32(_mm_loadu_si128(a + 2), _mm_loadu_si128(b + 2));
+      __m128i eq3 = _mm_cmpeq_epi32(_mm_loadu_si128(a + 3), _mm_loadu_si128(b + 3));
+      __m128i eq  = _mm_and_si128(_mm_and_si128(eq0, eq1), _mm_and_si128(eq2, eq3));
+
+      if (_mm_movemask_epi8(eq) != 0xffff)
+         break;
+   }
+
+   return find_change_c(old_state, new_state, i, size);
+}
+
+#if !defined(_MSC_VER) || _MSC_VER >= 1700
+#define REWIND_HAVE_AVX2
+REWIND_TARGET("avx2")
+static size_t find_change_avx2(const uint32_t *old_state, const uint32_t *new_state, size_t i, size_t size)
 {
-   size_t orig = v;
-   v--;
-   v |= v >> 1;
-   v |= v >> 2;
-   v |= v >> 4;
-#if SIZE_MAX >= UINT16_C(0xffff)
-      v |= v >> 8;
+   for (; i + 32 <= size; i += 32)
+   {
+      const __m256i *a = (const __m256i*)(old_state + i);
+      const __m256i *b = (const __m256i*)(new_state + i);
+      __m256i eq0 = _mm256_cmpeq_epi32(_mm256_loadu_si256(a + 0), _mm256_loadu_si256(b + 0));
+      __m256i eq1 = _mm256_cmpeq_epi32(_mm256_loadu_si256(a + 1), _mm256_loadu_si256(b + 1));
+      __m256i eq2 = _mm256_cmpeq_epi32(_mm256_loadu_si256(a + 2), _mm256_loadu_si256(b + 2));
+      __m256i eq3 = _mm256_cmpeq_epi32(_mm256_loadu_si256(a + 3), _mm256_loadu_si256(b + 3));
+      __m256i eq  = _mm256_and_si256(_mm256_and_si256(eq0, eq1), _mm256_and_si256(eq2, eq3));
+
+      if (_mm256_movemask_epi8(eq) != -1)
+         break;
+   }
+
+   return find_change_c(old_state, new_state, i, size);
+}
+#endif
 #endif
-#if SIZE_MAX >= UINT32_C(0xffffffff)
-      v |= v >> 16;
+
+// Returns the end of the changed span starting at i.
+// The span ends once REWIND_SPAN_GAP consecutive words are unchanged.
+static size_t find_span_end(const uint32_t *old_state, const uint32_t *new_state, size_t i, size_t size)
+{
+   size_t same = 0;
+   for (i++; i < size; i++)
+   {
+      if (old_state[i] != new_state[i])
+         same = 0;
+      else if (++same == REWIND_SPAN_GAP)
+         return i + 1 - REWIND_SPAN_GAP;
+   }
+
+   return size - same;
+}
+
+static find_change_t find_change_func(void)
+{
+#ifdef REWIND_SIMD_X86
+   struct rarch_cpu_features cpu;
+   rarch_get_cpu_features(&cpu);
+
+#ifdef REWIND_HAVE_AVX2
+   if (cpu.simd & RARCH_SIMD_AVX2)
+   {
+      RARCH_LOG("[Rewind]: Using AVX2 delta generation.\n");
+      return find_change_avx2;
+   }
 #endif
-#if SIZE_MAX >= UINT64_C(0xffffffffffffffff)
-      v |= v >> 32;
+   if (cpu.simd & RARCH_SIMD_SSE2)
+   {
+      RARCH_LOG("[Rewind]: Using SSE2 delta generation.\n");
+      return find_change_sse2;
+   }
 #endif
-   v++;
 
-   size_t next = v;
-   size_t prev = v >> 1;
+   return find_change_c;
+}
+
+// The "fast" codec. Xor deltas of save states are full of zero bytes, even inside changed spans.
+// Every group of 8 bytes is stored as a mask of non-zero bytes, followed by the non-zero bytes.
+// Gives up and returns size if the output would not be any smaller than the input.
+static size_t pack_zero_bytes(uint8_t *out, const uint8_t *in, size_t size)
+{
+   uint8_t *start = out;
+
+   for (size_t i = 0; i < size; i += 8)
+   {
+      if ((size_t)(out - start) + 9 > size)
+         return size;
+
+      size_t len = size - i < 8 ? size - i : 8;
+      uint8_t *mask = out++;
+      *mask = 0;
 
-   if ((next - orig) < (orig - prev))
-      return next;
+      for (size_t j = 0; j < len; j++)
+      {
+         uint8_t c = in[i + j];
+         *out = c;
+         out += c != 0;
+         *mask |= (c != 0) << j;
+      }
+   }
+
+   return out - start;
+}
+
+static void unpack_zero_bytes(uint8_t *out, const uint8_t *in, size_t size)
+{
+   for (size_t i = 0; i < size; i += 8)
+   {
+      size_t len = size - i < 8 ? size - i : 8;
+      unsigned mask = *in++;
+
+      for (size_t j = 0; j < len; j++)
+         out[i + j] = (mask & (1 << j)) ? *in++ : 0;
+   }
+}
+
+static bool compression_init(state_manager_t *state, const char *ident)
+{
+   state->compression = REWIND_COMPRESSION_NONE;
+   if (!ident || !*ident || !strcmp(ident, "none"))
+      return true;
+
+   if (!strcmp(ident, "fast"))
+   {
+      state->compression = REWIND_COMPRESSION_FAST;
+      state->max_packed_size = state->max_delta_size;
+   }
+#ifdef HAVE_ZLIB
+   else if (!strcmp(ident, "zlib"))
+   {
+      state->compression = REWIND_COMPRESSION_ZLIB;
+
+      if (deflateInit(&state->deflate, Z_BEST_SPEED) != Z_OK)
+         return false;
+      state->deflate_inited = true;
+      if (inflateInit(&state->inflate) != Z_OK)
+         return false;
+      state->inflate_inited = true;
+
+      state->max_packed_size = deflateBound(&state->deflate, state->max_delta_size);
+   }
+#endif
    else
-      return prev;
+   {
+      RARCH_WARN("[Rewind]: Unknown compression \"%s\". Rewind buffer will not be compressed.\n", ident);
+      return true;
+   }
+
+   RARCH_LOG("[Rewind]: Using \"%s\" compression.\n", ident);
+
+   state->delta  = (uint32_t*)malloc(state->max_delta_size);
+   state->packed = (uint8_t*)malloc(state->max_packed_size);
+   if (state->keyframe_interval)
+      state->packed_key = (uint8_t*)malloc(state->max_packed_size);
+
+   return state->delta && state->packed && (!state->keyframe_interval || state->packed_key);
+}
+
+// Compresses a delta or keyframe into out, which holds max_packed_size bytes.
+// Returns size of compressed data, or 0 if the data is better off stored as is.
+static size_t compress_data(state_manager_t *state, uint8_t *out, const void *data, size_t size)
+{
+   size_t packed_size = 0;
+
+   RARCH_PERFORMANCE_INIT(rewind_compress);
+   RARCH_PERFORMANCE_START(rewind_compress);
+
+   switch (state->compression)
+   {
+      case REWIND_COMPRESSION_FAST:
+         packed_size = pack_zero_bytes(out, (const uint8_t*)data, size);
+         break;
+
+#ifdef HAVE_ZLIB
+      case REWIND_COMPRESSION_ZLIB:
+         deflateReset(&state->deflate);
+         state->deflate.next_in   = (Bytef*)data;
+         state->deflate.avail_in  = size;
+         state->deflate.next_out  = out;
+         state->deflate.avail_out = state->max_packed_size;
+         if (deflate(&state->deflate, Z_FINISH) == Z_STREAM_END)
+            packed_size = state->deflate.total_out;
+         break;
+#endif
+
+      default:
+         break;
+   }
+
+   RARCH_PERFORMANCE_STOP(rewind_compress);
+
+   return packed_size < size ? packed_size : 0;
+}
+
+static bool decompress_data(state_manager_t *state, void *out, const uint8_t *data, size_t size, size_t raw_size)
+{
+   bool ret = true;
+
+   RARCH_PERFORMANCE_INIT(rewind_decompress);
+   RARCH_PERFORMANCE_START(rewind_decompress);
+
+   switch (state->compression)
+   {
+      case REWIND_COMPRESSION_FAST:
+         unpack_zero_bytes((uint8_t*)out, data, raw_size);
+         break;
+
+#ifdef HAVE_ZLIB
+      case REWIND_COMPRESSION_ZLIB:
+         inflateReset(&state->inflate);
+         state->inflate.next_in   = (Bytef*)data;
+         state->inflate.avail_in  = size;
+         state->inflate.next_out  = (Bytef*)out;
+         state->inflate.avail_out = raw_size;
+         ret = inflate(&state->inflate, Z_FINISH) == Z_STREAM_END;
+         break;
+#endif
+
+      default:
+         ret = false;
+         break;
+   }
+
+   RARCH_PERFORMANCE_STOP(rewind_decompress);
+
+   return ret;
+}
+
+#ifdef HAVE_MMAP
+// Maps the ring buffer from a file, so the OS can page out old history instead of it
+// taking up RAM. Recently written entries stay in the page cache, so pushes cost the same.
+static bool buffer_map(state_manager_t *state, const char *path)
+{
+   int fd = open(path, O_RDWR | O_CREAT, 0600);
+   if (fd < 0)
+   {
+      RARCH_ERR("[Rewind]: Cannot open backing file \"%s\".\n", path);
+      return false;
+   }
+
+   // Truncate first so stale contents are never read back in from disk, the file is sparse until written.
+   if (ftruncate(fd, 0) < 0 || ftruncate(fd, state->capacity) < 0)
+   {
+      RARCH_ERR("[Rewind]: Cannot resize backing file \"%s\".\n", path);
+      close(fd);
+      return false;
+   }
+
+   void *ptr = mmap(NULL, state->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if (ptr == MAP_FAILED)
+   {
+      RARCH_ERR("[Rewind]: Cannot map backing file \"%s\".\n", path);
+      close(fd);
+      return false;
+   }
+
+   RARCH_LOG("[Rewind]: Backing rewind buffer with \"%s\".\n", path);
+   state->buffer = (uint8_t*)ptr;
+   state->backing_fd = fd;
+   return true;
+}
+#endif
+
+static bool buffer_alloc(state_manager_t *state, const char *backing_file)
+{
+#ifdef HAVE_MMAP
+   state->backing_fd = -1;
+   if (backing_file && *backing_file)
+      return buffer_map(state, backing_file);
+#else
+   if (backing_file && *backing_file)
+      RARCH_WARN("[Rewind]: Backing files are not supported on this platform, using RAM.\n");
+#endif
+
+   state->buffer = (uint8_t*)malloc(state->capacity);
+   return state->buffer;
+}
+
+static void buffer_free(state_manager_t *state)
+{
+#ifdef HAVE_MMAP
+   if (state->backing_fd >= 0)
+   {
+      if (state->buffer)
+         munmap(state->buffer, state->capacity);
+      // History is useless once we exit, don't leave it taking up disk space.
+      if (ftruncate(state->backing_fd, 0) < 0)
+         RARCH_WARN("[Rewind]: Failed to truncate backing file.\n");
+      close(state->backing_fd);
+      return;
+   }
+#endif
+
+   free(state->buffer);
 }
 
-state_manager_t *state_manager_new(size_t state_size, size_t buffer_size, void *init_buffer)
+state_manager_t *state_manager_new(size_t state_size, size_t buffer_size, void *init_buffer,
+      const char *compression, unsigned keyframe_interval, const char *backing_file)
 {
    if (buffer_size <= state_size * 4) // Need a sufficient buffer size.
       return NULL;
@@ -71,41 +474,248 @@ state_manager_t *state_manager_new(size_t state_size, size_t buffer_size, void *
 
    // We need 4-byte aligned state_size to avoid having to enforce this with unneeded memcpy's!
    rarch_assert(state_size % 4 == 0);
-   state->top_ptr = 1;
 
    state->state_size = state_size / sizeof(uint32_t); // Works in multiple of 4.
-   state->buf_size = nearest_pow2_size(buffer_size) / sizeof(uint64_t); // Works in multiple of 8.
-   state->buf_size_mask = state->buf_size - 1;
-   RARCH_LOG("Readjusted rewind buffer size to %u MiB\n", (unsigned)(sizeof(uint64_t) * (state->buf_size >> 20)));
 
-   if (!(state->buffer = (uint64_t*)calloc(1, state->buf_size * sizeof(uint64_t))))
+   // Entries are 4-byte aligned. Apart from that, we use the buffer size as is.
+   state->capacity = buffer_size & ~(size_t)3;
+   state->wrap_end = state->capacity;
+
+   // Spans are separated by at least REWIND_SPAN_GAP unchanged words, so a delta can never
+   // be larger than the state itself plus the overhead of a single span.
+   state->max_delta_size = state_size + REWIND_SPAN_OVERHEAD * sizeof(uint32_t);
+
+   state->keyframe_interval = keyframe_interval;
+   if (keyframe_interval)
+      RARCH_LOG("[Rewind]: Storing a keyframe every %u states.\n", keyframe_interval);
+
+   if (!buffer_alloc(state, backing_file))
       goto error;
    if (!(state->tmp_state = (uint32_t*)calloc(1, state->state_size * sizeof(uint32_t))))
       goto error;
+   if (!compression_init(state, compression))
+      goto error;
 
    memcpy(state->tmp_state, init_buffer, state_size);
+   state->find_change = find_change_func();
 
    return state;
 
 error:
    if (state)
-   {
-      free(state->buffer);
-      free(state->tmp_state);
-      free(state);
-   }
+      state_manager_free(state);
    return NULL;
 }
 
 void state_manager_free(state_manager_t *state)
 {
-   free(state->buffer);
+#ifdef HAVE_THREADS
+   if (state->thread)
+   {
+      slock_lock(state->lock);
+      state->alive = false;
+      scond_signal(state->cond);
+      slock_unlock(state->lock);
+      sthread_join(state->thread);
+   }
+
+   if (state->lock)
+      slock_free(state->lock);
+   if (state->cond)
+      scond_free(state->cond);
+#endif
+
+#ifdef HAVE_ZLIB
+   if (state->deflate_inited)
+      deflateEnd(&state->deflate);
+   if (state->inflate_inited)
+      inflateEnd(&state->inflate);
+#endif
+
+   buffer_free(state);
    free(state->tmp_state);
+   free(state->keyframes);
+   free(state->delta);
+   free(state->packed);
+   free(state->packed_key);
+   free(state->capture[0]);
+   free(state->capture[1]);
    free(state);
 }
 
+void *state_manager_get_capture_buffer(state_manager_t *state)
+{
+#ifdef HAVE_THREADS
+   if (state->thread)
+      return state->capture[state->capture_index];
+#else
+   (void)state;
+#endif
+   return NULL;
+}
+
+static inline struct rewind_keyframe *keyframe_at(state_manager_t *state, size_t index)
+{
+   return &state->keyframes[(state->keyframes_first + index) % state->keyframes_size];
+}
+
+static bool keyframe_push(state_manager_t *state, uint64_t frame, size_t offset)
+{
+   if (state->keyframes_count == state->keyframes_size)
+   {
+      size_t new_size = state->keyframes_size ? state->keyframes_size * 2 : 16;
+      struct rewind_keyframe *keyframes = (struct rewind_keyframe*)malloc(new_size * sizeof(*keyframes));
+      if (!keyframes)
+         return false;
+
+      for (size_t i = 0; i < state->keyframes_count; i++)
+         keyframes[i] = *keyframe_at(state, i);
+
+      free(state->keyframes);
+      state->keyframes       = keyframes;
+      state->keyframes_size  = new_size;
+      state->keyframes_first = 0;
+   }
+
+   struct rewind_keyframe *keyframe = keyframe_at(state, state->keyframes_count++);
+   keyframe->frame  = frame;
+   keyframe->offset = offset;
+   return true;
+}
+
+static inline struct rewind_entry *entry_at(state_manager_t *state, size_t offset)
+{
+   return (struct rewind_entry*)(state->buffer + offset);
+}
+
+// Returns offset of the entry which ends at end.
+static inline size_t entry_before(state_manager_t *state, size_t end)
+{
+   if (!end)
+      end = state->wrap_end;
+   return end - *(const uint32_t*)(state->buffer + end - sizeof(uint32_t));
+}
+
+static inline size_t entry_after(state_manager_t *state, size_t offset)
+{
+   offset += entry_at(state, offset)->size;
+   return offset >= state->wrap_end ? 0 : offset;
+}
+
+// Discards every entry from offset and onwards.
+static void truncate_entries(state_manager_t *state, size_t offset, size_t entries)
+{
+   state->head    = offset;
+   state->entries = entries;
+
+   if (!entries)
+   {
+      state->head = state->tail = 0;
+      state->wrap_end = state->capacity;
+   }
+   else if (state->head > state->tail) // Everything we wrapped around with is gone.
+      state->wrap_end = state->capacity;
+
+   while (state->keyframes_count && keyframe_at(state, state->keyframes_count - 1)->frame > state->frame)
+      state->keyframes_count--;
+}
+
+static void xor_spans(uint32_t *state, const uint32_t *delta, size_t size)
+{
+   const uint32_t *end = delta + size / sizeof(uint32_t);
+
+   while (delta < end)
+   {
+      uint32_t *out = state + delta[0];
+      uint32_t len  = delta[1];
+      delta += REWIND_SPAN_OVERHEAD;
+
+      // Apply the xor patch.
+      for (uint32_t i = 0; i < len; i++)
+         out[i] ^= delta[i];
+
+      delta += len;
+   }
+}
+
+static inline void apply_delta(state_manager_t *state, const uint32_t *delta, size_t size)
+{
+   xor_spans(state->tmp_state, delta, size);
+}
+
+// Xor deltas work both ways, so this takes us from state N to N - 1 as well as from N - 1 to N.
+static bool apply_entry(state_manager_t *state, const struct rewind_entry *entry)
+{
+   const uint8_t *payload = (const uint8_t*)(entry + 1);
+
+   if (entry->flags & REWIND_ENTRY_COMPRESSED)
+   {
+      if (!decompress_data(state, state->delta, payload, entry->delta_size, entry->raw_size))
+      {
+         RARCH_ERR("[Rewind]: Failed to decompress delta.\n");
+         return false;
+      }
+      apply_delta(state, state->delta, entry->raw_size);
+   }
+   else
+      apply_delta(state, (const uint32_t*)payload, entry->raw_size);
+
+   return true;
+}
+
+static bool load_keyframe(state_manager_t *state, const struct rewind_entry *entry)
+{
+   size_t state_bytes     = state->state_size * sizeof(uint32_t);
+   size_t key_offset      = REWIND_ALIGN(entry->delta_size);
+   const uint8_t *key     = (const uint8_t*)(entry + 1) + key_offset;
+
+   if (!(entry->flags & REWIND_ENTRY_KEYFRAME_COMPRESSED))
+   {
+      memcpy(state->tmp_state, key, state_bytes);
+      return true;
+   }
+
+   if (!decompress_data(state, state->tmp_state, key,
+            entry->size - REWIND_ENTRY_OVERHEAD - key_offset, state_bytes))
+   {
+      RARCH_ERR("[Rewind]: Failed to decompress keyframe.\n");
+      return false;
+   }
+
+   return true;
+}
+
+static void drain_thread(state_manager_t *state)
+{
+#ifdef HAVE_THREADS
+   if (!state->thread)
+      return;
+
+   slock_lock(state->lock);
+   while (state->pending)
+      scond_wait(state->cond, state->lock);
+   slock_unlock(state->lock);
+#else
+   (void)state;
+#endif
+}
+
+static bool pop_entry(state_manager_t *state)
+{
+   size_t offset = entry_before(state, state->head);
+   if (!apply_entry(state, entry_at(state, offset)))
+      return false;
+
+   state->frame--;
+   truncate_entries(state, offset, state->entries - 1);
+   return true;
+}
+
 bool state_manager_pop(state_manager_t *state, void **data)
 { 
+   // Make sure every state we have captured is in the buffer before going backwards.
+   drain_thread(state);
+
    *data = state->tmp_state;
    if (state->first_pop)
    {
@@ -113,81 +723,425 @@ bool state_manager_pop(state_manager_t *state, void **data)
       return true;
    }
 
-   state->top_ptr = (state->top_ptr - 1) & state->buf_size_mask;
+   if (!state->entries) // Our stack is completely empty... :v
+      return false;
+
+   return pop_entry(state);
+}
 
-   if (state->top_ptr == state->bottom_ptr) // Our stack is completely empty... :v
+// Finds the keyframe which gets us to target with the least amount of deltas applied.
+// Returns false if walking back from the current state is just as cheap.
+static bool find_keyframe(state_manager_t *state, uint64_t target, size_t *index, uint64_t *cost)
+{
+   // Keyframe N holds state N - 1. Find the first one past target.
+   size_t lo = 0, hi = state->keyframes_count;
+   while (lo < hi)
    {
-      state->top_ptr = (state->top_ptr + 1) & state->buf_size_mask;
-      return false;
+      size_t mid = (lo + hi) / 2;
+      if (keyframe_at(state, mid)->frame - 1 > target)
+         hi = mid;
+      else
+         lo = mid + 1;
    }
 
-   while (state->buffer[state->top_ptr])
+   // Loading the keyframe itself is about as expensive as a delta.
+   bool found = false;
+   if (lo < state->keyframes_count)
    {
-      // Apply the xor patch.
-      uint32_t addr = state->buffer[state->top_ptr] >> 32;
-      uint32_t xor_ = state->buffer[state->top_ptr] & 0xFFFFFFFFU;
-      state->tmp_state[addr] ^= xor_;
+      uint64_t key_cost = keyframe_at(state, lo)->frame - target;
+      if (key_cost < *cost)
+      {
+         *cost  = key_cost;
+         *index = lo;
+         found  = true;
+      }
+   }
 
-      state->top_ptr = (state->top_ptr - 1) & state->buf_size_mask;
+   if (lo > 0)
+   {
+      uint64_t key_cost = target - keyframe_at(state, lo - 1)->frame + 2;
+      if (key_cost < *cost)
+      {
+         *cost  = key_cost;
+         *index = lo - 1;
+         found  = true;
+      }
    }
 
-   if (state->top_ptr == state->bottom_ptr) // Our stack is completely empty... :v
+   return found;
+}
+
+bool state_manager_seek(state_manager_t *state, unsigned frames_back, void **data)
+{
+   drain_thread(state);
+
+   *data = state->tmp_state;
+   state->first_pop = false;
+
+   if (frames_back > state->entries)
+      frames_back = state->entries;
+   if (!frames_back)
+      return state->entries > 0;
+
+   RARCH_PERFORMANCE_INIT(rewind_seek);
+   RARCH_PERFORMANCE_START(rewind_seek);
+
+   bool ret = true;
+   uint64_t target = state->frame - frames_back;
+   uint64_t cost   = frames_back;
+   size_t index    = 0;
+
+   if (find_keyframe(state, target, &index, &cost))
    {
-      state->top_ptr = (state->top_ptr + 1) & state->buf_size_mask;
-      return true;
+      struct rewind_keyframe keyframe = *keyframe_at(state, index);
+      const struct rewind_entry *entry = entry_at(state, keyframe.offset);
+
+      ret = load_keyframe(state, entry);
+
+      if (keyframe.frame - 1 > target)
+      {
+         // Throw away everything newer than the keyframe, and walk backwards from it.
+         size_t entries = state->entries - (size_t)(state->frame - keyframe.frame + 1);
+         state->frame = keyframe.frame - 1;
+         truncate_entries(state, keyframe.offset, entries);
+
+         while (ret && state->frame > target)
+            ret = pop_entry(state);
+      }
+      else
+      {
+         // Walk forwards from the keyframe, and throw away everything newer than target.
+         size_t offset = keyframe.offset;
+         for (uint64_t frame = keyframe.frame; ret && frame <= target; frame++)
+         {
+            ret = apply_entry(state, entry_at(state, offset));
+            offset = entry_after(state, offset);
+         }
+
+         state->frame = target;
+         truncate_entries(state, offset, state->entries - frames_back);
+      }
+   }
+   else
+   {
+      while (ret && state->frame > target)
+         ret = pop_entry(state);
    }
 
-   return true;
+   RARCH_PERFORMANCE_STOP(rewind_seek);
+   RARCH_LOG("[Rewind]: Seeked back %u states at the cost of %u deltas.\n", frames_back, (unsigned)cost);
+
+   return ret;
+}
+
+// Drops the oldest delta in the buffer.
+static void drop_tail(state_manager_t *state)
+{
+   const struct rewind_entry *entry = entry_at(state, state->tail);
+   if (entry->flags & REWIND_ENTRY_KEYFRAME)
+   {
+      state->keyframes_first = (state->keyframes_first + 1) % state->keyframes_size;
+      state->keyframes_count--;
+   }
+
+   state->tail += entry->size;
+   state->entries--;
+
+   if (state->tail >= state->wrap_end)
+   {
+      state->tail = 0;
+      state->wrap_end = state->capacity;
+   }
 }
 
-static void reassign_bottom(state_manager_t *state)
+// Makes room for a contiguous entry of size bytes at head, dropping old deltas as necessary.
+static void reserve_entry(state_manager_t *state, size_t size)
 {
-   state->bottom_ptr = (state->top_ptr + 1) & state->buf_size_mask;
-   while (state->buffer[state->bottom_ptr]) // Skip ahead until we find the first 0 (boundary for state delta).
-      state->bottom_ptr = (state->bottom_ptr + 1) & state->buf_size_mask;
+   for (;;)
+   {
+      if (!state->entries)
+      {
+         state->head = state->tail = 0;
+         state->wrap_end = state->capacity;
+         return;
+      }
+
+      if (state->tail < state->head)
+      {
+         // Valid data is [tail, head). Use the rest of the buffer, or wrap around.
+         if (state->head + size <= state->capacity)
+            return;
+
+         state->wrap_end = state->head;
+         state->head = 0;
+      }
+      else if (state->head + size <= state->tail)
+         return; // Valid data is [tail, wrap_end) and [0, head).
+      else
+         drop_tail(state);
+   }
 }
 
-static void generate_delta(state_manager_t *state, const void *data)
+// Encodes the xor of every changed span with its offset and length.
+// This can be reversed by reapplying the xor.
+// This, if states don't really differ much, we'll save lots of space :)
+// Spans where new_state differs from old_state are appended to out, offset by base words.
+// *last is the header of the span written last, or NULL.
+static uint32_t *encode_spans(find_change_t find_change, uint32_t *out, uint32_t **last,
+      const uint32_t *old_state, const uint32_t *new_state, size_t base, size_t size)
 {
-   bool crossed = false;
-   const uint32_t *old_state = state->tmp_state;
-   const uint32_t *new_state = (const uint32_t*)data;
+   for (size_t i = find_change(old_state, new_state, 0, size); i < size;
+         i = find_change(old_state, new_state, i, size))
+   {
+      size_t end = find_span_end(old_state, new_state, i, size);
+      uint32_t len = end - i;
+      uint32_t *span = *last;
+      size_t gap = span ? base + i - (span[0] + span[1]) : REWIND_SPAN_GAP;
+
+      if (gap < REWIND_SPAN_GAP)
+      {
+         // Only happens right after a region boundary. Fold the unchanged words
+         // in like find_span_end() does, so the delta stays within max_delta_size.
+         for (size_t j = 0; j < gap; j++)
+            *out++ = 0;
+         span[1] += gap + len;
+      }
+      else
+      {
+         *last  = out;
+         *out++ = base + i;
+         *out++ = len;
+      }
 
-   state->buffer[state->top_ptr++] = 0; // For each separate delta, we have a 0 value sentinel in between.
-   state->top_ptr &= state->buf_size_mask;
+      for (uint32_t j = 0; j < len; j++)
+         out[j] = old_state[i + j] ^ new_state[i + j];
+      out += len;
 
-   // Check if top_ptr and bottom_ptr crossed each other, which means we need to delete old cruft.
-   if (state->top_ptr == state->bottom_ptr)
-      crossed = true;
+      i = end;
+   }
+
+   return out;
+}
 
-   for (uint64_t i = 0; i < state->state_size; i++)
+// The regions make up the new state back to back. Spans are joined across region boundaries,
+// so the delta is no larger than for the state in one piece. Returns size of delta in bytes.
+static size_t generate_delta(state_manager_t *state, uint32_t *out,
+      const struct state_manager_region *regions, unsigned num_regions)
+{
+   uint32_t *start = out;
+   uint32_t *last = NULL;
+   size_t base = 0;
+
+   for (unsigned i = 0; i < num_regions; i++)
+   {
+      size_t size = regions[i].size / sizeof(uint32_t);
+      out = encode_spans(state->find_change, out, &last,
+            state->tmp_state + base, (const uint32_t*)regions[i].data, base, size);
+      base += size;
+   }
+
+   return (out - start) * sizeof(uint32_t);
+}
+
+static void push_state(state_manager_t *state, const struct state_manager_region *regions, unsigned num_regions)
+{
+   size_t state_bytes = state->state_size * sizeof(uint32_t);
+   bool keyframe = state->keyframe_interval && (state->frame + 1) % state->keyframe_interval == 0;
+   size_t key_size = keyframe ? state_bytes : 0;
+   uint32_t flags = keyframe ? REWIND_ENTRY_KEYFRAME : 0;
+   struct rewind_entry *entry;
+   const uint32_t *raw;
+   size_t raw_size, delta_size;
+
+   if (state->compression == REWIND_COMPRESSION_NONE)
    {
-      uint64_t xor_ = old_state[i] ^ new_state[i];
+      // Encode straight into the ring buffer.
+      reserve_entry(state, REWIND_ENTRY_OVERHEAD + state->max_delta_size + key_size);
+      entry      = entry_at(state, state->head);
+      raw        = (const uint32_t*)(entry + 1);
+      raw_size   = generate_delta(state, (uint32_t*)raw, regions, num_regions);
+      delta_size = raw_size;
 
-      // If the data differs (xor != 0), we push that xor on the stack with index and xor.
-      // This can be reversed by reapplying the xor.
-      // This, if states don't really differ much, we'll save lots of space :)
-      // Hopefully this will work really well with save states.
-      if (xor_)
+      if (keyframe)
+         memcpy((uint8_t*)(entry + 1) + REWIND_ALIGN(delta_size), state->tmp_state, key_size);
+   }
+   else
+   {
+      const void *delta = state->delta;
+      const void *key   = state->tmp_state;
+
+      raw        = state->delta;
+      raw_size   = generate_delta(state, state->delta, regions, num_regions);
+      delta_size = compress_data(state, state->packed, state->delta, raw_size);
+      if (delta_size)
       {
-         state->buffer[state->top_ptr] = (i << 32) | xor_;
-         state->top_ptr = (state->top_ptr + 1) & state->buf_size_mask;
+         delta  = state->packed;
+         flags |= REWIND_ENTRY_COMPRESSED;
+      }
+      else
+         delta_size = raw_size;
 
-         if (state->top_ptr == state->bottom_ptr)
-            crossed = true;
+      if (keyframe)
+      {
+         size_t packed_size = compress_data(state, state->packed_key, state->tmp_state, state_bytes);
+         if (packed_size)
+         {
+            key      = state->packed_key;
+            key_size = packed_size;
+            flags   |= REWIND_ENTRY_KEYFRAME_COMPRESSED;
+         }
       }
+
+      reserve_entry(state, REWIND_ENTRY_OVERHEAD + REWIND_ALIGN(delta_size) + REWIND_ALIGN(key_size));
+      entry = entry_at(state, state->head);
+      memcpy(entry + 1, delta, delta_size);
+      if (keyframe)
+         memcpy((uint8_t*)(entry + 1) + REWIND_ALIGN(delta_size), key, key_size);
+   }
+
+   size_t size = REWIND_ENTRY_OVERHEAD + REWIND_ALIGN(delta_size) + REWIND_ALIGN(key_size);
+   entry->size       = size;
+   entry->flags      = flags;
+   entry->delta_size = delta_size;
+   entry->raw_size   = raw_size;
+   *(uint32_t*)(state->buffer + state->head + size - sizeof(uint32_t)) = size;
+
+   state->frame++;
+   if (keyframe && !keyframe_push(state, state->frame, state->head))
+      entry->flags &= ~REWIND_ENTRY_KEYFRAME;
+
+   state->head += size;
+   state->entries++;
+
+   // Bring tmp_state up to date by patching only what changed, rather than copying the whole state.
+   apply_delta(state, raw, raw_size);
+   state->first_pop = true;
+}
+
+#ifdef HAVE_THREADS
+static void rewind_thread_loop(void *data)
+{
+   state_manager_t *state = (state_manager_t*)data;
+
+   slock_lock(state->lock);
+   for (;;)
+   {
+      while (state->alive && !state->pending)
+         scond_wait(state->cond, state->lock);
+
+      if (!state->alive)
+         break;
+
+      const uint32_t *pending = state->pending;
+      slock_unlock(state->lock);
+
+      RARCH_PERFORMANCE_INIT(rewind_thread_push);
+      RARCH_PERFORMANCE_START(rewind_thread_push);
+      struct state_manager_region region = { pending, state->state_size * sizeof(uint32_t) };
+      push_state(state, &region, 1);
+      RARCH_PERFORMANCE_STOP(rewind_thread_push);
+
+      slock_lock(state->lock);
+      state->pending = NULL;
+      scond_signal(state->cond);
+   }
+   slock_unlock(state->lock);
+}
+#endif
+
+bool state_manager_start_thread(state_manager_t *state)
+{
+#ifdef HAVE_THREADS
+   if (state->thread)
+      return true;
+
+   for (unsigned i = 0; i < 2; i++)
+   {
+      if (!(state->capture[i] = (uint32_t*)calloc(1, state->state_size * sizeof(uint32_t))))
+         return false;
+   }
+
+   state->lock  = slock_new();
+   state->cond  = scond_new();
+   state->alive = true;
+   if (!state->lock || !state->cond)
+      return false;
+
+   if (!(state->thread = sthread_create(rewind_thread_loop, state)))
+   {
+      state->alive = false;
+      return false;
    }
 
-   if (crossed)
-      reassign_bottom(state);
+   RARCH_LOG("[Rewind]: Generating deltas on a worker thread.\n");
+   return true;
+#else
+   (void)state;
+   return false;
+#endif
 }
 
 bool state_manager_push(state_manager_t *state, const void *data)
 {
-   generate_delta(state, data);
-   memcpy(state->tmp_state, data, state->state_size * sizeof(uint32_t));
-   state->first_pop = true;
+#ifdef HAVE_THREADS
+   if (state->thread)
+   {
+      // Only one state is diffed at a time, so wait for the previous one to complete.
+      // data is left untouched by the frontend until then, as it captures into the other buffer.
+      slock_lock(state->lock);
+      while (state->pending)
+         scond_wait(state->cond, state->lock);
+      state->pending = (const uint32_t*)data;
+      scond_signal(state->cond);
+      slock_unlock(state->lock);
+
+      // The next state is captured into the buffer which isn't being diffed.
+      if (data == state->capture[state->capture_index])
+         state->capture_index ^= 1;
+      return true;
+   }
+#endif
 
+   struct state_manager_region region = { data, state->state_size * sizeof(uint32_t) };
+   push_state(state, &region, 1);
    return true;
 }
 
+bool state_manager_push_regions(state_manager_t *state, const struct state_manager_region *regions, unsigned num_regions)
+{
+   size_t total = 0;
+   for (unsigned i = 0; i < num_regions; i++)
+   {
+      rarch_assert(regions[i].size % 4 == 0);
+      total += regions[i].size;
+   }
+   if (total != state->state_size * sizeof(uint32_t))
+      return false;
+
+   // The regions are live memory which will change as soon as we return, so they can't be handed off to the worker.
+   drain_thread(state);
+   push_state(state, regions, num_regions);
+   return true;
+}
+
+size_t state_delta_max_size(size_t state_size)
+{
+   return state_size + REWIND_SPAN_OVERHEAD * sizeof(uint32_t);
+}
+
+size_t state_delta_generate(void *delta, const void *old_state, const void *new_state, size_t state_size)
+{
+   static find_change_t find_change;
+   if (!find_change)
+      find_change = find_change_func();
+
+   uint32_t *last = NULL;
+   uint32_t *out = encode_spans(find_change, (uint32_t*)delta, &last,
+         (const uint32_t*)old_state, (const uint32_t*)new_state, 0, state_size / sizeof(uint32_t));
+   return (uint8_t*)out - (uint8_t*)delta;
+}
+
+void state_delta_apply(void *state, const void *delta, size_t delta_size)
+{
+   xor_spans((uint32_t*)state, (const uint32_t*)delta, delta_size);
+}
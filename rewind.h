@@ -21,11 +21,50 @@
 
 typedef struct state_manager state_manager_t;
 
+struct state_manager_region
+{
+   const void *data;
+   size_t size;
+};
+
 // Always pass in at least 4-byte aligned data and sizes!
 
-state_manager_t *state_manager_new(size_t state_size, size_t buffer_size, void *init_buffer);
+// compression is one of "none", "fast" or "zlib" (if built with zlib support).
+// buffer_size is used as is; it is not rounded to any power of two.
+// Every keyframe_interval states, a full copy of the state is stored to speed up seeking (0 disables).
+// If backing_file is set, the buffer is a shared mapping of that file rather than anonymous memory,
+// so a huge buffer only keeps the recently used part resident (NULL or empty uses RAM).
+state_manager_t *state_manager_new(size_t state_size, size_t buffer_size, void *init_buffer,
+      const char *compression, unsigned keyframe_interval, const char *backing_file);
 void state_manager_free(state_manager_t *state);
 bool state_manager_pop(state_manager_t *state, void **data);
 bool state_manager_push(state_manager_t *state, const void *data);
 
+// Pushes a state made up of several regions back to back, without gathering them into one buffer first.
+// The regions are diffed in place, so they can point straight into the core's memory.
+// Sizes must be multiples of 4, and add up to state_size. This is never done on the worker thread.
+bool state_manager_push_regions(state_manager_t *state, const struct state_manager_region *regions, unsigned num_regions);
+
+// Goes back frames_back states in one go, dropping every state newer than that.
+// The state is rebuilt from the nearest keyframe, so at most keyframe_interval / 2 deltas are applied.
+// frames_back is clamped to the oldest state in the buffer.
+bool state_manager_seek(state_manager_t *state, unsigned frames_back, void **data);
+
+// Returns a buffer of state_size bytes to serialize the next state into before passing it to
+// state_manager_push(). This avoids having to copy states when a worker thread is used.
+// The same buffer is returned until it has been pushed, so a capture which fails can simply be dropped.
+// Returns NULL if no worker thread is running, as any buffer of the caller's will do then.
+void *state_manager_get_capture_buffer(state_manager_t *state);
+
+// Generates (and compresses) deltas on a worker thread. state_manager_push() then only hands
+// the state over, and state_manager_pop() waits for outstanding pushes before popping.
+// Pushed data must come from state_manager_get_capture_buffer() in this mode.
+bool state_manager_start_thread(state_manager_t *state);
+
+// The span encoded xor deltas used by the state manager, for other users of save state history.
+// A delta takes old_state to new_state and back again. States must be 4-byte aligned and sized.
+size_t state_delta_max_size(size_t state_size);
+size_t state_delta_generate(void *delta, const void *old_state, const void *new_state, size_t state_size);
+void state_delta_apply(void *state, const void *delta, size_t delta_size);
+
 #endif
@@ -199,14 +199,22 @@ void config_set_defaults(void)
       strlcpy(g_settings.audio.device, audio_device, sizeof(g_settings.audio.device));
    g_settings.audio.latency = out_latency;
    g_settings.audio.sync = audio_sync;
+   g_settings.audio.threaded = audio_threaded;
    g_settings.audio.rate_control = rate_control;
    g_settings.audio.rate_control_delta = rate_control_delta;
+   g_settings.audio.rate_control_pi = rate_control_pi;
+   g_settings.audio.rate_control_latency = rate_control_latency;
    g_settings.audio.volume = audio_volume;
    strlcpy(g_settings.audio.resampler, audio_resampler, sizeof(g_settings.audio.resampler));
+   g_settings.audio.resampler_quality = audio_resampler_quality;
 
    g_settings.rewind_enable = rewind_enable;
    g_settings.rewind_buffer_size = rewind_buffer_size;
    g_settings.rewind_granularity = rewind_granularity;
+   g_settings.rewind_budget = rewind_budget;
+   strlcpy(g_settings.rewind_compression, rewind_compression, sizeof(g_settings.rewind_compression));
+   g_settings.rewind_threaded = rewind_threaded;
+   g_settings.rewind_keyframe_interval = rewind_keyframe_interval;
    g_settings.slowmotion_ratio = slowmotion_ratio;
    g_settings.pause_nonactive = pause_nonactive;
    g_settings.autosave_interval = autosave_interval;
@@ -233,6 +241,10 @@ void config_set_defaults(void)
 
    g_settings.input.axis_threshold = axis_threshold;
    g_settings.input.netplay_client_swap_input = netplay_client_swap_input;
+   g_settings.netplay_max_spectators = netplay_max_spectators;
+   g_settings.netplay_input_delay = netplay_input_delay;
+   g_settings.netplay_input_delay_auto = netplay_input_delay_auto;
+   g_settings.netplay_late_join = netplay_late_join;
    g_settings.input.turbo_period = turbo_period;
    g_settings.input.turbo_duty_cycle = turbo_duty_cycle;
    g_settings.input.overlay_opacity = 1.0f;
@@ -627,6 +639,10 @@ bool config_load_file(const char *path)
 
    CONFIG_GET_FLOAT(input.axis_threshold, "input_axis_threshold");
    CONFIG_GET_BOOL(input.netplay_client_swap_input, "netplay_client_swap_input");
+   CONFIG_GET_INT(netplay_max_spectators, "netplay_max_spectators");
+   CONFIG_GET_INT(netplay_input_delay, "netplay_input_delay");
+   CONFIG_GET_BOOL(netplay_input_delay_auto, "netplay_input_delay_auto");
+   CONFIG_GET_BOOL(netplay_late_join, "netplay_late_join");
 
    for (unsigned i = 0; i < MAX_PLAYERS; i++)
    {
@@ -642,10 +658,14 @@ bool config_load_file(const char *path)
    CONFIG_GET_STRING(audio.device, "audio_device");
    CONFIG_GET_INT(audio.latency, "audio_latency");
    CONFIG_GET_BOOL(audio.sync, "audio_sync");
+   CONFIG_GET_BOOL(audio.threaded, "audio_threaded");
    CONFIG_GET_BOOL(audio.rate_control, "audio_rate_control");
    CONFIG_GET_FLOAT(audio.rate_control_delta, "audio_rate_control_delta");
+   CONFIG_GET_BOOL(audio.rate_control_pi, "audio_rate_control_pi");
+   CONFIG_GET_INT(audio.rate_control_latency, "audio_rate_control_latency");
    CONFIG_GET_FLOAT(audio.volume, "audio_volume");
    CONFIG_GET_STRING(audio.resampler, "audio_resampler");
+   CONFIG_GET_INT(audio.resampler_quality, "audio_resampler_quality");
 
    CONFIG_GET_STRING(video.driver, "video_driver");
    CONFIG_GET_STRING(audio.driver, "audio_driver");
@@ -669,6 +689,11 @@ bool config_load_file(const char *path)
       g_settings.rewind_buffer_size = buffer_size * UINT64_C(1000000);
 
    CONFIG_GET_INT(rewind_granularity, "rewind_granularity");
+   CONFIG_GET_FLOAT(rewind_budget, "rewind_budget");
+   CONFIG_GET_STRING(rewind_compression, "rewind_compression");
+   CONFIG_GET_BOOL(rewind_threaded, "rewind_threaded");
+   CONFIG_GET_INT(rewind_keyframe_interval, "rewind_keyframe_interval");
+   CONFIG_GET_PATH(rewind_backing_file, "rewind_backing_file");
    CONFIG_GET_FLOAT(slowmotion_ratio, "slowmotion_ratio");
    if (g_settings.slowmotion_ratio < 1.0f)
       g_settings.slowmotion_ratio = 1.0f;
@@ -1176,6 +1201,11 @@ bool config_save_file(const char *path)
    config_set_string(conf, "cheat_database_path", g_settings.cheat_database);
    config_set_bool(conf, "rewind_enable", g_settings.rewind_enable);
    config_set_int(conf, "rewind_granularity", g_settings.rewind_granularity);
+   config_set_float(conf, "rewind_budget", g_settings.rewind_budget);
+   config_set_string(conf, "rewind_compression", g_settings.rewind_compression);
+   config_set_bool(conf, "rewind_threaded", g_settings.rewind_threaded);
+   config_set_int(conf, "rewind_keyframe_interval", g_settings.rewind_keyframe_interval);
+   config_set_string(conf, "rewind_backing_file", g_settings.rewind_backing_file);
    config_set_string(conf, "video_cg_shader", g_settings.video.cg_shader_path);
    config_set_float(conf, "video_aspect_ratio", g_settings.video.aspect_ratio);
 #ifdef HAVE_FBO
@@ -1189,10 +1219,14 @@ bool config_save_file(const char *path)
    config_set_bool(conf, "video_vsync", g_settings.video.vsync);
    config_set_int(conf, "aspect_ratio_index", g_settings.video.aspect_ratio_idx);
    config_set_string(conf, "audio_device", g_settings.audio.device);
+   config_set_bool(conf, "audio_threaded", g_settings.audio.threaded);
    config_set_bool(conf, "audio_rate_control", g_settings.audio.rate_control);
    config_set_float(conf, "audio_rate_control_delta", g_settings.audio.rate_control_delta);
+   config_set_bool(conf, "audio_rate_control_pi", g_settings.audio.rate_control_pi);
+   config_set_int(conf, "audio_rate_control_latency", g_settings.audio.rate_control_latency);
    config_set_string(conf, "system_directory", g_settings.system_directory);
    config_set_string(conf, "audio_resampler", g_settings.audio.resampler);
+   config_set_int(conf, "audio_resampler_quality", g_settings.audio.resampler_quality);
 
 #ifdef ANDROID
    config_set_int(conf, "input_autodetect_icade_profile_pad1", input.icade_profile[0]);
@@ -0,0 +1,409 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2013 - Hans-Kristian Arntzen
+ * 
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Runs a fake emulation loop that writes one video frame worth of audio per iteration,
+// once straight into an audio driver and once through the threaded audio wrapper.
+// Prints how long the main thread spends blocked in write(), and how regular the frame pacing is.
+// The loop is either paced by audio alone (audio sync), or by a 60 Hz clock as with vsync
+// and dynamic rate control, where audio should never block it.
+//
+// The null driver is the baseline. Two simulated devices model the blocking behaviour of real ones:
+// "period" frees its buffer a hardware period at a time (ALSA, OSS), and "stall" consumes
+// smoothly, but every so often takes a long time to accept data (PulseAudio, JACK, OpenAL).
+// Real drivers which are built in are tried as well, and skipped if they can't be opened.
+// Simulated devices check that every sample arrives in order.
+
+#ifdef HAVE_CONFIG_H
+#include "../../config.h"
+#endif
+
+#include "../../general.h"
+#include "../../driver.h"
+#include "../../audio/thread_wrapper.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+struct settings g_settings;
+struct global g_extern;
+
+extern const audio_driver_t audio_null;
+#ifdef HAVE_OSS
+extern const audio_driver_t audio_oss;
+#endif
+
+#define OUT_RATE 48000
+#define FPS 60
+#define FRAMES_PER_VIDEO_FRAME (OUT_RATE / FPS)
+#define LATENCY 64
+#define EMULATE_USEC 2000
+#define WARMUP_FRAMES 15
+
+#define STALL_INTERVAL_MS 250
+#define STALL_MS 20
+
+static int64_t time_usec(void)
+{
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return (int64_t)tv.tv_sec * 1000000 + tv.tv_nsec / 1000;
+}
+
+static void sleep_usec(int64_t usec)
+{
+   if (usec <= 0)
+      return;
+   struct timespec tv = { usec / 1000000, (usec % 1000000) * 1000 };
+   nanosleep(&tv, NULL);
+}
+
+typedef struct sim_audio
+{
+   bool period_based;
+   bool stalls;
+   size_t capacity; // In frames.
+   size_t period;
+
+   int64_t last_time;
+   int64_t played_usec; // Time worth of audio played since the queue was last empty, for period rounding.
+   size_t queued;
+   uint64_t written;
+   uint64_t next_stall;
+   unsigned underruns;
+
+   int16_t expected;
+   bool corrupt;
+} sim_audio_t;
+
+static bool sim_period = true;
+// Results of the last simulated device which was freed.
+static bool sim_corrupt;
+static unsigned sim_underruns;
+
+static void *sim_init(const char *device, unsigned rate, unsigned latency)
+{
+   (void)device;
+   sim_audio_t *sim = (sim_audio_t*)calloc(1, sizeof(*sim));
+   if (!sim)
+      return NULL;
+
+   sim->period_based = sim_period;
+   sim->stalls       = !sim_period;
+   sim->capacity     = (size_t)rate * latency / 1000;
+   sim->period       = sim->capacity / 4;
+   sim->next_stall   = (uint64_t)rate * STALL_INTERVAL_MS / 1000;
+   sim->last_time    = time_usec();
+   return sim;
+}
+
+// Plays back whatever the device would have played since the last call.
+static void sim_update(sim_audio_t *sim)
+{
+   int64_t now = time_usec();
+   int64_t elapsed = now - sim->last_time;
+   sim->last_time = now;
+
+   if (!sim->queued)
+   {
+      sim->played_usec = 0;
+      return;
+   }
+
+   // Hardware pointer only moves a period at a time.
+   int64_t before = sim->played_usec * OUT_RATE / 1000000;
+   sim->played_usec += elapsed;
+   int64_t after = sim->played_usec * OUT_RATE / 1000000;
+   size_t played = after - before;
+   if (sim->period_based)
+      played = (after / sim->period - before / sim->period) * sim->period;
+
+   if (played >= sim->queued)
+   {
+      sim->queued = 0;
+      sim->underruns++;
+      sim->played_usec = 0;
+   }
+   else
+      sim->queued -= played;
+}
+
+static ssize_t sim_write(void *data, const void *buf, size_t size)
+{
+   sim_audio_t *sim = (sim_audio_t*)data;
+   const int16_t *samples = (const int16_t*)buf;
+   size_t frames = size / (2 * sizeof(int16_t));
+
+   for (size_t i = 0; i < 2 * frames; i++)
+   {
+      if (samples[i] != sim->expected)
+         sim->corrupt = true;
+      sim->expected = samples[i] + 1;
+   }
+
+   if (sim->stalls && sim->written >= sim->next_stall)
+   {
+      sleep_usec(STALL_MS * 1000);
+      sim->next_stall += (uint64_t)OUT_RATE * STALL_INTERVAL_MS / 1000;
+   }
+
+   size_t done = 0;
+   while (done < frames)
+   {
+      sim_update(sim);
+      size_t avail = sim->capacity - sim->queued;
+      size_t amt = min(avail, frames - done);
+      if (!amt)
+      {
+         // Sleep until the next frame or period is played back.
+         size_t unit = sim->period_based ? sim->period : 1;
+         int64_t played = sim->played_usec * OUT_RATE / 1000000;
+         size_t wait = unit - played % unit;
+         sleep_usec((int64_t)wait * 1000000 / OUT_RATE + 1);
+         continue;
+      }
+
+      sim->queued  += amt;
+      sim->written += amt;
+      done += amt;
+   }
+
+   return size;
+}
+
+static bool sim_stop(void *data)
+{
+   (void)data;
+   return true;
+}
+
+static bool sim_start(void *data)
+{
+   (void)data;
+   return true;
+}
+
+static void sim_set_nonblock_state(void *data, bool state)
+{
+   (void)data;
+   (void)state;
+}
+
+static void sim_free(void *data)
+{
+   sim_audio_t *sim = (sim_audio_t*)data;
+   sim_corrupt   = sim->corrupt;
+   sim_underruns = sim->underruns;
+   free(sim);
+}
+
+static bool sim_use_float(void *data)
+{
+   (void)data;
+   return false;
+}
+
+static size_t sim_write_avail(void *data)
+{
+   sim_audio_t *sim = (sim_audio_t*)data;
+   sim_update(sim);
+   return (sim->capacity - sim->queued) * 2 * sizeof(int16_t);
+}
+
+static size_t sim_buffer_size(void *data)
+{
+   sim_audio_t *sim = (sim_audio_t*)data;
+   return sim->capacity * 2 * sizeof(int16_t);
+}
+
+static const audio_driver_t audio_sim = {
+   sim_init,
+   sim_write,
+   sim_stop,
+   sim_start,
+   sim_set_nonblock_state,
+   sim_free,
+   sim_use_float,
+   "sim",
+   sim_write_avail,
+   sim_buffer_size,
+};
+
+struct stats
+{
+   double mean;
+   double dev;
+   double max;
+};
+
+static void compute_stats(const int64_t *samples, unsigned count, struct stats *out)
+{
+   double sum = 0.0, sum_sq = 0.0, max = 0.0;
+   for (unsigned i = 0; i < count; i++)
+   {
+      double v = samples[i] / 1000.0;
+      sum += v;
+      sum_sq += v * v;
+      if (v > max)
+         max = v;
+   }
+
+   out->mean = sum / count;
+   out->dev  = sqrt(fabs(sum_sq / count - out->mean * out->mean));
+   out->max  = max;
+}
+
+static void emulate(void)
+{
+   int64_t end = time_usec() + EMULATE_USEC;
+   while (time_usec() < end);
+}
+
+// Returns false if the run failed, true if it ran or the driver isn't available.
+static bool run(const char *name, const audio_driver_t *drv, bool threaded, bool vsync, unsigned frames)
+{
+   const audio_driver_t *out = drv;
+   void *data = NULL;
+
+   if (threaded)
+      rarch_threaded_audio_init(&out, &data, NULL, OUT_RATE, LATENCY, drv);
+   else
+      data = drv->init(NULL, OUT_RATE, LATENCY);
+
+   if (!data)
+   {
+      printf("%-8s %-8s   (not available)\n", name, threaded ? "threaded" : "direct");
+      return true;
+   }
+
+   bool use_float = out->use_float && out->use_float(data);
+   size_t frame_size = use_float ? 2 * sizeof(float) : 2 * sizeof(int16_t);
+   size_t chunk_size = FRAMES_PER_VIDEO_FRAME * frame_size;
+   uint8_t *chunk = (uint8_t*)calloc(1, chunk_size);
+   int64_t *write_time = (int64_t*)calloc(frames, sizeof(int64_t));
+   int64_t *frame_time = (int64_t*)calloc(frames, sizeof(int64_t));
+   int16_t counter = 0;
+   bool ok = chunk && write_time && frame_time;
+
+   int64_t last = time_usec();
+   int64_t next_vsync = last;
+   // With video sync, rate control would keep the buffers half full.
+   // Start out there, rather than empty.
+   unsigned prefill = vsync ? (OUT_RATE * LATENCY / 2000) / FRAMES_PER_VIDEO_FRAME : 0;
+
+   for (unsigned i = 0; ok && i < frames; i++)
+   {
+      emulate();
+
+      int64_t start = 0;
+      for (unsigned j = 0; ok && j <= (i ? 0 : prefill); j++)
+      {
+         if (!use_float)
+         {
+            int16_t *samples = (int16_t*)chunk;
+            for (unsigned s = 0; s < 2 * FRAMES_PER_VIDEO_FRAME; s++)
+               samples[s] = counter++;
+         }
+
+         start = time_usec();
+         if (out->write(data, chunk, chunk_size) != (ssize_t)chunk_size)
+         {
+            fprintf(stderr, "%s: write() failed.\n", name);
+            ok = false;
+         }
+      }
+      int64_t now = time_usec();
+      write_time[i] = now - start;
+
+      if (vsync)
+      {
+         next_vsync += 1000000 / FPS;
+         if (next_vsync < now)
+            next_vsync = now; // Missed it, don't try to catch up.
+         sleep_usec(next_vsync - now);
+         now = time_usec();
+      }
+
+      frame_time[i] = now - last;
+      last = now;
+   }
+
+   // Give the wrapper time to drain into the device before checking it.
+   if (threaded)
+      sleep_usec(LATENCY * 1000);
+   out->free(data);
+
+   if (ok)
+   {
+      struct stats w, f;
+      compute_stats(write_time + WARMUP_FRAMES, frames - WARMUP_FRAMES, &w);
+      compute_stats(frame_time + WARMUP_FRAMES, frames - WARMUP_FRAMES, &f);
+      printf("%-8s %-8s %8.3f %8.3f %8.3f   %8.3f %8.3f %8.3f", name, threaded ? "threaded" : "direct",
+            w.mean, w.dev, w.max, f.mean, f.dev, f.max);
+      if (drv == &audio_sim)
+         printf(" %6u", sim_underruns);
+      printf("\n");
+   }
+
+   if (drv == &audio_sim && sim_corrupt)
+   {
+      fprintf(stderr, "%s: samples arrived out of order.\n", name);
+      ok = false;
+   }
+
+   free(chunk);
+   free(write_time);
+   free(frame_time);
+   return ok;
+}
+
+int main(int argc, char *argv[])
+{
+   double seconds = argc > 1 ? strtod(argv[1], NULL) : 2.0;
+   unsigned frames = (unsigned)(seconds * FPS);
+   if (frames <= WARMUP_FRAMES)
+      frames = WARMUP_FRAMES + 1;
+
+   printf("%u Hz, %u ms latency, %u frames per video frame, %u ms emulation per frame.\n",
+         OUT_RATE, LATENCY, FRAMES_PER_VIDEO_FRAME, EMULATE_USEC / 1000);
+   printf("%-8s %-8s %26s   %26s\n", "", "", "blocked in write (ms)", "frame time (ms)");
+   printf("%-8s %-8s %8s %8s %8s   %8s %8s %8s %6s\n", "driver", "mode",
+         "mean", "stddev", "max", "mean", "stddev", "max", "xruns");
+
+   bool ok = true;
+   for (unsigned vsync = 0; vsync < 2; vsync++)
+   {
+      printf("%s\n", vsync ? "Video sync:" : "Audio sync:");
+      for (unsigned threaded = 0; threaded < 2; threaded++)
+         ok &= run("null", &audio_null, threaded, vsync, frames);
+#ifdef HAVE_OSS
+      for (unsigned threaded = 0; threaded < 2; threaded++)
+         ok &= run("oss", &audio_oss, threaded, vsync, frames);
+#endif
+
+      sim_period = true;
+      for (unsigned threaded = 0; threaded < 2; threaded++)
+         ok &= run("period", &audio_sim, threaded, vsync, frames);
+
+      sim_period = false;
+      for (unsigned threaded = 0; threaded < 2; threaded++)
+         ok &= run("stall", &audio_sim, threaded, vsync, frames);
+   }
+
+   printf("%s\n", ok ? "PASS" : "FAIL");
+   return ok ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2013 - Hans-Kristian Arntzen
+ * 
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Streams a counter through a small fifo_buffer from one thread to another,
+// the way the threaded audio drivers do, once with every operation under a lock
+// and a condition variable, and once with the lock-free fifo and its wait helpers.
+// Every word must arrive in order. Prints the throughput of both.
+
+#ifdef HAVE_CONFIG_H
+#include "../../config.h"
+#endif
+
+#include "../../fifo_buffer.h"
+#include "../../thread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define FIFO_SIZE (8 * 1024)
+#define TOTAL_WORDS (32 * 1024 * 1024)
+
+struct bench
+{
+   fifo_buffer_t *fifo;
+   bool locked;
+   slock_t *lock;
+   scond_t *cond;
+
+   size_t write_chunk;
+   size_t read_chunk;
+   volatile bool failed;
+};
+
+static int64_t time_usec(void)
+{
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return (int64_t)tv.tv_sec * 1000000 + tv.tv_nsec / 1000;
+}
+
+static void bench_write(struct bench *b, const uint8_t *data, size_t size)
+{
+   while (size)
+   {
+      size_t avail;
+      if (b->locked)
+      {
+         slock_lock(b->lock);
+         while (!(avail = fifo_write_avail(b->fifo)))
+            scond_wait(b->cond, b->lock);
+         if (avail > size)
+            avail = size;
+         fifo_write(b->fifo, data, avail);
+         scond_signal(b->cond);
+         slock_unlock(b->lock);
+      }
+      else
+      {
+         // Waiting for the whole chunk halves the wakeups compared to taking any space.
+         avail = fifo_wait_write_avail(b->fifo, size);
+         if (avail > size)
+            avail = size;
+         fifo_write(b->fifo, data, avail);
+      }
+
+      data += avail;
+      size -= avail;
+   }
+}
+
+static void bench_read(struct bench *b, uint8_t *data, size_t size)
+{
+   if (b->locked)
+   {
+      slock_lock(b->lock);
+      while (fifo_read_avail(b->fifo) < size)
+         scond_wait(b->cond, b->lock);
+      fifo_read(b->fifo, data, size);
+      scond_signal(b->cond);
+      slock_unlock(b->lock);
+   }
+   else
+   {
+      fifo_wait_read_avail(b->fifo, size);
+      fifo_read(b->fifo, data, size);
+   }
+}
+
+static void consumer_thread(void *data)
+{
+   struct bench *b = (struct bench*)data;
+   uint32_t *buf = (uint32_t*)malloc(b->read_chunk);
+   size_t words = b->read_chunk / sizeof(uint32_t);
+
+   uint32_t expected = 0;
+   while (expected < TOTAL_WORDS)
+   {
+      bench_read(b, (uint8_t*)buf, b->read_chunk);
+      for (size_t i = 0; i < words; i++, expected++)
+      {
+         if (buf[i] != expected && !b->failed)
+         {
+            fprintf(stderr, "Got word %u, expected %u.\n", buf[i], expected);
+            b->failed = true;
+         }
+      }
+   }
+
+   free(buf);
+}
+
+static bool run_bench(bool locked, size_t write_chunk, size_t read_chunk)
+{
+   struct bench b = {0};
+   b.fifo = fifo_new(FIFO_SIZE);
+   b.locked = locked;
+   b.lock = slock_new();
+   b.cond = scond_new();
+   b.write_chunk = write_chunk;
+   b.read_chunk = read_chunk;
+
+   uint32_t *buf = (uint32_t*)malloc(write_chunk);
+   size_t words = write_chunk / sizeof(uint32_t);
+
+   int64_t start = time_usec();
+   sthread_t *thread = sthread_create(consumer_thread, &b);
+
+   for (uint32_t word = 0; word < TOTAL_WORDS; )
+   {
+      for (size_t i = 0; i < words; i++)
+         buf[i] = word++;
+      bench_write(&b, (const uint8_t*)buf, write_chunk);
+   }
+
+   sthread_join(thread);
+   int64_t usec = time_usec() - start;
+
+   printf("%-9s write %5u, read %5u: %7.1f MB/s\n", locked ? "Locked" : "Lock-free",
+         (unsigned)write_chunk, (unsigned)read_chunk,
+         (double)TOTAL_WORDS * sizeof(uint32_t) / usec);
+
+   free(buf);
+   scond_free(b.cond);
+   slock_free(b.lock);
+   fifo_free(b.fifo);
+
+   return !b.failed;
+}
+
+int main(void)
+{
+   // Small writes like a core pushing a frame of audio at a time,
+   // and period sized reads like a sound card thread.
+   static const size_t chunks[][2] = {
+      { 64, 1024 },
+      { 256, 1024 },
+      { 2048, 2048 },
+   };
+
+   bool ok = true;
+   for (unsigned i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+   {
+      ok &= run_bench(true, chunks[i][0], chunks[i][1]);
+      ok &= run_bench(false, chunks[i][0], chunks[i][1]);
+   }
+
+   if (!ok)
+   {
+      fprintf(stderr, "FAIL: Data was corrupted.\n");
+      return 1;
+   }
+
+   printf("PASS\n");
+   return 0;
+}
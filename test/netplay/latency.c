@@ -0,0 +1,760 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2013 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Runs a host and a client in separate processes over loopback, with the UDP traffic going through
+// a shim which delays, jitters and drops packets. Both run a deterministic core which hashes
+// its input into its state, so comparing the state hash of every frame afterwards finds desyncs.
+// Reports how often and how deep netplay rolls back, and how much time that costs.
+
+#include "../../netplay_compat.h"
+#include "../../netplay.h"
+#include "../../general.h"
+#include "../../dynamic.h"
+#include "../../performance.h"
+#include "stubs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#define HOST_PORT 55510
+#define SHIM_PORT 55511
+
+#define MAX_QUEUED_PACKETS 4096
+#define MAX_PACKET_SIZE 1024
+
+struct config
+{
+   unsigned frames;
+   unsigned netplay_frames;
+   unsigned delay_ms;
+   unsigned jitter_ms;
+   float loss;
+   unsigned state_size;
+   unsigned hold_frames;
+   unsigned fps;
+   unsigned seed;
+   unsigned join_frames;
+   unsigned desync_frame;
+};
+
+static struct config conf = {
+   600,  // frames
+   8,    // netplay_frames
+   30,   // delay_ms
+   10,   // jitter_ms
+   5.0f, // loss
+   16 * 1024, // state_size
+   8,    // hold_frames
+   60,   // fps
+   1,    // seed
+   0,    // join_frames
+   0,    // desync_frame
+};
+
+// Deterministic core. Every frame mixes both players' input into the hash and touches some RAM,
+// so a mispredicted frame which isn't replayed correctly shows up as a different hash.
+struct core_state
+{
+   uint32_t frame;
+   uint32_t hash;
+   uint8_t ram[];
+};
+
+static struct core_state *core;
+static uint32_t *history;
+static uint8_t *history_valid; // A late joining client never runs the frames before its state.
+static unsigned history_size;
+static unsigned player;
+static unsigned local_frame;
+
+static uint32_t mix(uint32_t x)
+{
+   x ^= x >> 16;
+   x *= 0x7feb352d;
+   x ^= x >> 15;
+   x *= 0x846ca68b;
+   x ^= x >> 16;
+   return x;
+}
+
+static size_t core_serialize_size(void)
+{
+   return sizeof(*core) + conf.state_size;
+}
+
+static bool core_serialize(void *data, size_t size)
+{
+   if (size < core_serialize_size())
+      return false;
+   memcpy(data, core, core_serialize_size());
+   return true;
+}
+
+static bool core_unserialize(const void *data, size_t size)
+{
+   if (size < core_serialize_size())
+      return false;
+   memcpy(core, data, core_serialize_size());
+   return true;
+}
+
+static void core_run(void)
+{
+   input_poll_net();
+
+   uint32_t input = 0;
+   for (unsigned port = 0; port < 2; port++)
+      for (unsigned id = 0; id < RARCH_FIRST_META_KEY; id++)
+         input |= input_state_net(port, RETRO_DEVICE_JOYPAD, 0, id) ? 1u << (port * 16 + id) : 0;
+
+   core->hash = mix(core->hash ^ input) + core->frame;
+   // Something netplay can't know about, like a core which isn't deterministic.
+   if (player == 1 && conf.desync_frame && core->frame == conf.desync_frame)
+      core->hash ^= 1;
+   for (unsigned i = 0; i < 16; i++)
+      core->ram[mix(core->hash + i) % conf.state_size] ^= (uint8_t)(input >> (i & 15));
+
+   if (core->frame < history_size)
+   {
+      history[core->frame] = core->hash;
+      history_valid[core->frame] = 1;
+   }
+   core->frame++;
+}
+
+// Buttons are held for a while, and change at random. Enough to make prediction fail now and then.
+static int16_t local_input_state(unsigned port, unsigned device, unsigned index, unsigned id)
+{
+   (void)port;
+   (void)device;
+   (void)index;
+   uint32_t r = mix(conf.seed * 0x9e3779b9u + (player << 24) + (id << 20) + local_frame / conf.hold_frames);
+   return (r & 7) == 0;
+}
+
+// The shim. Delays UDP in both directions, with jitter and loss.
+// TCP only gets the fixed delay, and stays in order.
+struct packet
+{
+   rarch_time_t due;
+   bool to_host;
+   size_t size;
+   uint8_t data[MAX_PACKET_SIZE];
+};
+
+struct stream
+{
+   struct packet *queue;
+   unsigned head;
+   unsigned queued;
+};
+
+struct shim
+{
+   int listen_fd;
+   int client_udp; // Talks to the client.
+   int host_udp; // Talks to the host.
+   struct sockaddr_in client_addr;
+   bool has_client_addr;
+   struct sockaddr_in host_addr;
+
+   struct packet *queue;
+   unsigned queued;
+   struct stream tcp;
+
+   unsigned sent;
+   unsigned dropped;
+   uint64_t bytes;
+   volatile bool quit;
+};
+
+static int udp_socket(uint16_t port)
+{
+   int fd = socket(AF_INET, SOCK_DGRAM, 0);
+   struct sockaddr_in addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(port);
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+      return -1;
+   return fd;
+}
+
+static void shim_schedule(struct shim *shim, const uint8_t *data, size_t size, bool to_host)
+{
+   if (rand() < conf.loss / 100.0f * RAND_MAX)
+   {
+      shim->dropped++;
+      return;
+   }
+   if (shim->queued >= MAX_QUEUED_PACKETS)
+      return;
+
+   int delay = conf.delay_ms * 1000;
+   if (conf.jitter_ms)
+      delay += rand() % (2 * conf.jitter_ms * 1000 + 1) - conf.jitter_ms * 1000;
+   if (delay < 0)
+      delay = 0;
+
+   struct packet *packet = &shim->queue[shim->queued++];
+   packet->due = rarch_get_time_usec() + delay;
+   packet->to_host = to_host;
+   packet->size = size;
+   memcpy(packet->data, data, size);
+}
+
+static void shim_send_due(struct shim *shim)
+{
+   rarch_time_t now = rarch_get_time_usec();
+   for (unsigned i = 0; i < shim->queued; )
+   {
+      struct packet *packet = &shim->queue[i];
+      if (packet->due > now)
+      {
+         i++;
+         continue;
+      }
+
+      if (packet->to_host)
+         sendto(shim->host_udp, packet->data, packet->size, 0,
+               (struct sockaddr*)&shim->host_addr, sizeof(shim->host_addr));
+      else if (shim->has_client_addr)
+         sendto(shim->client_udp, packet->data, packet->size, 0,
+               (struct sockaddr*)&shim->client_addr, sizeof(shim->client_addr));
+      shim->sent++;
+      shim->bytes += packet->size;
+
+      *packet = shim->queue[--shim->queued];
+   }
+}
+
+static bool stream_schedule(struct stream *stream, int fd, bool to_host)
+{
+   struct packet *packet = &stream->queue[(stream->head + stream->queued) % MAX_QUEUED_PACKETS];
+   ssize_t ret = recv(fd, packet->data, sizeof(packet->data), 0);
+   if (ret <= 0)
+      return false;
+
+   packet->due = rarch_get_time_usec() + conf.delay_ms * 1000;
+   packet->to_host = to_host;
+   packet->size = ret;
+   stream->queued++;
+   return true;
+}
+
+static bool stream_send_due(struct stream *stream, int client_fd, int host_fd)
+{
+   rarch_time_t now = rarch_get_time_usec();
+   while (stream->queued && stream->queue[stream->head].due <= now)
+   {
+      const struct packet *packet = &stream->queue[stream->head];
+      if (send(packet->to_host ? host_fd : client_fd, packet->data, packet->size, 0) != (ssize_t)packet->size)
+         return false;
+
+      stream->head = (stream->head + 1) % MAX_QUEUED_PACKETS;
+      stream->queued--;
+   }
+   return true;
+}
+
+static void *shim_thread(void *data)
+{
+   struct shim *shim = (struct shim*)data;
+   int client_tcp = -1, host_tcp = -1;
+
+   while (!shim->quit)
+   {
+      fd_set fds;
+      FD_ZERO(&fds);
+      int max_fd = shim->listen_fd;
+      FD_SET(shim->listen_fd, &fds);
+      FD_SET(shim->client_udp, &fds);
+      FD_SET(shim->host_udp, &fds);
+      if (shim->client_udp > max_fd)
+         max_fd = shim->client_udp;
+      if (shim->host_udp > max_fd)
+         max_fd = shim->host_udp;
+      if (client_tcp >= 0 && shim->tcp.queued < MAX_QUEUED_PACKETS)
+      {
+         FD_SET(client_tcp, &fds);
+         FD_SET(host_tcp, &fds);
+         if (client_tcp > max_fd)
+            max_fd = client_tcp;
+         if (host_tcp > max_fd)
+            max_fd = host_tcp;
+      }
+
+      struct timeval tv = { 0, 500 };
+      if (select(max_fd + 1, &fds, NULL, NULL, &tv) < 0)
+         break;
+
+      if (FD_ISSET(shim->listen_fd, &fds) && client_tcp < 0)
+      {
+         client_tcp = accept(shim->listen_fd, NULL, NULL);
+         host_tcp = socket(AF_INET, SOCK_STREAM, 0);
+         struct sockaddr_in addr = shim->host_addr;
+         if (connect(host_tcp, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+         {
+            fprintf(stderr, "Shim failed to connect to host.\n");
+            break;
+         }
+
+         // We already delay everything, don't let Nagle hold back more.
+         int yes = 1;
+         setsockopt(client_tcp, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+         setsockopt(host_tcp, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+         continue;
+      }
+
+      if (client_tcp >= 0 && FD_ISSET(client_tcp, &fds) && !stream_schedule(&shim->tcp, client_tcp, true))
+         break;
+      if (client_tcp >= 0 && FD_ISSET(host_tcp, &fds) && !stream_schedule(&shim->tcp, host_tcp, false))
+         break;
+      if (client_tcp >= 0 && !stream_send_due(&shim->tcp, client_tcp, host_tcp))
+         break;
+
+      uint8_t buf[MAX_PACKET_SIZE];
+      if (FD_ISSET(shim->client_udp, &fds))
+      {
+         socklen_t addrlen = sizeof(shim->client_addr);
+         ssize_t ret = recvfrom(shim->client_udp, buf, sizeof(buf), 0,
+               (struct sockaddr*)&shim->client_addr, &addrlen);
+         if (ret > 0)
+         {
+            shim->has_client_addr = true;
+            shim_schedule(shim, buf, ret, true);
+         }
+      }
+
+      if (FD_ISSET(shim->host_udp, &fds))
+      {
+         ssize_t ret = recv(shim->host_udp, buf, sizeof(buf), 0);
+         if (ret > 0)
+            shim_schedule(shim, buf, ret, false);
+      }
+
+      shim_send_due(shim);
+   }
+
+   if (client_tcp >= 0)
+      close(client_tcp);
+   if (host_tcp >= 0)
+      close(host_tcp);
+   return NULL;
+}
+
+static bool shim_init(struct shim *shim)
+{
+   memset(shim, 0, sizeof(*shim));
+   shim->queue = (struct packet*)calloc(MAX_QUEUED_PACKETS, sizeof(*shim->queue));
+   shim->tcp.queue = (struct packet*)calloc(MAX_QUEUED_PACKETS, sizeof(*shim->tcp.queue));
+
+   shim->host_addr.sin_family = AF_INET;
+   shim->host_addr.sin_port = htons(HOST_PORT);
+   shim->host_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+   struct sockaddr_in addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(SHIM_PORT);
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+   int yes = 1;
+   shim->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+   setsockopt(shim->listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+   if (bind(shim->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(shim->listen_fd, 1) < 0)
+      return false;
+
+   shim->client_udp = udp_socket(SHIM_PORT);
+   shim->host_udp = udp_socket(0);
+   return shim->queue && shim->tcp.queue && shim->client_udp >= 0 && shim->host_udp >= 0;
+}
+
+static void shim_deinit(struct shim *shim)
+{
+   close(shim->listen_fd);
+   close(shim->client_udp);
+   close(shim->host_udp);
+   free(shim->queue);
+   free(shim->tcp.queue);
+}
+
+struct result
+{
+   bool ok;
+   struct netplay_stats stats;
+   uint64_t total_usec;
+};
+
+// Plays one side. Writes the result and frame hashes to out, then waits for the go ahead on in
+// before hanging up, so the other side never sees us leave early.
+static int run_instance(bool host, int out, int in)
+{
+   player = host ? 0 : 1;
+   srand(conf.seed + player);
+
+   core = (struct core_state*)calloc(1, core_serialize_size());
+   // Run a bit past the compared frames so they are all confirmed by real input.
+   unsigned total = conf.frames + conf.netplay_frames + 2;
+   history_size = total;
+   history = (uint32_t*)calloc(history_size, sizeof(uint32_t));
+   history_valid = (uint8_t*)calloc(history_size, 1);
+   g_settings.netplay_late_join = host && conf.join_frames;
+
+   pretro_serialize_size = core_serialize_size;
+   pretro_serialize = core_serialize;
+   pretro_unserialize = core_unserialize;
+   pretro_run = core_run;
+
+   struct retro_callbacks cbs = {0};
+   cbs.state_cb = local_input_state;
+
+   struct result result = {0};
+   netplay_t *handle = netplay_new(host ? NULL : "127.0.0.1", host ? HOST_PORT : SHIM_PORT,
+         conf.netplay_frames, &cbs, false, host ? "host" : "client", 0);
+   g_extern.netplay = handle;
+
+   if (handle)
+   {
+      rarch_time_t frame_usec = 1000000 / conf.fps;
+      rarch_time_t start = rarch_get_time_usec();
+      rarch_time_t next = start;
+
+      // A late joining client starts at the frame the host sent its state at.
+      for (local_frame = 0; core->frame < total; local_frame++)
+      {
+         netplay_pre_frame(handle);
+         pretro_run();
+         netplay_post_frame(handle);
+
+         // Like a frontend synced to vsync, don't run a burst of frames to make up for a hiccup,
+         // such as the host accepting a late joining client.
+         next += frame_usec;
+         rarch_time_t now = rarch_get_time_usec();
+         if (next > now)
+            usleep(next - now);
+         else if (now - next > frame_usec)
+            next = now;
+      }
+
+      result.total_usec = rarch_get_time_usec() - start;
+      netplay_get_stats(handle, &result.stats);
+      result.ok = true;
+   }
+
+   if (write(out, &result, sizeof(result)) != sizeof(result) ||
+         write(out, history, conf.frames * sizeof(uint32_t)) != (ssize_t)(conf.frames * sizeof(uint32_t)) ||
+         write(out, history_valid, conf.frames) != (ssize_t)conf.frames)
+      return 1;
+
+   char go;
+   if (read(in, &go, 1) != 1)
+      return 1;
+
+   if (handle)
+      netplay_free(handle);
+   return 0;
+}
+
+static bool read_all(int fd, void *data_, size_t size)
+{
+   uint8_t *data = (uint8_t*)data_;
+   while (size)
+   {
+      ssize_t ret = read(fd, data, size);
+      if (ret <= 0)
+         return false;
+      data += ret;
+      size -= ret;
+   }
+   return true;
+}
+
+static void print_result(const char *name, const struct result *result)
+{
+   const struct netplay_stats *stats = &result->stats;
+   printf("%s: %u frames, %u replays (%.1f%% of frames), %u frames replayed.\n", name,
+         stats->frames, stats->replays, stats->frames ? 100.0 * stats->replays / stats->frames : 0.0,
+         stats->replayed_frames);
+   printf("   Replay time: %llu usec (%.2f%% of run time, %.1f usec per replay).\n",
+         (unsigned long long)stats->replay_usec,
+         result->total_usec ? 100.0 * stats->replay_usec / result->total_usec : 0.0,
+         stats->replays ? (double)stats->replay_usec / stats->replays : 0.0);
+   printf("   Stalls: %u (%llu usec).\n", stats->stalls, (unsigned long long)stats->stall_usec);
+
+   if (stats->join_state_size)
+   {
+      printf("   State transfer: %u bytes of state as %u bytes in %.1f ms (%.1f KiB/s).\n",
+            (unsigned)stats->join_state_size, (unsigned)stats->join_transfer_size, stats->join_usec / 1000.0,
+            stats->join_usec ? stats->join_transfer_size * 1000000.0 / 1024.0 / stats->join_usec : 0.0);
+      printf("   %u frames while transferring, %.2f ms average", stats->join_frames,
+            stats->join_frames ? stats->join_frame_usec / 1000.0 / stats->join_frames : 0.0);
+      if (stats->join_frame_usec_max)
+         printf(", %.2f ms worst, %.2f ms worst spent sending", stats->join_frame_usec_max / 1000.0,
+               stats->join_send_usec_max / 1000.0);
+      printf(".\n");
+   }
+
+   printf("   State checks: %u hashes (%.1f usec each), %u compared, %u desyncs, %u resyncs.\n",
+         stats->state_hashes, stats->state_hashes ? (double)stats->state_hash_usec / stats->state_hashes : 0.0,
+         stats->state_checks, stats->desyncs, stats->resyncs);
+
+   printf("   Replay depth:");
+   for (unsigned i = 1; i <= NETPLAY_MAX_REPLAY_DEPTH; i++)
+   {
+      if (stats->replay_depth[i])
+         printf(" %u%s:%u", i, i == NETPLAY_MAX_REPLAY_DEPTH ? "+" : "", stats->replay_depth[i]);
+   }
+   printf("\n");
+}
+
+static void print_help(void)
+{
+   puts("Usage: test-latency [options]");
+   puts("\t-f/--frames: Frames to run and compare. Default 600.");
+   puts("\t-F/--netplay-frames: Netplay frames to buffer, as with retroarch -F. Default 8.");
+   puts("\t-d/--delay: One way UDP delay in ms. Default 30.");
+   puts("\t-j/--jitter: Random UDP delay variation in ms, +/-. Default 10.");
+   puts("\t-l/--loss: UDP packet loss in percent. Default 5.");
+   puts("\t-D/--input-delay: Netplay input delay in frames, or \"auto\" to pick it from round trip time. Default 0.");
+   puts("\t-s/--state-size: Core RAM size in bytes. Default 16384.");
+   puts("\t-H/--hold: Frames between input changes. Default 8.");
+   puts("\t-r/--fps: Frame rate. Default 60.");
+   puts("\t-S/--seed: Seed for input and the network shim. Default 1.");
+   puts("\t-J/--join: Let the client join a game in progress after this many frames. Default 0.");
+   puts("\t-X/--desync: Make the client go out of sync on this frame, which netplay has to detect and recover from. Default 0.");
+}
+
+static bool parse_args(int argc, char *argv[])
+{
+   struct option opts[] = {
+      { "frames", 1, NULL, 'f' },
+      { "netplay-frames", 1, NULL, 'F' },
+      { "delay", 1, NULL, 'd' },
+      { "jitter", 1, NULL, 'j' },
+      { "loss", 1, NULL, 'l' },
+      { "input-delay", 1, NULL, 'D' },
+      { "state-size", 1, NULL, 's' },
+      { "hold", 1, NULL, 'H' },
+      { "fps", 1, NULL, 'r' },
+      { "seed", 1, NULL, 'S' },
+      { "join", 1, NULL, 'J' },
+      { "desync", 1, NULL, 'X' },
+      { "help", 0, NULL, 'h' },
+      { NULL, 0, NULL, 0 },
+   };
+
+   int c;
+   while ((c = getopt_long(argc, argv, "f:F:d:j:l:D:s:H:r:S:J:X:h", opts, NULL)) != -1)
+   {
+      switch (c)
+      {
+         case 'f':
+            conf.frames = strtoul(optarg, NULL, 0);
+            break;
+         case 'F':
+            conf.netplay_frames = strtoul(optarg, NULL, 0);
+            break;
+         case 'd':
+            conf.delay_ms = strtoul(optarg, NULL, 0);
+            break;
+         case 'j':
+            conf.jitter_ms = strtoul(optarg, NULL, 0);
+            break;
+         case 'l':
+            conf.loss = strtod(optarg, NULL);
+            break;
+         case 'D':
+            if (strcmp(optarg, "auto") == 0)
+               g_settings.netplay_input_delay_auto = true;
+            else
+               g_settings.netplay_input_delay = strtoul(optarg, NULL, 0);
+            break;
+         case 's':
+            conf.state_size = strtoul(optarg, NULL, 0);
+            break;
+         case 'H':
+            conf.hold_frames = strtoul(optarg, NULL, 0);
+            break;
+         case 'r':
+            conf.fps = strtoul(optarg, NULL, 0);
+            break;
+         case 'S':
+            conf.seed = strtoul(optarg, NULL, 0);
+            break;
+         case 'J':
+            conf.join_frames = strtoul(optarg, NULL, 0);
+            break;
+         case 'X':
+            conf.desync_frame = strtoul(optarg, NULL, 0);
+            break;
+         default:
+            print_help();
+            return false;
+      }
+   }
+
+   if (!conf.frames || !conf.state_size || !conf.hold_frames || !conf.fps || conf.join_frames >= conf.frames ||
+         (conf.desync_frame && (conf.desync_frame <= conf.join_frames || conf.desync_frame >= conf.frames)))
+   {
+      print_help();
+      return false;
+   }
+
+   return true;
+}
+
+int main(int argc, char *argv[])
+{
+   if (!parse_args(argc, argv))
+      return 1;
+
+   stub_init();
+   g_extern.verbose = false;
+   netplay_init_network();
+
+   printf("%u frames at %u fps, %u netplay frames, UDP delay %u +/- %u ms, %.1f%% loss.\n",
+         conf.frames, conf.fps, conf.netplay_frames, conf.delay_ms, conf.jitter_ms, conf.loss);
+   if (g_settings.netplay_input_delay_auto)
+      printf("Input delay picked from round trip time.\n");
+   else
+      printf("Input delay: %u frames.\n", g_settings.netplay_input_delay);
+   if (conf.join_frames)
+      printf("Client joins after %u frames.\n", conf.join_frames);
+   if (conf.desync_frame)
+      printf("Client goes out of sync on frame %u.\n", conf.desync_frame);
+
+   struct shim shim;
+   if (!shim_init(&shim))
+   {
+      fprintf(stderr, "Failed to set up shim.\n");
+      return 1;
+   }
+   srand(conf.seed);
+
+   int results[2][2], go[2][2];
+   pid_t pids[2];
+   for (unsigned i = 0; i < 2; i++)
+   {
+      if (pipe(results[i]) < 0 || pipe(go[i]) < 0)
+         return 1;
+
+      pids[i] = fork();
+      if (pids[i] == 0)
+      {
+         // The host has to be listening before the client connects through the shim.
+         if (i == 1)
+            usleep(100000 + (uint64_t)conf.join_frames * 1000000 / conf.fps);
+         shim_deinit(&shim);
+         _exit(run_instance(i == 0, results[i][1], go[i][0]));
+      }
+
+      // So we see EOF if the child dies.
+      close(results[i][1]);
+      close(go[i][0]);
+   }
+
+   pthread_t thread;
+   pthread_create(&thread, NULL, shim_thread, &shim);
+
+   struct result result[2];
+   uint32_t *hashes[2];
+   uint8_t *valid[2];
+   bool ok = true;
+   for (unsigned i = 0; i < 2; i++)
+   {
+      hashes[i] = (uint32_t*)calloc(conf.frames, sizeof(uint32_t));
+      valid[i] = (uint8_t*)calloc(conf.frames, 1);
+      if (!read_all(results[i][0], &result[i], sizeof(result[i])) ||
+            !read_all(results[i][0], hashes[i], conf.frames * sizeof(uint32_t)) ||
+            !read_all(results[i][0], valid[i], conf.frames) ||
+            !result[i].ok)
+      {
+         fprintf(stderr, "%s did not finish.\n", i ? "Client" : "Host");
+         ok = false;
+      }
+   }
+
+   for (unsigned i = 0; i < 2; i++)
+   {
+      if (write(go[i][1], "", 1) != 1)
+         ok = false;
+   }
+
+   for (unsigned i = 0; i < 2; i++)
+   {
+      int status = 0;
+      waitpid(pids[i], &status, 0);
+   }
+
+   shim.quit = true;
+   pthread_join(thread, NULL);
+
+   if (!ok)
+      return 1;
+
+   print_result("Host", &result[0]);
+   print_result("Client", &result[1]);
+   printf("Shim: %u UDP packets delivered (%.1f bytes on average), %u dropped.\n",
+         shim.sent, shim.sent ? (double)shim.bytes / shim.sent : 0.0, shim.dropped);
+
+   // The client never runs the frames between going out of sync and getting the host's state again.
+   unsigned desync = conf.frames, last_desync = 0, compared = 0;
+   for (unsigned i = 0; i < conf.frames; i++)
+   {
+      if (!valid[0][i] || !valid[1][i])
+         continue;
+
+      compared++;
+      if (hashes[0][i] != hashes[1][i])
+      {
+         if (desync == conf.frames)
+            desync = i;
+         last_desync = i;
+      }
+   }
+
+   if (desync == conf.frames)
+      printf("Desync: none in %u compared frames.\n", compared);
+   else if (conf.desync_frame)
+      printf("Desync: first at frame %u, in sync again from frame %u.\n", desync, last_desync + 1);
+   else
+      printf("Desync: first at frame %u.\n", desync);
+
+   shim_deinit(&shim);
+   for (unsigned i = 0; i < 2; i++)
+   {
+      free(hashes[i]);
+      free(valid[i]);
+   }
+
+   // Without a late join, every frame is compared. Otherwise, the client has to join reasonably soon.
+   bool pass = desync == conf.frames && compared * 2 >= conf.frames - conf.join_frames;
+   if (!conf.join_frames)
+      pass = pass && compared == conf.frames;
+
+   // Checks must never fail on their own, and an injected desync has to be recovered from within two seconds.
+   if (conf.desync_frame)
+      pass = desync >= conf.desync_frame && last_desync < conf.desync_frame + 2 * conf.fps &&
+         result[0].stats.resyncs && result[1].stats.resyncs;
+   else
+      pass = pass && !result[0].stats.desyncs && !result[1].stats.desyncs;
+   printf("%s\n", pass ? "PASS" : "FAIL");
+   return pass ? 0 : 1;
+}
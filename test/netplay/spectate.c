@@ -0,0 +1,292 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2013 - Hans-Kristian Arntzen
+ * 
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Hosts a spectator session over loopback with a legacy spectator reading raw input words
+// as fast as it can, a spectator asking for compact frames, a real spectating netplay client
+// in a child process, and one spectator which never reads after connecting.
+// The host must keep its frame time, stream every input word to both readers intact,
+// drop the slow spectator once its queue overflows, and compact frames must be smaller.
+
+#include "../../netplay_compat.h"
+#include "../../general.h"
+#include "../../performance.h"
+#include "stubs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#define TEST_PORT 55499
+#define TEST_FRAMES 4000
+#define INPUTS_PER_FRAME 128
+#define MAX_FRAME_USEC 5000
+#define FRAME_SLEEP_USEC 1000
+
+static unsigned test_frame;
+static unsigned test_input;
+static volatile bool slow_drain;
+
+enum client_type
+{
+   CLIENT_LEGACY,
+   CLIENT_COMPACT,
+   CLIENT_SLOW
+};
+
+struct client
+{
+   enum client_type type;
+   bool ok;
+   bool dropped;
+   size_t words;
+   size_t bytes;
+};
+
+// Buttons are held for a few frames at a time, like a player would.
+static uint16_t input_value(unsigned frame, unsigned input)
+{
+   return ((frame >> 4) + input) % 5 == 0 ? 1 : 0;
+}
+
+static int16_t test_input_state(unsigned port, unsigned device, unsigned index, unsigned id)
+{
+   (void)port;
+   (void)device;
+   (void)index;
+   (void)id;
+   return input_value(test_frame, test_input++);
+}
+
+static bool recv_exact(int fd, void *data_, size_t size)
+{
+   uint8_t *data = (uint8_t*)data_;
+   while (size)
+   {
+      ssize_t ret = recv(fd, data, size, 0);
+      if (ret <= 0)
+         return false;
+      data += ret;
+      size -= ret;
+   }
+   return true;
+}
+
+static int client_connect(bool compact)
+{
+   int fd = socket(AF_INET, SOCK_STREAM, 0);
+   if (fd < 0)
+      return -1;
+
+   struct sockaddr_in addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(TEST_PORT);
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+   if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+   {
+      close(fd);
+      return -1;
+   }
+
+   // Same handshake as a spectating RetroArch: nick, host nick, then the BSV header and state.
+   uint8_t nick[] = { 4, 't', 'e', 's', 't' };
+   if (compact)
+      nick[0] |= 0x80;
+   uint8_t host_nick[256];
+   uint32_t header[4];
+   uint8_t state[STUB_STATE_SIZE];
+
+   if (send(fd, nick, sizeof(nick), 0) != sizeof(nick) ||
+         !recv_exact(fd, host_nick, 1) ||
+         !recv_exact(fd, host_nick + 1, host_nick[0]) ||
+         !recv_exact(fd, header, sizeof(header)) ||
+         !recv_exact(fd, state, sizeof(state)))
+   {
+      close(fd);
+      return -1;
+   }
+
+   return fd;
+}
+
+static void *client_thread(void *data)
+{
+   struct client *client = (struct client*)data;
+
+   int fd = client_connect(client->type == CLIENT_COMPACT);
+   if (fd < 0)
+      return NULL;
+
+   if (client->type == CLIENT_SLOW)
+   {
+      while (!slow_drain)
+         usleep(1000);
+
+      // Whatever is still in flight arrives, then we should be cut off.
+      struct timeval tv = { 2, 0 };
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+      uint8_t buf[4096];
+      ssize_t ret;
+      while ((ret = recv(fd, buf, sizeof(buf), 0)) > 0);
+      client->dropped = ret == 0;
+      client->ok = true;
+      close(fd);
+      return NULL;
+   }
+
+   if (client->type == CLIENT_COMPACT)
+   {
+      // Decoding is checked by the real client, only count the bandwidth here.
+      uint8_t buf[4096];
+      ssize_t ret;
+      while ((ret = recv(fd, buf, sizeof(buf), 0)) > 0)
+         client->bytes += ret;
+      client->ok = true;
+      close(fd);
+      return NULL;
+   }
+
+   client->ok = true;
+   int16_t word;
+   while (recv_exact(fd, &word, sizeof(word)))
+   {
+      unsigned frame = client->words / INPUTS_PER_FRAME;
+      unsigned input = client->words % INPUTS_PER_FRAME;
+      if ((uint16_t)swap_if_big16(word) != input_value(frame, input))
+         client->ok = false;
+      client->words++;
+      client->bytes += sizeof(word);
+   }
+
+   close(fd);
+   return NULL;
+}
+
+// Spectates like RetroArch does with --spectate, and checks every input word of every frame.
+static int spectate_client(void)
+{
+   struct retro_callbacks cbs = {0};
+   cbs.state_cb = test_input_state;
+
+   netplay_t *handle = netplay_new("127.0.0.1", TEST_PORT, 0, &cbs, true, "client", 0);
+   if (!handle)
+      return 1;
+   g_extern.netplay = handle;
+
+   int ret = 0;
+   for (unsigned frame = 0; frame < TEST_FRAMES; frame++)
+   {
+      netplay_pre_frame(handle);
+      for (unsigned i = 0; i < INPUTS_PER_FRAME; i++)
+      {
+         if ((uint16_t)input_state_spectate_client(0, RETRO_DEVICE_JOYPAD, 0, i & 15) != input_value(frame, i))
+            ret = 1;
+      }
+      netplay_post_frame(handle);
+   }
+
+   netplay_free(handle);
+   return ret;
+}
+
+int main(void)
+{
+   stub_init();
+
+   struct retro_callbacks cbs = {0};
+   cbs.state_cb = test_input_state;
+
+   netplay_t *handle = netplay_new(NULL, TEST_PORT, 0, &cbs, true, "host", 4);
+   if (!handle)
+   {
+      fprintf(stderr, "Failed to host.\n");
+      return 1;
+   }
+   g_extern.netplay = handle;
+
+   pid_t child = fork();
+   if (child == 0)
+      _exit(spectate_client());
+
+   struct client fast = {0};
+   struct client compact = {0};
+   struct client slow = {0};
+   compact.type = CLIENT_COMPACT;
+   slow.type = CLIENT_SLOW;
+
+   pthread_t fast_thread, compact_thread, slow_thread;
+   pthread_create(&fast_thread, NULL, client_thread, &fast);
+   pthread_create(&compact_thread, NULL, client_thread, &compact);
+   pthread_create(&slow_thread, NULL, client_thread, &slow);
+
+   // Let all spectators connect.
+   for (unsigned i = 0; i < 100; i++)
+   {
+      netplay_pre_frame(handle);
+      usleep(10000);
+   }
+
+   rarch_time_t total = 0, worst = 0;
+   size_t sent_words = 0;
+   for (unsigned frame = 0; frame < TEST_FRAMES; frame++)
+   {
+      rarch_time_t start = rarch_get_time_usec();
+
+      test_frame = frame;
+      test_input = 0;
+      netplay_pre_frame(handle);
+      for (unsigned i = 0; i < INPUTS_PER_FRAME; i++)
+         input_state_spectate(0, RETRO_DEVICE_JOYPAD, 0, i & 15);
+      netplay_post_frame(handle);
+
+      rarch_time_t time = rarch_get_time_usec() - start;
+      total += time;
+      if (time > worst)
+         worst = time;
+
+      sent_words += INPUTS_PER_FRAME;
+
+      // Pace frames somewhat like a real core would, so the fast spectator gets to run.
+      usleep(FRAME_SLEEP_USEC);
+   }
+
+   slow_drain = true;
+   pthread_join(slow_thread, NULL);
+
+   netplay_free(handle);
+   pthread_join(fast_thread, NULL);
+   pthread_join(compact_thread, NULL);
+
+   int status = 0;
+   waitpid(child, &status, 0);
+   bool client_ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+   printf("Host frame time: avg %.1f usec, worst %lld usec.\n",
+         (double)total / TEST_FRAMES, (long long)worst);
+   printf("Legacy spectator: %u / %u input words, %s, %.1f bytes per frame.\n",
+         (unsigned)fast.words, (unsigned)sent_words, fast.ok ? "intact" : "CORRUPT",
+         (double)fast.bytes / TEST_FRAMES);
+   printf("Compact spectator: %.1f bytes per frame.\n", (double)compact.bytes / TEST_FRAMES);
+   printf("Spectating client: %s.\n", client_ok ? "intact" : "CORRUPT");
+   printf("Slow spectator: %s.\n", slow.dropped ? "dropped" : "NOT DROPPED");
+
+   bool pass = fast.ok && fast.words == sent_words && compact.ok && compact.bytes &&
+      compact.bytes < fast.bytes && client_ok && slow.ok && slow.dropped && worst < MAX_FRAME_USEC;
+   printf("%s\n", pass ? "PASS" : "FAIL");
+   return pass ? 0 : 1;
+}
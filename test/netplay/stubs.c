@@ -0,0 +1,98 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2013 - Hans-Kristian Arntzen
+ * 
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Just enough of the frontend and a dummy core to run netplay.c outside of RetroArch.
+
+#include "../../general.h"
+#include "../../dynamic.h"
+#include "../../autosave.h"
+#include "stubs.h"
+#include <string.h>
+
+struct settings g_settings;
+struct global g_extern;
+
+static uint8_t core_state[STUB_STATE_SIZE];
+
+static unsigned stub_api_version(void)
+{
+   return RETRO_API_VERSION;
+}
+
+static size_t stub_serialize_size(void)
+{
+   return sizeof(core_state);
+}
+
+static bool stub_serialize(void *data, size_t size)
+{
+   if (size < sizeof(core_state))
+      return false;
+   memcpy(data, core_state, sizeof(core_state));
+   return true;
+}
+
+static bool stub_unserialize(const void *data, size_t size)
+{
+   if (size < sizeof(core_state))
+      return false;
+   memcpy(core_state, data, sizeof(core_state));
+   return true;
+}
+
+static void stub_run(void)
+{
+   core_state[0]++;
+}
+
+static void stub_set_input_state(retro_input_state_t cb)
+{
+   (void)cb;
+}
+
+static void *stub_get_memory_data(unsigned id)
+{
+   (void)id;
+   return NULL;
+}
+
+static size_t stub_get_memory_size(unsigned id)
+{
+   (void)id;
+   return 0;
+}
+
+unsigned (*pretro_api_version)(void) = stub_api_version;
+size_t (*pretro_serialize_size)(void) = stub_serialize_size;
+bool (*pretro_serialize)(void*, size_t) = stub_serialize;
+bool (*pretro_unserialize)(const void*, size_t) = stub_unserialize;
+void (*pretro_run)(void) = stub_run;
+void (*pretro_set_input_state)(retro_input_state_t) = stub_set_input_state;
+void *(*pretro_get_memory_data)(unsigned) = stub_get_memory_data;
+size_t (*pretro_get_memory_size)(unsigned) = stub_get_memory_size;
+
+void lock_autosave(void)
+{}
+
+void unlock_autosave(void)
+{}
+
+void stub_init(void)
+{
+   g_extern.verbose = true;
+   g_extern.system.info.library_name = "stub";
+   g_extern.system.info.library_version = "0";
+   g_extern.msg_queue = msg_queue_new(8);
+}
@@ -0,0 +1,418 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2013 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Pushes randomly changing states into the rewind buffer, and pops and seeks back at random,
+// checking every state we get back against a plain copy of the history. The buffer is small,
+// so old states are dropped and it wraps around all the time. Runs every compression mode,
+// with and without keyframes and the worker thread, and backed by a file.
+// Also round trips random states through state_delta_generate() and state_delta_apply().
+// Takes the seed as an optional argument, so a failure can be reproduced.
+
+#ifdef HAVE_CONFIG_H
+#include "../../config.h"
+#endif
+
+#include "../../rewind.h"
+#include "../../general.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define STATE_WORDS 1024
+#define STATE_SIZE (STATE_WORDS * sizeof(uint32_t))
+#define BUFFER_SIZE (STATE_SIZE * 48)
+#define STEPS 4000
+#define MAX_SEEK 300
+#define MAX_REGIONS 4
+#define DELTA_ROUNDS 2000
+#define BACKING_FILE "rewind-history.tmp"
+
+struct settings g_settings;
+struct global g_extern;
+
+struct config
+{
+   const char *compression;
+   unsigned keyframe_interval;
+   bool threaded;
+   const char *backing_file;
+};
+
+// What the state manager should hold. Word 0 of every state is its position in the history,
+// so we can tell which state we got back, and check it against ours.
+struct history
+{
+   uint32_t *states; // STEPS + 1 states, indexed by position.
+   unsigned pos;     // Position of the manager's current state.
+   unsigned oldest;  // The manager has run out of states before this one.
+   bool first_pop;   // The next pop returns the current state, as after a push.
+   void *dropped;    // Capture buffer which was written to but never pushed.
+
+   unsigned pushes;
+   unsigned pops;
+   unsigned seeks;
+   unsigned exhausted;
+   unsigned drops;
+};
+
+static uint32_t rng_state;
+
+static uint32_t rng(void)
+{
+   // xorshift32
+   rng_state ^= rng_state << 13;
+   rng_state ^= rng_state >> 17;
+   rng_state ^= rng_state << 5;
+   return rng_state;
+}
+
+static unsigned rng_range(unsigned n)
+{
+   return rng() % n;
+}
+
+// Changes a state like a core would: usually a few runs of memory, sometimes scattered words,
+// sometimes nothing, and now and then everything.
+static void mutate(uint32_t *state, size_t words)
+{
+   unsigned kind = rng_range(10);
+
+   if (kind == 0)
+      return;
+   else if (kind == 1)
+   {
+      for (size_t i = 0; i < words; i++)
+         state[i] = rng();
+   }
+   else if (kind <= 3)
+   {
+      unsigned count = 1 + rng_range(64);
+      for (unsigned i = 0; i < count; i++)
+         state[rng_range(words)] ^= 1 + rng_range(0xffff);
+   }
+   else
+   {
+      unsigned runs = 1 + rng_range(8);
+      for (unsigned i = 0; i < runs; i++)
+      {
+         size_t start = rng_range(words);
+         size_t len = 1 + rng_range(64);
+         if (len > words - start)
+            len = words - start;
+         for (size_t j = 0; j < len; j++)
+            state[start + j] = rng();
+      }
+   }
+}
+
+static uint32_t *state_at(struct history *h, unsigned pos)
+{
+   return h->states + (size_t)pos * STATE_WORDS;
+}
+
+static bool check_state(struct history *h, const void *data, unsigned pos, const char *what)
+{
+   if (memcmp(data, state_at(h, pos), STATE_SIZE))
+   {
+      fprintf(stderr, "%s returned a corrupt state at position %u.\n", what, pos);
+      return false;
+   }
+   return true;
+}
+
+static bool do_push(state_manager_t *state, struct history *h, const struct config *config, uint32_t *scratch)
+{
+   uint32_t *buf = (uint32_t*)state_manager_get_capture_buffer(state);
+   if (!buf != !config->threaded)
+   {
+      fprintf(stderr, "Capture buffer is only expected with a worker thread.\n");
+      return false;
+   }
+   if (h->dropped && buf != h->dropped)
+   {
+      fprintf(stderr, "Got another capture buffer before the last one was pushed.\n");
+      return false;
+   }
+   h->dropped = NULL;
+   if (!buf)
+      buf = scratch;
+
+   memcpy(buf, state_at(h, h->pos), STATE_SIZE);
+   mutate(buf, STATE_WORDS);
+   buf[0] = ++h->pos;
+   memcpy(state_at(h, h->pos), buf, STATE_SIZE);
+
+   bool ret;
+   if (rng_range(4))
+      ret = state_manager_push(state, buf);
+   else
+   {
+      // Split the state into regions, the way cores which expose their memory push it.
+      struct state_manager_region regions[MAX_REGIONS];
+      unsigned num_regions = 1 + rng_range(MAX_REGIONS);
+      size_t offset = 0;
+      for (unsigned i = 0; i < num_regions; i++)
+      {
+         size_t size = i + 1 < num_regions ? rng_range(STATE_WORDS - offset + 1) : STATE_WORDS - offset;
+         regions[i].data = buf + offset;
+         regions[i].size = size * sizeof(uint32_t);
+         offset += size;
+      }
+      ret = state_manager_push_regions(state, regions, num_regions);
+   }
+
+   if (!ret)
+   {
+      fprintf(stderr, "Failed to push state %u.\n", h->pos);
+      return false;
+   }
+
+   h->first_pop = true;
+   h->pushes++;
+   return true;
+}
+
+// A capture which fails half way, like a core failing to serialize. The state is never pushed,
+// and is usually dropped while the worker thread is still diffing the previous one.
+// If that one got handed out again, the garbage ends up in its delta.
+static void do_drop_capture(state_manager_t *state, struct history *h)
+{
+   uint32_t *buf = (uint32_t*)state_manager_get_capture_buffer(state);
+   if (!buf)
+      return;
+
+   for (size_t i = 0; i < STATE_WORDS; i++)
+      buf[i] = rng();
+   h->dropped = buf;
+   h->drops++;
+}
+
+static bool do_pop(state_manager_t *state, struct history *h)
+{
+   void *data;
+   bool ret = state_manager_pop(state, &data);
+
+   if (h->first_pop)
+   {
+      if (!ret)
+      {
+         fprintf(stderr, "First pop after a push failed.\n");
+         return false;
+      }
+      h->first_pop = false;
+   }
+   else if (ret)
+   {
+      if (h->pos == h->oldest)
+      {
+         fprintf(stderr, "Popped past the oldest state at position %u.\n", h->pos);
+         return false;
+      }
+      h->pos--;
+   }
+   else
+   {
+      h->oldest = h->pos;
+      h->exhausted++;
+   }
+
+   h->pops++;
+   return check_state(h, data, h->pos, "Pop");
+}
+
+static bool do_seek(state_manager_t *state, struct history *h)
+{
+   unsigned frames_back = rng_range(MAX_SEEK + 1);
+
+   void *data;
+   bool ret = state_manager_seek(state, frames_back, &data);
+   h->first_pop = false;
+   h->seeks++;
+
+   unsigned pos = ((const uint32_t*)data)[0];
+   if (pos > h->pos || pos < h->oldest || h->pos - pos > frames_back)
+   {
+      fprintf(stderr, "Seeking back %u states from position %u ended up at %u.\n", frames_back, h->pos, pos);
+      return false;
+   }
+
+   if (frames_back && ret != (pos < h->pos))
+   {
+      fprintf(stderr, "Seeking back %u states from position %u returned %s.\n",
+            frames_back, h->pos, ret ? "true" : "false");
+      return false;
+   }
+
+   // Seeks are clamped to the oldest state in the buffer, which we only learn about here.
+   if (h->pos - pos < frames_back)
+   {
+      h->oldest = pos;
+      h->exhausted++;
+   }
+
+   h->pos = pos;
+   return check_state(h, data, pos, "Seek");
+}
+
+static bool run_config(const struct config *config)
+{
+   struct history h = {0};
+   h.states = (uint32_t*)calloc(STEPS + 1, STATE_SIZE);
+   uint32_t *scratch = (uint32_t*)malloc(STATE_SIZE);
+   if (!h.states || !scratch)
+      return false;
+
+   for (size_t i = 0; i < STATE_WORDS; i++)
+      h.states[i] = rng();
+   h.states[0] = 0;
+
+   state_manager_t *state = state_manager_new(STATE_SIZE, BUFFER_SIZE, h.states,
+         config->compression, config->keyframe_interval, config->backing_file);
+   bool ok = state;
+   if (ok && config->threaded)
+      ok = state_manager_start_thread(state);
+
+   for (unsigned step = 0; ok && step < STEPS; )
+   {
+      // Play for a while, then rewind for a while, or seek back in one go.
+      unsigned op = rng_range(10);
+      unsigned count = op < 6 ? 1 + rng_range(200) : op < 8 ? 1 + rng_range(60) : 1 + rng_range(4);
+
+      for (unsigned i = 0; ok && i < count && step < STEPS; i++, step++)
+      {
+         if (op < 6)
+         {
+            ok = do_push(state, &h, config, scratch);
+            if (ok && !rng_range(8))
+               do_drop_capture(state, &h);
+         }
+         else if (op < 8)
+            ok = do_pop(state, &h);
+         else
+            ok = do_seek(state, &h);
+      }
+   }
+
+   printf("%-4s, keyframes %2u, %-8s, %-4s: %4u pushes, %5u pops, %3u seeks, %3u dropped, ran out %3u times. %s\n",
+         config->compression, config->keyframe_interval, config->threaded ? "threaded" : "sync",
+         config->backing_file ? "file" : "RAM", h.pushes, h.pops, h.seeks, h.drops, h.exhausted, ok ? "OK" : "FAIL");
+
+   if (state)
+      state_manager_free(state);
+   if (config->backing_file)
+      remove(config->backing_file);
+   free(scratch);
+   free(h.states);
+   return ok;
+}
+
+// A delta must take the old state to the new one and back, and be no larger than promised.
+static bool test_deltas(void)
+{
+   uint32_t *old_state = (uint32_t*)malloc(STATE_SIZE);
+   uint32_t *new_state = (uint32_t*)malloc(STATE_SIZE);
+   uint32_t *tmp = (uint32_t*)malloc(STATE_SIZE);
+   uint32_t *delta = (uint32_t*)malloc(state_delta_max_size(STATE_SIZE));
+   bool ok = old_state && new_state && tmp && delta;
+
+   for (unsigned round = 0; ok && round < DELTA_ROUNDS; round++)
+   {
+      // Odd sizes make sure the SIMD paths handle the tail of the state.
+      size_t words = 1 + rng_range(STATE_WORDS);
+      size_t size = words * sizeof(uint32_t);
+
+      for (size_t i = 0; i < words; i++)
+         old_state[i] = rng();
+      memcpy(new_state, old_state, size);
+      mutate(new_state, words);
+
+      size_t delta_size = state_delta_generate(delta, old_state, new_state, size);
+      if (delta_size > state_delta_max_size(size) || (!memcmp(old_state, new_state, size) != !delta_size))
+      {
+         fprintf(stderr, "Delta of %u bytes for a state of %u bytes.\n", (unsigned)delta_size, (unsigned)size);
+         ok = false;
+         break;
+      }
+
+      memcpy(tmp, old_state, size);
+      state_delta_apply(tmp, delta, delta_size);
+      if (memcmp(tmp, new_state, size))
+      {
+         fprintf(stderr, "Delta did not take the old state to the new one.\n");
+         ok = false;
+         break;
+      }
+
+      state_delta_apply(tmp, delta, delta_size);
+      if (memcmp(tmp, old_state, size))
+      {
+         fprintf(stderr, "Delta did not take the new state back to the old one.\n");
+         ok = false;
+      }
+   }
+
+   printf("state_delta_generate/apply: %u round trips. %s\n", DELTA_ROUNDS, ok ? "OK" : "FAIL");
+
+   free(old_state);
+   free(new_state);
+   free(tmp);
+   free(delta);
+   return ok;
+}
+
+int main(int argc, char *argv[])
+{
+   static const char *compressions[] = {
+      "none",
+      "fast",
+#ifdef HAVE_ZLIB
+      "zlib",
+#endif
+   };
+
+   rng_state = argc > 1 ? strtoul(argv[1], NULL, 0) : (uint32_t)time(NULL);
+   if (!rng_state)
+      rng_state = 1;
+   printf("Seed: %u\n", rng_state);
+
+   bool ok = true;
+   for (unsigned i = 0; i < sizeof(compressions) / sizeof(compressions[0]); i++)
+   {
+      struct config config = { compressions[i] };
+
+      for (unsigned keyframes = 0; keyframes <= 16; keyframes += 16)
+      {
+         config.keyframe_interval = keyframes;
+         config.threaded = false;
+         ok &= run_config(&config);
+#ifdef HAVE_THREADS
+         config.threaded = true;
+         ok &= run_config(&config);
+#endif
+      }
+
+      config.keyframe_interval = 16;
+      config.threaded = false;
+      config.backing_file = BACKING_FILE;
+      ok &= run_config(&config);
+   }
+
+   ok &= test_deltas();
+
+   printf("%s\n", ok ? "PASS" : "FAIL");
+   return ok ? 0 : 1;
+}